@@ -35,9 +35,12 @@ static void __attribute__((noreturn)) usage(int exit_code)
 		s = stdout;
 
 	fprintf(s, "Usage: { { -c CLK_GPIO_ID } { -d DATA_GPIO_ID } |"
-		   " { -k DEVICE_NAME }\n"
+		   " { -k DEVICE_NAME } | { -s STRIP_NAME }\n"
 		   "       [ -n NUM_LEDS (20) ]\n"
 		   "       [ -g CHIP_ID (0) ]\n"
+		   "       [ -r FILE ] record all commits to FILE\n"
+		   "       [ -w FILE ] don't blank the strip, keep the last "
+		   "frame in FILE\n"
 		   "       [ -h ]\n");
 
 	exit(exit_code);
@@ -50,12 +53,14 @@ int main(int argc, char **argv)
 	unsigned int chip = DEFAULT_GPIOCHIP;
 	unsigned int num_leds = DEFAULT_NUM_LEDS;
 	bool kernel_mode = false;
-	const char *device_name;
+	const char *device_name = NULL, *strip_name = NULL, *record = NULL;
+	const char *state = NULL;
+	struct ws2801_recorder recorder;
 	int option, err;
 
 	option = 0;
 
-	while ((option = getopt(argc, argv, "c:d:n:g:k:h")) != -1) {
+	while ((option = getopt(argc, argv, "c:d:n:g:k:s:r:w:h")) != -1) {
 		switch (option) {
 			case 'c':
 				clock = atoi(optarg);
@@ -73,18 +78,34 @@ int main(int argc, char **argv)
 				kernel_mode = true;
 				device_name = optarg;
 				break;
+			case 's':
+				strip_name = optarg;
+				break;
+			case 'r':
+				record = optarg;
+				break;
+			case 'w':
+				state = optarg;
+				break;
 			default:
 				usage(-1);
 		}
 	}
 
 
-	if (kernel_mode) {
+	if (strip_name) {
+		err = ws2801_shm_init(NULL, strip_name, &ws);
+	} else if (kernel_mode) {
 		err = ws2801_kernel_init(num_leds, device_name, &ws);
 	} else {
 		if (clock == -1 || data == -1)
 			usage(-EINVAL);
-		err = ws2801_user_init(num_leds, chip, clock, data, &ws);
+		if (state)
+			err = ws2801_user_attach(num_leds, chip, clock, data,
+						 state, &ws);
+		else
+			err = ws2801_user_init(num_leds, chip, clock, data,
+					       &ws);
 	}
 
 	if (err) {
@@ -92,8 +113,21 @@ int main(int argc, char **argv)
 		return err;
 	}
 
+	if (record) {
+		err = ws2801_record_start(&recorder, &ws, record, 0);
+		if (err) {
+			fprintf(stderr, "recording to %s: %s\n", record,
+				strerror(-err));
+			ws.free(&ws);
+			return err;
+		}
+	}
+
 	err = app(&ws);
 
+	if (record)
+		ws2801_record_stop(&recorder);
+
 	ws.free(&ws);
 
 	return err;
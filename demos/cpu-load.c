@@ -14,11 +14,13 @@
  * the COPYING file in the top-level directory.
  */
 
+#include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
+#include <time.h>
 #include <ws2801.h>
 
 #include "common.h"
@@ -105,15 +107,33 @@ static int get_cpu_usage(struct cpu_stats *stats_prev, double *result)
 	return 0;
 }
 
+#define PERIOD_MS 200
+#define OUTPUT_FPS 50
+
 int app(struct ws2801_driver *ws)
 {
 	int err;
 	struct cpu_stats stats;
+	struct ws2801_interp interp;
+	struct led led, *frame;
+	struct timespec now;
 	double usage;
-	struct led led;
+	unsigned int i;
 
 	led.b = 0;
 
+	frame = malloc(ws->num_leds * sizeof(*frame));
+	if (!frame)
+		return -ENOMEM;
+
+	/* Usage is only sampled every PERIOD_MS, the interpolator fades
+	 * between the samples */
+	err = ws2801_interp_init(&interp, ws, OUTPUT_FPS);
+	if (err) {
+		free(frame);
+		return err;
+	}
+
 	err = get_cpu_stats(&stats);
 	if (err)
 		fprintf(stderr, "Unable to get CPU stats\n");
@@ -134,12 +154,21 @@ int app(struct ws2801_driver *ws)
 		led.r = usage * 255;
 		led.g = 255 - led.r;
 
-		err = ws->full_on(ws, &led);
+		for (i = 0; i < ws->num_leds; i++)
+			frame[i] = led;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		err = ws2801_interp_submit(&interp, frame,
+					   now.tv_sec * 1000000000ULL +
+					   now.tv_nsec +
+					   PERIOD_MS * 1000000ULL);
 		if (err)
 			break;
-		ws->commit(ws);
-		usleep(200000);
+		usleep(PERIOD_MS * 1000);
 	}
 
+	ws2801_interp_free(&interp);
+	free(frame);
+
 	return 0;
 }
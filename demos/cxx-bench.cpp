@@ -0,0 +1,78 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+/* Compares the cost of filling a frame through per-pixel vtable calls with
+ * the C++ interface. Nothing is committed, so only the CPU time of building
+ * frames is measured. */
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include <ws2801.hpp>
+
+extern "C" {
+#include "common.h"
+}
+
+static constexpr std::size_t num_leds = 256;
+static constexpr unsigned int frames = 20000;
+
+template <typename F>
+static double measure(F &&fill_frame)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	for (unsigned int f = 0; f < frames; f++)
+		fill_frame(f);
+
+	std::chrono::duration<double, std::nano> d =
+		std::chrono::steady_clock::now() - start;
+
+	return d.count() / frames;
+}
+
+static led color(unsigned int f, std::size_t i)
+{
+	return { (unsigned char)(f + i), (unsigned char)(f * 2 + i),
+		 (unsigned char)(f * 3 + i) };
+}
+
+extern "C" int app(struct ws2801_driver *ws)
+{
+	ws2801::Strip<num_leds, WS2801_ORDER_GRB> strip(*ws);
+	std::vector<led> buffer(num_leds);
+	double t;
+
+	t = measure([&](unsigned int f) {
+		for (std::size_t i = 0; i < num_leds; i++) {
+			led c = color(f, i);
+			ws->set_led(ws, i, &c);
+		}
+	});
+	printf("set_led() per pixel:    %8.0f ns/frame\n", t);
+
+	t = measure([&](unsigned int f) {
+		for (std::size_t i = 0; i < num_leds; i++)
+			buffer[i] = color(f, i);
+		ws->set_leds(ws, buffer.data(), 0, num_leds);
+	});
+	printf("set_leds() per frame:   %8.0f ns/frame\n", t);
+
+	t = measure([&](unsigned int f) {
+		for (std::size_t i = 0; i < num_leds; i++)
+			strip.set(i, color(f, i));
+		strip.load();
+	});
+	printf("Strip<%zu, GRB>:        %8.0f ns/frame\n", num_leds, t);
+
+	return 0;
+}
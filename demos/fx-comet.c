@@ -0,0 +1,38 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <string.h>
+#include <ws2801.h>
+
+/* LEDs per second */
+#define SPEED 60
+#define TAIL 16
+
+static void render(struct led *out, unsigned int num_leds, uint64_t t_ns)
+{
+	unsigned int i, head, dist, v;
+
+	head = t_ns * SPEED / 1000000000ULL % num_leds;
+
+	memset(out, 0, num_leds * sizeof(*out));
+	for (i = 0; i < TAIL && i < num_leds; i++) {
+		dist = (head + num_leds - i) % num_leds;
+		v = 255 * (TAIL - i) / TAIL;
+		out[dist] = (struct led){ .r = v, .g = v / 2, .b = v / 8 };
+	}
+}
+
+const struct ws2801_effect ws2801_effect = {
+	.abi = WS2801_EFFECT_ABI,
+	.name = "comet",
+	.render = render,
+};
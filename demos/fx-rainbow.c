@@ -0,0 +1,46 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <ws2801.h>
+
+/* One full turn of the hue circle every four seconds */
+#define PERIOD_NS 4000000000ULL
+
+/* Fully saturated color of hue h, 0 to 767 */
+static struct led wheel(unsigned int h)
+{
+	unsigned char x = h & 0xff;
+
+	switch (h >> 8) {
+	case 0:
+		return (struct led){ .r = 255 - x, .g = x, .b = 0 };
+	case 1:
+		return (struct led){ .r = 0, .g = 255 - x, .b = x };
+	default:
+		return (struct led){ .r = x, .g = 0, .b = 255 - x };
+	}
+}
+
+static void render(struct led *out, unsigned int num_leds, uint64_t t_ns)
+{
+	unsigned int i, offset;
+
+	offset = (t_ns % PERIOD_NS) * 768 / PERIOD_NS;
+	for (i = 0; i < num_leds; i++)
+		out[i] = wheel((offset + i * 768 / num_leds) % 768);
+}
+
+const struct ws2801_effect ws2801_effect = {
+	.abi = WS2801_EFFECT_ABI,
+	.name = "rainbow",
+	.render = render,
+};
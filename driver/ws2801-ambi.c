@@ -0,0 +1,314 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ws2801-common.h"
+#include "ws2801-simd.h"
+
+/* 16 bit column sums can take this many rows without overflow */
+#define ROWS_MAX 257
+
+/* The part of the screen whose average is shown by one LED */
+struct ws2801_ambi_region {
+	unsigned int x;
+	unsigned int y;
+	unsigned int width;
+	unsigned int height;
+};
+
+struct ws2801_ambi_priv {
+	struct ws2801_ambi_config cfg;
+	unsigned int stride;
+	unsigned int bytes_per_pixel;
+
+	unsigned int num_regions;
+	struct ws2801_ambi_region *regions;
+
+	/* Column sums of the current region, one per byte */
+	unsigned short *columns;
+
+	/* Smoothed colors in 8.8 fixed point, three per LED */
+	unsigned int *state;
+	bool first;
+	struct led *out;
+};
+
+static inline unsigned char clamp_u8(int x)
+{
+	return x < 0 ? 0 : x > 255 ? 255 : x;
+}
+
+/* columns[i] += src[i] */
+static void add_row(unsigned short *columns, const unsigned char *src,
+		    unsigned int len)
+{
+	unsigned int i;
+	v8u16 acc;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&acc, columns + i, sizeof(acc));
+		acc += v8u16_load(src + i);
+		memcpy(columns + i, &acc, sizeof(acc));
+	}
+
+	for (; i < len; i++)
+		columns[i] += src[i];
+}
+
+/*
+ * Box sum of a region: rows are added up with vectors into column sums,
+ * which are then reduced into one sum per byte of a pixel group, i.e. per
+ * channel for RGB24, or Y0 U Y1 V for YUYV.
+ */
+static void region_sum(struct ws2801_ambi_priv *priv, const unsigned char *frame,
+		       const struct ws2801_ambi_region *r,
+		       unsigned long long sum[4])
+{
+	unsigned int len = r->width * priv->bytes_per_pixel;
+	unsigned int group = priv->cfg.format == WS2801_FORMAT_YUYV ? 4 : 3;
+	const unsigned char *src;
+	unsigned int y, rows, i;
+
+	sum[0] = sum[1] = sum[2] = sum[3] = 0;
+
+	src = frame + r->y * priv->stride + r->x * priv->bytes_per_pixel;
+	for (y = 0; y < r->height; y += rows) {
+		rows = r->height - y;
+		if (rows > ROWS_MAX)
+			rows = ROWS_MAX;
+
+		memset(priv->columns, 0, len * sizeof(*priv->columns));
+		for (i = 0; i < rows; i++, src += priv->stride)
+			add_row(priv->columns, src, len);
+
+		for (i = 0; i < len; i++)
+			sum[i % group] += priv->columns[i];
+	}
+}
+
+/* BT.601, limited range */
+static void yuv_to_rgb(struct led *led, int y, int u, int v)
+{
+	y = 298 * (y - 16) + 128;
+	u -= 128;
+	v -= 128;
+
+	led->r = clamp_u8((y + 409 * v) >> 8);
+	led->g = clamp_u8((y - 100 * u - 208 * v) >> 8);
+	led->b = clamp_u8((y + 516 * u) >> 8);
+}
+
+static void region_average(struct ws2801_ambi_priv *priv,
+			   const unsigned char *frame,
+			   const struct ws2801_ambi_region *r, struct led *led)
+{
+	unsigned long long sum[4], pixels = r->width * r->height;
+
+	region_sum(priv, frame, r, sum);
+
+	if (priv->cfg.format == WS2801_FORMAT_YUYV) {
+		/* Every pixel has a Y, every pair of pixels a U and a V */
+		yuv_to_rgb(led, (sum[0] + sum[2]) / pixels,
+			   sum[1] * 2 / pixels, sum[3] * 2 / pixels);
+	} else {
+		led->r = sum[0] / pixels;
+		led->g = sum[1] / pixels;
+		led->b = sum[2] / pixels;
+	}
+}
+
+static void ws2801_ambi_smooth(struct ws2801_ambi_priv *priv)
+{
+	unsigned int i, s = priv->cfg.smoothing;
+	unsigned char *out = (unsigned char *)priv->out;
+	unsigned int *state = priv->state;
+
+	for (i = 0; i < priv->num_regions * 3; i++) {
+		if (priv->first)
+			state[i] = out[i] << 8;
+		else
+			state[i] = (state[i] * s + (out[i] << 8) * (256 - s))
+				   >> 8;
+		out[i] = (state[i] + 128) >> 8;
+	}
+	priv->first = false;
+}
+
+/* Splits length into num parts, rounded down to multiples of align */
+static inline unsigned int split(unsigned int length, unsigned int num,
+				 unsigned int i, unsigned int align)
+{
+	return (unsigned long long)length * i / num / align * align;
+}
+
+static int ws2801_ambi_layout(struct ws2801_ambi_priv *priv)
+{
+	const struct ws2801_ambi_config *cfg = &priv->cfg;
+	unsigned int i, n = 0, align, depth_x, depth_y, x, y;
+	struct ws2801_ambi_region *r = priv->regions;
+
+	/* YUYV regions must start and end on pixel pairs */
+	align = cfg->format == WS2801_FORMAT_YUYV ? 2 : 1;
+	depth_x = cfg->width * cfg->depth / 100 / align * align;
+	depth_y = cfg->height * cfg->depth / 100;
+	if (!depth_x || !depth_y)
+		return -EINVAL;
+
+	/* Clockwise, starting at the bottom of the left edge */
+	for (i = 0; i < cfg->left; i++, n++) {
+		y = cfg->left - 1 - i;
+		r[n].x = 0;
+		r[n].width = depth_x;
+		r[n].y = split(cfg->height, cfg->left, y, 1);
+		r[n].height = split(cfg->height, cfg->left, y + 1, 1) - r[n].y;
+	}
+
+	for (i = 0; i < cfg->top; i++, n++) {
+		r[n].x = split(cfg->width, cfg->top, i, align);
+		r[n].width = split(cfg->width, cfg->top, i + 1, align) - r[n].x;
+		r[n].y = 0;
+		r[n].height = depth_y;
+	}
+
+	for (i = 0; i < cfg->right; i++, n++) {
+		r[n].x = cfg->width - depth_x;
+		r[n].width = depth_x;
+		r[n].y = split(cfg->height, cfg->right, i, 1);
+		r[n].height = split(cfg->height, cfg->right, i + 1, 1) - r[n].y;
+	}
+
+	for (i = 0; i < cfg->bottom; i++, n++) {
+		x = cfg->bottom - 1 - i;
+		r[n].x = split(cfg->width, cfg->bottom, x, align);
+		r[n].width = split(cfg->width, cfg->bottom, x + 1, align) -
+			     r[n].x;
+		r[n].y = cfg->height - depth_y;
+		r[n].height = depth_y;
+	}
+
+	for (i = 0; i < n; i++)
+		if (!r[i].width || !r[i].height)
+			return -EINVAL;
+
+	return 0;
+}
+
+int ws2801_ambi_init(struct ws2801_ambi *ambi, struct ws2801_driver *ws,
+		     const struct ws2801_ambi_config *cfg)
+{
+	struct ws2801_ambi_priv *priv;
+	unsigned int i, num_regions, max_len = 0;
+	int err;
+
+	num_regions = cfg->left + cfg->top + cfg->right + cfg->bottom;
+	if (!num_regions || num_regions > ws->num_leds)
+		return -EINVAL;
+
+	if (cfg->format > WS2801_FORMAT_YUYV || !cfg->width || !cfg->height ||
+	    !cfg->depth || cfg->depth > 100 || cfg->smoothing > 255)
+		return -EINVAL;
+
+	if (cfg->format == WS2801_FORMAT_YUYV && cfg->width % 2)
+		return -EINVAL;
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv)
+		return -ENOMEM;
+
+	priv->cfg = *cfg;
+	priv->num_regions = num_regions;
+	priv->first = true;
+	priv->bytes_per_pixel = cfg->format == WS2801_FORMAT_YUYV ? 2 : 3;
+	priv->stride = cfg->stride;
+	if (!priv->stride)
+		priv->stride = cfg->width * priv->bytes_per_pixel;
+
+	err = -EINVAL;
+	if (priv->stride < cfg->width * priv->bytes_per_pixel)
+		goto free_out;
+
+	err = -ENOMEM;
+	priv->regions = calloc(num_regions, sizeof(*priv->regions));
+	priv->state = calloc(num_regions * 3, sizeof(*priv->state));
+	priv->out = calloc(num_regions, sizeof(*priv->out));
+	if (!priv->regions || !priv->state || !priv->out)
+		goto free_out;
+
+	err = ws2801_ambi_layout(priv);
+	if (err)
+		goto free_out;
+
+	for (i = 0; i < num_regions; i++)
+		if (priv->regions[i].width > max_len)
+			max_len = priv->regions[i].width;
+	max_len *= priv->bytes_per_pixel;
+
+	err = -ENOMEM;
+	priv->columns = calloc(max_len, sizeof(*priv->columns));
+	if (!priv->columns)
+		goto free_out;
+
+	ambi->ws = ws;
+	ambi->num_leds = num_regions;
+	ambi->priv = priv;
+
+	return 0;
+
+free_out:
+	free(priv->out);
+	free(priv->state);
+	free(priv->regions);
+	free(priv);
+	return err;
+}
+
+void ws2801_ambi_free(struct ws2801_ambi *ambi)
+{
+	struct ws2801_ambi_priv *priv = ambi->priv;
+
+	free(priv->columns);
+	free(priv->out);
+	free(priv->state);
+	free(priv->regions);
+	free(priv);
+}
+
+int ws2801_ambi_submit(struct ws2801_ambi *ambi, const void *frame,
+		       size_t len)
+{
+	struct ws2801_ambi_priv *priv = ambi->priv;
+	const struct ws2801_ambi_config *cfg = &priv->cfg;
+	unsigned int i;
+	int err;
+
+	/* The last line doesn't need to be padded */
+	if (len < (size_t)priv->stride * (cfg->height - 1) +
+		  cfg->width * priv->bytes_per_pixel)
+		return -EINVAL;
+
+	for (i = 0; i < priv->num_regions; i++)
+		region_average(priv, frame, priv->regions + i, priv->out + i);
+
+	if (cfg->smoothing)
+		ws2801_ambi_smooth(priv);
+
+	err = ambi->ws->set_leds(ambi->ws, priv->out, 0, priv->num_regions);
+	if (err < 0)
+		return err;
+
+	ambi->ws->commit(ambi->ws);
+
+	return 0;
+}
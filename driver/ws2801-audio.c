@@ -0,0 +1,394 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ws2801-common.h"
+
+/* Band levels span this range below full scale */
+#define DB_RANGE 60.0f
+
+/* Hue of the lowest and the highest band, red to blue */
+#define HUE_LOW 0
+#define HUE_HIGH 170
+
+struct ws2801_audio_band {
+	/* Bins [lo, hi) of the transform */
+	unsigned int lo;
+	unsigned int hi;
+	float level;
+	struct led color;
+	/* LEDs [first, first + num) of the strip */
+	unsigned int first;
+	unsigned int num;
+};
+
+struct ws2801_audio_priv {
+	struct ws2801_audio_config cfg;
+
+	/* The last fft_size samples, pos is the oldest one */
+	float *ring;
+	unsigned int pos;
+	/* Samples since the last rendered frame */
+	unsigned int pending;
+
+	float *window;
+	/* Scales the power of a full scale sine to 1 */
+	float norm;
+
+	/* The real transform of size N is computed as a complex transform of
+	 * size N/2 on the even and odd samples */
+	unsigned int *bitrev;
+	float *tw_re;
+	float *tw_im;
+	float *re;
+	float *im;
+	float *power;
+
+	float attack;
+	float decay;
+	struct ws2801_audio_band *bands;
+
+	struct led *frame;
+};
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* In-place radix-2 transform of size n = fft_size / 2 */
+static void fft(struct ws2801_audio_priv *priv)
+{
+	unsigned int n = priv->cfg.fft_size / 2, len, half, step, i, j, k;
+	float *re = priv->re, *im = priv->im, ur, ui, vr, vi, wr, wi;
+
+	for (i = 0; i < n; i++) {
+		j = priv->bitrev[i];
+		if (i < j) {
+			ur = re[i]; re[i] = re[j]; re[j] = ur;
+			ui = im[i]; im[i] = im[j]; im[j] = ui;
+		}
+	}
+
+	for (len = 2; len <= n; len <<= 1) {
+		half = len / 2;
+		/* W_len^j = W_N^(j * N / len) */
+		step = priv->cfg.fft_size / len;
+		for (i = 0; i < n; i += len) {
+			for (j = 0; j < half; j++) {
+				k = i + j;
+				wr = priv->tw_re[j * step];
+				wi = priv->tw_im[j * step];
+				vr = re[k + half] * wr - im[k + half] * wi;
+				vi = re[k + half] * wi + im[k + half] * wr;
+				ur = re[k];
+				ui = im[k];
+				re[k] = ur + vr;
+				im[k] = ui + vi;
+				re[k + half] = ur - vr;
+				im[k + half] = ui - vi;
+			}
+		}
+	}
+}
+
+/*
+ * Power spectrum of the windowed ring. With Z = FFT(x[2m] + i * x[2m + 1]),
+ * the spectra of the even and odd samples are E[k] = (Z[k] + Z*[n - k]) / 2
+ * and O[k] = (Z[k] - Z*[n - k]) / 2i, and X[k] = E[k] + W_N^k * O[k].
+ */
+static void power_spectrum(struct ws2801_audio_priv *priv)
+{
+	unsigned int n = priv->cfg.fft_size / 2, i, s, k, c;
+	float er, ei, odd_r, odd_i, xr, xi;
+
+	for (i = 0, s = priv->pos; i < n; i++) {
+		priv->re[i] = priv->ring[s] * priv->window[2 * i];
+		s = (s + 1) % priv->cfg.fft_size;
+		priv->im[i] = priv->ring[s] * priv->window[2 * i + 1];
+		s = (s + 1) % priv->cfg.fft_size;
+	}
+
+	fft(priv);
+
+	for (k = 0; k < n; k++) {
+		c = (n - k) % n;
+		er = (priv->re[k] + priv->re[c]) / 2;
+		ei = (priv->im[k] - priv->im[c]) / 2;
+		odd_r = (priv->im[k] + priv->im[c]) / 2;
+		odd_i = (priv->re[c] - priv->re[k]) / 2;
+
+		xr = er + priv->tw_re[k] * odd_r - priv->tw_im[k] * odd_i;
+		xi = ei + priv->tw_re[k] * odd_i + priv->tw_im[k] * odd_r;
+		priv->power[k] = (xr * xr + xi * xi) * priv->norm;
+	}
+}
+
+static void update_bands(struct ws2801_audio_priv *priv, unsigned int hops)
+{
+	struct ws2801_audio_band *band;
+	float energy, target, coeff;
+	unsigned int i, k;
+
+	for (i = 0; i < priv->cfg.num_bands; i++) {
+		band = priv->bands + i;
+
+		energy = 1e-12f;
+		for (k = band->lo; k < band->hi; k++)
+			energy += priv->power[k];
+
+		target = (10 * log10f(energy) + DB_RANGE) / DB_RANGE;
+		if (target < 0)
+			target = 0;
+		else if (target > 1)
+			target = 1;
+
+		coeff = target > band->level ? priv->attack : priv->decay;
+		/* Catch up on hops that were not rendered */
+		for (k = 0; k < hops; k++)
+			band->level += (target - band->level) * coeff;
+	}
+}
+
+/* Every band is a bar from the start of its segment, its tip is dimmed */
+static void render(struct ws2801_audio_priv *priv)
+{
+	const struct ws2801_audio_band *band;
+	unsigned int i, j, full, tip;
+	struct led *out;
+	float length;
+
+	for (i = 0; i < priv->cfg.num_bands; i++) {
+		band = priv->bands + i;
+		out = priv->frame + band->first;
+
+		length = band->level * band->num;
+		full = length;
+		tip = (length - full) * 256;
+
+		for (j = 0; j < full; j++)
+			out[j] = band->color;
+
+		if (j < band->num) {
+			out[j].r = (band->color.r * tip) >> 8;
+			out[j].g = (band->color.g * tip) >> 8;
+			out[j].b = (band->color.b * tip) >> 8;
+			j++;
+		}
+
+		memset(out + j, 0, (band->num - j) * sizeof(*out));
+	}
+}
+
+static unsigned int freq_to_bin(const struct ws2801_audio_config *cfg,
+				float freq)
+{
+	return freq * cfg->fft_size / cfg->rate + 0.5f;
+}
+
+static void ws2801_audio_layout(struct ws2801_audio_priv *priv,
+				unsigned int num_leds)
+{
+	const struct ws2801_audio_config *cfg = &priv->cfg;
+	unsigned int i, nyquist = cfg->fft_size / 2;
+	struct ws2801_audio_band *band;
+	struct led_hsv hsv;
+	float ratio;
+
+	ratio = (float)cfg->max_freq / cfg->min_freq;
+	for (i = 0; i < cfg->num_bands; i++) {
+		band = priv->bands + i;
+
+		band->lo = freq_to_bin(cfg, cfg->min_freq *
+				       powf(ratio, (float)i / cfg->num_bands));
+		band->hi = freq_to_bin(cfg, cfg->min_freq *
+				       powf(ratio, (float)(i + 1) /
+					    cfg->num_bands));
+		/* The DC bin is never part of a band */
+		if (band->lo < 1)
+			band->lo = 1;
+		if (band->lo > nyquist - 1)
+			band->lo = nyquist - 1;
+		if (band->hi > nyquist)
+			band->hi = nyquist;
+		/* Narrow low bands get at least one bin */
+		if (band->hi <= band->lo)
+			band->hi = band->lo + 1;
+
+		band->first = (unsigned long long)num_leds * i / cfg->num_bands;
+		band->num = (unsigned long long)num_leds * (i + 1) /
+			    cfg->num_bands - band->first;
+
+		hsv.h = HUE_LOW + (HUE_HIGH - HUE_LOW) * i /
+			(cfg->num_bands > 1 ? cfg->num_bands - 1 : 1);
+		hsv.s = 255;
+		hsv.v = 255;
+		ws2801_hsv_to_rgb(&band->color, &hsv, 1);
+	}
+}
+
+static float smoothing(const struct ws2801_audio_config *cfg, unsigned int ms)
+{
+	if (!ms)
+		return 1;
+
+	return 1 - expf(-(float)cfg->hop * 1000 / ((float)cfg->rate * ms));
+}
+
+int ws2801_audio_init(struct ws2801_audio *audio, struct ws2801_driver *ws,
+		      const struct ws2801_audio_config *cfg)
+{
+	struct ws2801_audio_priv *priv;
+	unsigned int i, j, n, bits;
+	float sum = 0;
+	int err;
+
+	if (!cfg->rate || cfg->fft_size < 4 ||
+	    (cfg->fft_size & (cfg->fft_size - 1)) ||
+	    !cfg->hop || cfg->hop > cfg->fft_size)
+		return -EINVAL;
+
+	if (!cfg->num_bands || cfg->num_bands > ws->num_leds ||
+	    !cfg->min_freq || cfg->min_freq >= cfg->max_freq ||
+	    cfg->max_freq > cfg->rate / 2)
+		return -EINVAL;
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv)
+		return -ENOMEM;
+
+	priv->cfg = *cfg;
+	n = cfg->fft_size / 2;
+
+	err = -ENOMEM;
+	priv->ring = calloc(cfg->fft_size, sizeof(*priv->ring));
+	priv->window = calloc(cfg->fft_size, sizeof(*priv->window));
+	priv->bitrev = calloc(n, sizeof(*priv->bitrev));
+	priv->tw_re = calloc(n, sizeof(*priv->tw_re));
+	priv->tw_im = calloc(n, sizeof(*priv->tw_im));
+	priv->re = calloc(n, sizeof(*priv->re));
+	priv->im = calloc(n, sizeof(*priv->im));
+	priv->power = calloc(n, sizeof(*priv->power));
+	priv->bands = calloc(cfg->num_bands, sizeof(*priv->bands));
+	priv->frame = calloc(ws->num_leds, sizeof(*priv->frame));
+	if (!priv->ring || !priv->window || !priv->bitrev || !priv->tw_re ||
+	    !priv->tw_im || !priv->re || !priv->im || !priv->power ||
+	    !priv->bands || !priv->frame)
+		goto free_out;
+
+	/* Hann window */
+	for (i = 0; i < cfg->fft_size; i++) {
+		priv->window[i] = 0.5f - 0.5f * cosf(2 * M_PI * i /
+						     cfg->fft_size);
+		sum += priv->window[i];
+	}
+	priv->norm = 4 / (sum * sum);
+
+	for (bits = 0; (1U << bits) < n; bits++)
+		;
+	for (i = 0; i < n; i++) {
+		for (j = 0, priv->bitrev[i] = 0; j < bits; j++)
+			if (i & (1U << j))
+				priv->bitrev[i] |= 1U << (bits - 1 - j);
+
+		priv->tw_re[i] = cosf(2 * M_PI * i / cfg->fft_size);
+		priv->tw_im[i] = -sinf(2 * M_PI * i / cfg->fft_size);
+	}
+
+	priv->attack = smoothing(cfg, cfg->attack_ms);
+	priv->decay = smoothing(cfg, cfg->decay_ms);
+	ws2801_audio_layout(priv, ws->num_leds);
+
+	audio->ws = ws;
+	audio->latency_last = 0;
+	audio->latency_max = 0;
+	audio->priv = priv;
+
+	return 0;
+
+free_out:
+	free(priv->frame);
+	free(priv->bands);
+	free(priv->power);
+	free(priv->im);
+	free(priv->re);
+	free(priv->tw_im);
+	free(priv->tw_re);
+	free(priv->bitrev);
+	free(priv->window);
+	free(priv->ring);
+	free(priv);
+	return err;
+}
+
+void ws2801_audio_free(struct ws2801_audio *audio)
+{
+	struct ws2801_audio_priv *priv = audio->priv;
+
+	free(priv->frame);
+	free(priv->bands);
+	free(priv->power);
+	free(priv->im);
+	free(priv->re);
+	free(priv->tw_im);
+	free(priv->tw_re);
+	free(priv->bitrev);
+	free(priv->window);
+	free(priv->ring);
+	free(priv);
+}
+
+int ws2801_audio_feed(struct ws2801_audio *audio, const short *samples,
+		      unsigned int num, unsigned long long timestamp)
+{
+	struct ws2801_audio_priv *priv = audio->priv;
+	struct ws2801_driver *ws = audio->ws;
+	unsigned long long latency;
+	unsigned int i, hops;
+	int err;
+
+	for (i = 0; i < num; i++) {
+		priv->ring[priv->pos] = samples[i] / 32768.0f;
+		priv->pos = (priv->pos + 1) % priv->cfg.fft_size;
+	}
+
+	priv->pending += num;
+	if (priv->pending < priv->cfg.hop)
+		return 0;
+
+	hops = priv->pending / priv->cfg.hop;
+	priv->pending %= priv->cfg.hop;
+
+	power_spectrum(priv);
+	update_bands(priv, hops);
+	render(priv);
+
+	err = ws->set_leds(ws, priv->frame, 0, ws->num_leds);
+	if (err < 0)
+		return err;
+	ws->commit(ws);
+
+	latency = now_ns() - timestamp;
+	audio->latency_last = latency;
+	if (latency > audio->latency_max)
+		audio->latency_max = latency;
+
+	return 1;
+}
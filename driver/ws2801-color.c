@@ -0,0 +1,242 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ws2801-common.h"
+#include "ws2801-simd.h"
+
+/* The HSV kernel converts eight pixels per iteration */
+#define PIXELS_PER_VECTOR 8
+
+/* All fields are protected by the data_lock of the driver */
+struct ws2801_indexed_priv {
+	/* The driver holds the indexed frame itself, index and palette point
+	 * into it */
+	bool native;
+	/* Only used if not native: the frame isn't expanded into the LEDs */
+	bool dirty;
+	unsigned char *index;
+	struct led *palette;
+};
+
+_Static_assert(sizeof(struct led_hsv) == 3, "struct led_hsv must be packed");
+
+static inline unsigned int div255(unsigned int x)
+{
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+/*
+ * The hue circle is split into six sectors. Within a sector, one channel is
+ * at v, one at p = v * (1 - s), and one ramps between p and v: up as
+ * t = v * (1 - s * (1 - f)), or down as q = v * (1 - s * f).
+ */
+static void hsv_to_rgb(struct led *dst, const struct led_hsv *src)
+{
+	unsigned int sector, f, p, q, t, v = src->v;
+
+	sector = (src->h * 6) >> 8;
+	f = (src->h * 6) & 0xff;
+	p = div255(v * (255 - src->s));
+	q = div255(v * (255 - div255(src->s * f)));
+	t = div255(v * (255 - div255(src->s * (255 - f))));
+
+	switch (sector) {
+	case 0:
+		*dst = (struct led){ .r = v, .g = t, .b = p };
+		break;
+	case 1:
+		*dst = (struct led){ .r = q, .g = v, .b = p };
+		break;
+	case 2:
+		*dst = (struct led){ .r = p, .g = v, .b = t };
+		break;
+	case 3:
+		*dst = (struct led){ .r = p, .g = q, .b = v };
+		break;
+	case 4:
+		*dst = (struct led){ .r = t, .g = p, .b = v };
+		break;
+	default:
+		*dst = (struct led){ .r = v, .g = p, .b = q };
+		break;
+	}
+}
+
+/* Same as hsv_to_rgb(), for eight pixels. Sectors are selected with masks. */
+static void hsv_to_rgb8(struct led *dst, const struct led_hsv *src)
+{
+	v8u16 h, s, v, sector, f, p, q, t;
+	v8u16 m0, m1, m2, m3, m4, m5;
+
+	v8u16_load3(src, &h, &s, &v);
+
+	sector = (h * 6) >> 8;
+	f = (h * 6) & 0xff;
+	p = v8u16_div255(v * (255 - s));
+	q = v8u16_div255(v * (255 - v8u16_div255(s * f)));
+	t = v8u16_div255(v * (255 - v8u16_div255(s * (255 - f))));
+
+	m0 = (v8u16)(sector == 0);
+	m1 = (v8u16)(sector == 1);
+	m2 = (v8u16)(sector == 2);
+	m3 = (v8u16)(sector == 3);
+	m4 = (v8u16)(sector == 4);
+	m5 = (v8u16)(sector == 5);
+
+	v8u16_store3(dst,
+		     (v & (m0 | m5)) | (q & m1) | (p & (m2 | m3)) | (t & m4),
+		     (t & m0) | (v & (m1 | m2)) | (q & m3) | (p & (m4 | m5)),
+		     (p & (m0 | m1)) | (t & m2) | (v & (m3 | m4)) | (q & m5));
+}
+
+void ws2801_hsv_to_rgb(struct led *dst, const struct led_hsv *src,
+		       unsigned int num_leds)
+{
+	unsigned int i;
+
+	for (i = 0; i + PIXELS_PER_VECTOR <= num_leds; i += PIXELS_PER_VECTOR)
+		hsv_to_rgb8(dst + i, src + i);
+
+	for (; i < num_leds; i++)
+		hsv_to_rgb(dst + i, src + i);
+}
+
+void ws2801_palette_expand(struct led *dst, const unsigned char *index,
+			   const struct led *palette, unsigned int num_leds)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_leds; i++)
+		dst[i] = palette[index[i]];
+}
+
+int ws2801_indexed_init(struct ws2801_indexed *ind, struct ws2801_driver *ws)
+{
+	struct ws2801_indexed_priv *priv;
+	int err;
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv)
+		return -ENOMEM;
+
+	ind->ws = ws;
+	ind->priv = priv;
+
+	err = ws->set_indexed(ws, true);
+	if (!err) {
+		priv->native = true;
+		priv->index = ws->index;
+		priv->palette = ws->palette;
+		return 0;
+	}
+	if (err != -ENOSYS)
+		goto free_out;
+
+	/* Without support of the backend, the frame is expanded into the LEDs
+	 * of the driver on commit */
+	err = -ENOMEM;
+	priv->index = calloc(ws->num_leds, sizeof(*priv->index));
+	priv->palette = calloc(WS2801_PALETTE_SIZE, sizeof(*priv->palette));
+	if (!priv->index || !priv->palette)
+		goto free_out;
+
+	priv->dirty = true;
+
+	return 0;
+
+free_out:
+	free(priv->palette);
+	free(priv->index);
+	free(priv);
+	return err;
+}
+
+int ws2801_indexed_free(struct ws2801_indexed *ind)
+{
+	struct ws2801_indexed_priv *priv = ind->priv;
+	int err;
+
+	if (priv->native) {
+		err = ind->ws->set_indexed(ind->ws, false);
+		if (err)
+			return err;
+	} else {
+		free(priv->palette);
+		free(priv->index);
+	}
+
+	free(priv);
+
+	return 0;
+}
+
+int ws2801_indexed_set_leds(struct ws2801_indexed *ind,
+			    const unsigned char *index, unsigned int offset,
+			    unsigned int num_leds)
+{
+	struct ws2801_indexed_priv *priv = ind->priv;
+	struct ws2801_driver *ws = ind->ws;
+
+	if (offset >= ws->num_leds)
+		return 0;
+
+	if (num_leds + offset >= ws->num_leds)
+		num_leds = ws->num_leds - offset;
+
+	pthread_mutex_lock(&ws->data_lock);
+	memcpy(priv->index + offset, index, num_leds);
+	priv->dirty = true;
+	pthread_mutex_unlock(&ws->data_lock);
+
+	return num_leds;
+}
+
+int ws2801_indexed_set_palette(struct ws2801_indexed *ind,
+			       const struct led *colors, unsigned int first,
+			       unsigned int num_colors)
+{
+	struct ws2801_indexed_priv *priv = ind->priv;
+	struct ws2801_driver *ws = ind->ws;
+
+	if (first >= WS2801_PALETTE_SIZE ||
+	    num_colors > WS2801_PALETTE_SIZE - first)
+		return -ERANGE;
+
+	pthread_mutex_lock(&ws->data_lock);
+	memcpy(priv->palette + first, colors, num_colors * sizeof(*colors));
+	priv->dirty = true;
+	pthread_mutex_unlock(&ws->data_lock);
+
+	return 0;
+}
+
+void ws2801_indexed_commit(struct ws2801_indexed *ind)
+{
+	struct ws2801_indexed_priv *priv = ind->priv;
+	struct ws2801_driver *ws = ind->ws;
+
+	/* Native drivers expand the frame on transmission */
+	pthread_mutex_lock(&ws->data_lock);
+	if (!priv->native && priv->dirty) {
+		ws2801_palette_expand(ws->leds, priv->index, priv->palette,
+				      ws->num_leds);
+		priv->dirty = false;
+	}
+	pthread_mutex_unlock(&ws->data_lock);
+
+	ws->commit(ws);
+}
@@ -11,11 +11,14 @@
  */
 
 #include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "ws2801-common.h"
 
+#define BITS_PER_LONG (8 * sizeof(unsigned long))
+
 static inline void ws2801_auto_commit(struct ws2801_driver *ws_driver)
 {
 	if (ws_driver->auto_commit)
@@ -31,6 +34,13 @@ int ws2801_init(struct ws2801_driver *ws_driver, unsigned int num_leds)
 		return -ENOMEM;
 
 	ws_driver->num_leds = num_leds;
+	ws_driver->index = NULL;
+	ws_driver->palette = NULL;
+	ws_driver->commit_hook = NULL;
+	ws_driver->group_init = NULL;
+	ws_driver->group_free = NULL;
+	ws_driver->sched = NULL;
+	ws_driver->recorder = NULL;
 
 	err = pthread_mutex_init(&ws_driver->data_lock, NULL);
 	if (err) {
@@ -47,6 +57,8 @@ void ws2801_free(struct ws2801_driver *ws_driver)
 {
 	if (ws_driver->leds)
 		free(ws_driver->leds);
+	free(ws_driver->index);
+	free(ws_driver->palette);
 
 	pthread_mutex_destroy(&ws_driver->data_lock);
 }
@@ -56,14 +68,21 @@ void ws2801_set_auto_commit(struct ws2801_driver *ws_driver, bool auto_commit)
 	ws_driver->auto_commit = auto_commit;
 }
 
-void ws2801_clear(struct ws2801_driver *ws_driver)
+int ws2801_clear(struct ws2801_driver *ws_driver)
 {
 	pthread_mutex_lock(&ws_driver->data_lock);
+	if (ws_driver->index) {
+		pthread_mutex_unlock(&ws_driver->data_lock);
+		return -EBUSY;
+	}
+
 	memset(ws_driver->leds, 0,
 	       ws_driver->num_leds * sizeof(*ws_driver->leds));
 	pthread_mutex_unlock(&ws_driver->data_lock);
 
 	ws2801_auto_commit(ws_driver);
+
+	return 0;
 }
 
 int ws2801_set_led(struct ws2801_driver *ws_driver, unsigned int num,
@@ -74,6 +93,10 @@ int ws2801_set_led(struct ws2801_driver *ws_driver, unsigned int num,
 		pthread_mutex_unlock(&ws_driver->data_lock);
 		return -ERANGE;
 	}
+	if (ws_driver->index) {
+		pthread_mutex_unlock(&ws_driver->data_lock);
+		return -EBUSY;
+	}
 
 	ws_driver->leds[num] = *led;
 	pthread_mutex_unlock(&ws_driver->data_lock);
@@ -90,6 +113,10 @@ int ws2801_set_leds(struct ws2801_driver *ws_driver, const struct led *leds,
 		return 0;
 
 	pthread_mutex_lock(&ws_driver->data_lock);
+	if (ws_driver->index) {
+		pthread_mutex_unlock(&ws_driver->data_lock);
+		return -EBUSY;
+	}
 
 	if (num_leds + offset >= ws_driver->num_leds)
 		num_leds = ws_driver->num_leds - offset;
@@ -103,10 +130,68 @@ int ws2801_set_leds(struct ws2801_driver *ws_driver, const struct led *leds,
 	return num_leds;
 }
 
+int ws2801_update(struct ws2801_driver *ws_driver,
+		  const struct ws2801_update *updates, unsigned int num_updates)
+{
+	unsigned int i;
+
+	/* Validate first, so that updates are applied all or nothing */
+	for (i = 0; i < num_updates; i++)
+		if (updates[i].num >= ws_driver->num_leds)
+			return -ERANGE;
+
+	pthread_mutex_lock(&ws_driver->data_lock);
+	if (ws_driver->index) {
+		pthread_mutex_unlock(&ws_driver->data_lock);
+		return -EBUSY;
+	}
+
+	for (i = 0; i < num_updates; i++)
+		ws_driver->leds[updates[i].num] = updates[i].color;
+	pthread_mutex_unlock(&ws_driver->data_lock);
+
+	ws2801_auto_commit(ws_driver);
+
+	return 0;
+}
+
+int ws2801_update_mask(struct ws2801_driver *ws_driver,
+		       const unsigned long *mask, const struct led *colors)
+{
+	unsigned int i, words, base;
+	unsigned long bits;
+
+	words = (ws_driver->num_leds + BITS_PER_LONG - 1) / BITS_PER_LONG;
+
+	pthread_mutex_lock(&ws_driver->data_lock);
+	if (ws_driver->index) {
+		pthread_mutex_unlock(&ws_driver->data_lock);
+		return -EBUSY;
+	}
+
+	for (i = 0; i < words; i++) {
+		bits = mask[i];
+		base = i * BITS_PER_LONG;
+		/* Bits beyond num_leds are ignored */
+		if (base + BITS_PER_LONG > ws_driver->num_leds)
+			bits &= (1UL << (ws_driver->num_leds - base)) - 1;
+
+		while (bits) {
+			ws_driver->leds[base + __builtin_ctzl(bits)] = *colors++;
+			bits &= bits - 1;
+		}
+	}
+	pthread_mutex_unlock(&ws_driver->data_lock);
+
+	ws2801_auto_commit(ws_driver);
+
+	return 0;
+}
+
 int ws2801_full_on(struct ws2801_driver *ws_driver, const struct led *color)
 {
 	unsigned int i;
-	int err;
+	int err = 0;
 
 	for (i = 0; i < ws_driver->num_leds; i++) {
 		err = ws_driver->set_led(ws_driver, i, color);
@@ -116,3 +201,184 @@ int ws2801_full_on(struct ws2801_driver *ws_driver, const struct led *color)
 
 	return err;
 }
+
+int ws2801_get_stats(struct ws2801_driver *ws_driver,
+		     struct ws2801_stats *stats)
+{
+	return -ENOSYS;
+}
+
+int ws2801_wait_commit(struct ws2801_driver *ws_driver, int timeout_ms)
+{
+	return -ENOSYS;
+}
+
+int ws2801_refresh(struct ws2801_driver *ws_driver)
+{
+	return -ENOSYS;
+}
+
+int ws2801_no_power_limit(struct ws2801_driver *ws_driver,
+			  const struct ws2801_power_limit *limit)
+{
+	return -ENOSYS;
+}
+
+int ws2801_no_group_commit(struct ws2801_group *group)
+{
+	return -ENOSYS;
+}
+
+static int ws2801_group_cmp(const void *a, const void *b)
+{
+	uintptr_t x = (uintptr_t)*(struct ws2801_driver *const *)a;
+	uintptr_t y = (uintptr_t)*(struct ws2801_driver *const *)b;
+
+	return (x > y) - (x < y);
+}
+
+int ws2801_group_init(struct ws2801_group *group,
+		      struct ws2801_driver *const *members,
+		      unsigned int num_members)
+{
+	unsigned int i;
+	int err;
+
+	if (!num_members)
+		return -EINVAL;
+
+	for (i = 0; i < num_members; i++) {
+		if (members[i]->group_commit == ws2801_no_group_commit)
+			return -ENOSYS;
+		if (members[i]->group_commit != members[0]->group_commit)
+			return -EINVAL;
+	}
+
+	group->members = malloc(num_members * sizeof(*group->members));
+	if (!group->members)
+		return -ENOMEM;
+	memcpy(group->members, members, num_members * sizeof(*members));
+
+	/* A fixed order lets concurrent groups lock their members safely */
+	qsort(group->members, num_members, sizeof(*group->members),
+	      ws2801_group_cmp);
+	for (i = 1; i < num_members; i++)
+		if (group->members[i] == group->members[i - 1]) {
+			err = -EINVAL;
+			goto free_out;
+		}
+
+	group->num_members = num_members;
+	group->skew_last = 0;
+	group->skew_max = 0;
+	group->priv = NULL;
+
+	if (group->members[0]->group_init) {
+		err = group->members[0]->group_init(group);
+		if (err)
+			goto free_out;
+	}
+
+	return 0;
+
+free_out:
+	free(group->members);
+	return err;
+}
+
+void ws2801_group_free(struct ws2801_group *group)
+{
+	if (group->members[0]->group_free)
+		group->members[0]->group_free(group);
+
+	free(group->members);
+}
+
+int ws2801_group_commit(struct ws2801_group *group)
+{
+	return group->members[0]->group_commit(group);
+}
+
+/* Swaps the RGB LEDs for one palette index per LED, all at index 0 of a
+ * black palette */
+static int ws2801_enter_indexed(struct ws2801_driver *ws_driver)
+{
+	struct led *palette;
+	unsigned char *index;
+	int err = -ENOMEM;
+
+	index = calloc(ws_driver->num_leds, sizeof(*index));
+	palette = calloc(WS2801_PALETTE_SIZE, sizeof(*palette));
+	if (!index || !palette)
+		goto free_out;
+
+	pthread_mutex_lock(&ws_driver->data_lock);
+	if (ws_driver->index) {
+		pthread_mutex_unlock(&ws_driver->data_lock);
+		err = -EBUSY;
+		goto free_out;
+	}
+
+	free(ws_driver->leds);
+	ws_driver->leds = NULL;
+	ws_driver->index = index;
+	ws_driver->palette = palette;
+	pthread_mutex_unlock(&ws_driver->data_lock);
+
+	return 0;
+
+free_out:
+	free(palette);
+	free(index);
+	return err;
+}
+
+/* Expands the frame into RGB LEDs again */
+static int ws2801_leave_indexed(struct ws2801_driver *ws_driver)
+{
+	struct led *leds;
+
+	leds = calloc(ws_driver->num_leds, sizeof(*leds));
+	if (!leds)
+		return -ENOMEM;
+
+	pthread_mutex_lock(&ws_driver->data_lock);
+	if (!ws_driver->index) {
+		pthread_mutex_unlock(&ws_driver->data_lock);
+		free(leds);
+		return 0;
+	}
+
+	ws2801_copy_frame(leds, ws_driver);
+	free(ws_driver->index);
+	free(ws_driver->palette);
+	ws_driver->index = NULL;
+	ws_driver->palette = NULL;
+	ws_driver->leds = leds;
+	pthread_mutex_unlock(&ws_driver->data_lock);
+
+	return 0;
+}
+
+int ws2801_set_indexed(struct ws2801_driver *ws_driver, bool indexed)
+{
+	if (indexed)
+		return ws2801_enter_indexed(ws_driver);
+
+	return ws2801_leave_indexed(ws_driver);
+}
+
+int ws2801_no_indexed(struct ws2801_driver *ws_driver, bool indexed)
+{
+	return -ENOSYS;
+}
+
+void ws2801_copy_frame(struct led *dst, const struct ws2801_driver *ws_driver)
+{
+	if (ws_driver->index)
+		ws2801_palette_expand(dst, ws_driver->index,
+				      ws_driver->palette, ws_driver->num_leds);
+	else
+		memcpy(dst, ws_driver->leds,
+		       ws_driver->num_leds * sizeof(*dst));
+}
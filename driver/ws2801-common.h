@@ -14,11 +14,28 @@
 
 int ws2801_init(struct ws2801_driver *ws_driver, unsigned int num_leds);
 
+static inline void ws2801_commit_hook(struct ws2801_driver *ws_driver)
+{
+	if (ws_driver->commit_hook)
+		ws_driver->commit_hook(ws_driver, ws_driver->commit_hook_data);
+}
+
+/* Appends the LEDs to the recording of the driver. Must be called with
+ * data_lock held, while the LEDs hold the frame that is being committed. */
+void ws2801_record_frame(struct ws2801_driver *ws_driver);
+
+static inline void ws2801_record_commit(struct ws2801_driver *ws_driver)
+{
+	/* Recorders without priv are still being started */
+	if (ws_driver->recorder && ws_driver->recorder->priv)
+		ws2801_record_frame(ws_driver);
+}
+
 void ws2801_free(struct ws2801_driver *ws_driver);
 
 void ws2801_set_auto_commit(struct ws2801_driver *ws_driver, bool auto_commit);
 
-void ws2801_clear(struct ws2801_driver *ws_driver);
+int ws2801_clear(struct ws2801_driver *ws_driver);
 
 int ws2801_set_led(struct ws2801_driver *ws_driver, unsigned int num,
 		   const struct led *led);
@@ -26,4 +43,66 @@ int ws2801_set_led(struct ws2801_driver *ws_driver, unsigned int num,
 int ws2801_set_leds(struct ws2801_driver *ws_driver, const struct led *leds,
 		    unsigned int offset, unsigned int num_leds);
 
+int ws2801_update(struct ws2801_driver *ws_driver,
+		  const struct ws2801_update *updates, unsigned int num_updates);
+
+int ws2801_update_mask(struct ws2801_driver *ws_driver,
+		       const unsigned long *mask, const struct led *colors);
+
 int ws2801_full_on(struct ws2801_driver *ws_driver, const struct led *color);
+
+int ws2801_get_stats(struct ws2801_driver *ws_driver,
+		     struct ws2801_stats *stats);
+int ws2801_wait_commit(struct ws2801_driver *ws_driver, int timeout_ms);
+
+int ws2801_refresh(struct ws2801_driver *ws_driver);
+
+int ws2801_no_group_commit(struct ws2801_group *group);
+
+int ws2801_set_indexed(struct ws2801_driver *ws_driver, bool indexed);
+
+int ws2801_no_indexed(struct ws2801_driver *ws_driver, bool indexed);
+
+/* Copies the frame of the driver as RGB LEDs, in either mode. The frame
+ * buffers must not be swapped meanwhile: data_lock must be held, unless the
+ * backend serialises set_indexed() with its transmissions otherwise. */
+void ws2801_copy_frame(struct led *dst, const struct ws2801_driver *ws_driver);
+
+/* Power limiter state of a backend */
+struct ws2801_power {
+	struct ws2801_power_limit limit;
+	/* Estimated current and applied scale of the last frame */
+	unsigned long long current_ma;
+	unsigned int scale;
+	unsigned long long frames_limited;
+};
+
+void ws2801_power_init(struct ws2801_power *power);
+
+/* A NULL limit disables the limiter */
+int ws2801_power_set_limit(struct ws2801_power *power,
+			   const struct ws2801_power_limit *limit);
+
+/* Estimates the current of a frame, and returns the scale in 1/256 that
+ * keeps it within the budget */
+unsigned int ws2801_power_update(struct ws2801_power *power,
+				 const struct led *leds, unsigned int num_leds);
+
+/* Same as ws2801_power_update(), for a frame in indexed mode */
+unsigned int ws2801_power_update_indexed(struct ws2801_power *power,
+					 const unsigned char *index,
+					 const struct led *palette,
+					 unsigned int num_leds);
+
+/* dst = src * scale / 256 */
+void ws2801_power_apply(struct led *dst, const struct led *src,
+			unsigned int num_leds, unsigned int scale);
+
+void ws2801_power_stats(const struct ws2801_power *power,
+			struct ws2801_stats *stats);
+
+int ws2801_no_power_limit(struct ws2801_driver *ws_driver,
+			  const struct ws2801_power_limit *limit);
+
+/* Notifies the scheduler that the refresh rate of a driver changed */
+int ws2801_sched_wake(struct ws2801_sched *sched, struct ws2801_driver *ws);
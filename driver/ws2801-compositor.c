@@ -0,0 +1,272 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ws2801-common.h"
+#include "ws2801-simd.h"
+
+/* The blend kernels process two pixels per iteration */
+#define PIXELS_PER_VECTOR 2
+#define ROUND_UP(x) (((x) + PIXELS_PER_VECTOR - 1) & ~(PIXELS_PER_VECTOR - 1))
+
+struct ws2801_layer {
+	struct led_rgba *leds;
+	enum ws2801_blend_mode mode;
+	unsigned char opacity;
+};
+
+struct ws2801_compositor_priv {
+	pthread_mutex_t lock;
+	bool dirty;
+	unsigned int num_pixels;
+	struct led_rgba *out;
+	struct ws2801_layer layers[];
+};
+
+static const v8u16 alpha_lanes = { 3, 3, 3, 3, 7, 7, 7, 7 };
+static const v8u16 saturated = { 255, 255, 255, 255, 255, 255, 255, 255 };
+
+/* Effective per-channel alpha of two source pixels */
+static inline v8u16 blend_alpha(v8u16 s, unsigned short opacity)
+{
+	return v8u16_div255(__builtin_shuffle(s, alpha_lanes) * opacity);
+}
+
+static void blend_over(struct led_rgba *dst, const struct led_rgba *src,
+		       unsigned int num_pixels, unsigned int opacity)
+{
+	v8u16 s, d, a;
+	unsigned int i;
+
+	for (i = 0; i < num_pixels; i += PIXELS_PER_VECTOR) {
+		s = v8u16_load(src + i);
+		d = v8u16_load(dst + i);
+		a = blend_alpha(s, opacity);
+		v8u16_store(dst + i, v8u16_div255(s * a + d * (255 - a)));
+	}
+}
+
+static void blend_add(struct led_rgba *dst, const struct led_rgba *src,
+		      unsigned int num_pixels, unsigned int opacity)
+{
+	v8u16 s, d, a;
+	unsigned int i;
+
+	for (i = 0; i < num_pixels; i += PIXELS_PER_VECTOR) {
+		s = v8u16_load(src + i);
+		d = v8u16_load(dst + i);
+		a = blend_alpha(s, opacity);
+		d = v8u16_min(d + v8u16_div255(s * a), saturated);
+		v8u16_store(dst + i, d);
+	}
+}
+
+static void blend_max(struct led_rgba *dst, const struct led_rgba *src,
+		      unsigned int num_pixels, unsigned int opacity)
+{
+	v8u16 s, d, a;
+	unsigned int i;
+
+	for (i = 0; i < num_pixels; i += PIXELS_PER_VECTOR) {
+		s = v8u16_load(src + i);
+		d = v8u16_load(dst + i);
+		a = blend_alpha(s, opacity);
+		v8u16_store(dst + i, v8u16_max(d, v8u16_div255(s * a)));
+	}
+}
+
+static void (* const blend[])(struct led_rgba *, const struct led_rgba *,
+			      unsigned int, unsigned int) = {
+	[WS2801_BLEND_OVER] = blend_over,
+	[WS2801_BLEND_ADD] = blend_add,
+	[WS2801_BLEND_MAX] = blend_max,
+};
+
+static int ws2801_compositor_flatten(struct ws2801_compositor *comp)
+{
+	struct ws2801_compositor_priv *priv = comp->priv;
+	struct ws2801_driver *ws = comp->ws;
+	struct ws2801_layer *layer;
+	unsigned int i;
+
+	memset(priv->out, 0, priv->num_pixels * sizeof(*priv->out));
+	for (i = 0; i < comp->num_layers; i++) {
+		layer = priv->layers + i;
+		if (layer->opacity)
+			blend[layer->mode](priv->out, layer->leds,
+					   priv->num_pixels, layer->opacity);
+	}
+
+	pthread_mutex_lock(&ws->data_lock);
+	if (ws->index) {
+		pthread_mutex_unlock(&ws->data_lock);
+		return -EBUSY;
+	}
+
+	for (i = 0; i < ws->num_leds; i++) {
+		ws->leds[i].r = priv->out[i].r;
+		ws->leds[i].g = priv->out[i].g;
+		ws->leds[i].b = priv->out[i].b;
+	}
+	pthread_mutex_unlock(&ws->data_lock);
+
+	return 0;
+}
+
+int ws2801_compositor_init(struct ws2801_compositor *comp,
+			   struct ws2801_driver *ws, unsigned int num_layers)
+{
+	struct ws2801_compositor_priv *priv;
+	unsigned int i, num_pixels;
+	int err;
+
+	if (!num_layers)
+		return -EINVAL;
+
+	priv = calloc(1, sizeof(*priv) + num_layers * sizeof(*priv->layers));
+	if (!priv)
+		return -ENOMEM;
+
+	comp->ws = ws;
+	comp->num_layers = num_layers;
+	comp->priv = priv;
+
+	num_pixels = ROUND_UP(ws->num_leds);
+	priv->num_pixels = num_pixels;
+	priv->dirty = true;
+
+	err = pthread_mutex_init(&priv->lock, NULL);
+	if (err)
+		goto free_out;
+
+	err = -ENOMEM;
+	priv->out = calloc(num_pixels, sizeof(*priv->out));
+	if (!priv->out)
+		goto destroy_out;
+
+	for (i = 0; i < num_layers; i++) {
+		priv->layers[i].leds = calloc(num_pixels,
+					      sizeof(*priv->layers[i].leds));
+		if (!priv->layers[i].leds)
+			goto layers_out;
+		priv->layers[i].mode = WS2801_BLEND_OVER;
+		priv->layers[i].opacity = 255;
+	}
+
+	return 0;
+
+layers_out:
+	while (i--)
+		free(priv->layers[i].leds);
+	free(priv->out);
+
+destroy_out:
+	pthread_mutex_destroy(&priv->lock);
+
+free_out:
+	free(priv);
+	return err;
+}
+
+void ws2801_compositor_free(struct ws2801_compositor *comp)
+{
+	struct ws2801_compositor_priv *priv = comp->priv;
+	unsigned int i;
+
+	for (i = 0; i < comp->num_layers; i++)
+		free(priv->layers[i].leds);
+	free(priv->out);
+	pthread_mutex_destroy(&priv->lock);
+	free(priv);
+}
+
+int ws2801_layer_set_leds(struct ws2801_compositor *comp, unsigned int layer,
+			  const struct led_rgba *leds, unsigned int offset,
+			  unsigned int num_leds)
+{
+	struct ws2801_compositor_priv *priv = comp->priv;
+
+	if (layer >= comp->num_layers)
+		return -ERANGE;
+
+	if (offset >= comp->ws->num_leds)
+		return 0;
+
+	if (num_leds + offset >= comp->ws->num_leds)
+		num_leds = comp->ws->num_leds - offset;
+
+	pthread_mutex_lock(&priv->lock);
+	memcpy(priv->layers[layer].leds + offset, leds,
+	       num_leds * sizeof(*leds));
+	priv->dirty = true;
+	pthread_mutex_unlock(&priv->lock);
+
+	return num_leds;
+}
+
+int ws2801_layer_clear(struct ws2801_compositor *comp, unsigned int layer)
+{
+	struct ws2801_compositor_priv *priv = comp->priv;
+
+	if (layer >= comp->num_layers)
+		return -ERANGE;
+
+	pthread_mutex_lock(&priv->lock);
+	memset(priv->layers[layer].leds, 0,
+	       priv->num_pixels * sizeof(*priv->layers[layer].leds));
+	priv->dirty = true;
+	pthread_mutex_unlock(&priv->lock);
+
+	return 0;
+}
+
+int ws2801_layer_set_blend(struct ws2801_compositor *comp, unsigned int layer,
+			   enum ws2801_blend_mode mode, unsigned char opacity)
+{
+	struct ws2801_compositor_priv *priv = comp->priv;
+
+	if (layer >= comp->num_layers)
+		return -ERANGE;
+
+	if (mode > WS2801_BLEND_MAX)
+		return -EINVAL;
+
+	pthread_mutex_lock(&priv->lock);
+	priv->layers[layer].mode = mode;
+	priv->layers[layer].opacity = opacity;
+	priv->dirty = true;
+	pthread_mutex_unlock(&priv->lock);
+
+	return 0;
+}
+
+void ws2801_compositor_commit(struct ws2801_compositor *comp)
+{
+	struct ws2801_compositor_priv *priv = comp->priv;
+
+	int err = 0;
+
+	pthread_mutex_lock(&priv->lock);
+	if (priv->dirty) {
+		err = ws2801_compositor_flatten(comp);
+		/* Layers stay dirty until they reached the LEDs */
+		if (!err)
+			priv->dirty = false;
+	}
+	pthread_mutex_unlock(&priv->lock);
+
+	if (!err)
+		comp->ws->commit(comp->ws);
+}
@@ -0,0 +1,226 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ws2801-common.h"
+
+struct ws2801_host_priv {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	bool stop;
+
+	/* The running effect. Protected by lock. */
+	void *handle;
+	const struct ws2801_effect *effect;
+	unsigned long long start;
+
+	/* Only written by the output thread, under lock */
+	struct led *frame;
+};
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void ws2801_host_unload(void *handle,
+			       const struct ws2801_effect *effect)
+{
+	if (effect->exit)
+		effect->exit();
+	dlclose(handle);
+}
+
+static void *ws2801_host_task(void *data)
+{
+	struct ws2801_host *host = data;
+	struct ws2801_host_priv *priv = host->priv;
+	unsigned long long period, tick, now, took;
+	struct timespec ts;
+
+	period = 1000000000ULL / host->fps;
+	tick = now_ns();
+
+	pthread_mutex_lock(&priv->lock);
+	while (!priv->stop) {
+		if (!priv->effect) {
+			pthread_cond_wait(&priv->cond, &priv->lock);
+			/* Start ticking with the first effect */
+			tick = now_ns();
+			continue;
+		}
+
+		/* The effect can't be unloaded while it renders */
+		now = now_ns();
+		priv->effect->render(priv->frame, host->ws->num_leds,
+				     now - priv->start);
+		took = now_ns() - now;
+		host->render_last = took;
+		if (took > host->render_max)
+			host->render_max = took;
+		pthread_mutex_unlock(&priv->lock);
+
+		/* Frames are dropped while the driver is in indexed mode */
+		if (host->ws->set_leds(host->ws, priv->frame, 0,
+				       host->ws->num_leds) >= 0)
+			host->ws->commit(host->ws);
+
+		tick += period;
+		if (tick < now)
+			tick = now + period;
+		ts.tv_sec = tick / 1000000000ULL;
+		ts.tv_nsec = tick % 1000000000ULL;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+				       NULL) == EINTR);
+
+		pthread_mutex_lock(&priv->lock);
+	}
+	pthread_mutex_unlock(&priv->lock);
+
+	return NULL;
+}
+
+int ws2801_host_load(struct ws2801_host *host, const char *path)
+{
+	struct ws2801_host_priv *priv = host->priv;
+	const struct ws2801_effect *effect, *old_effect;
+	void *handle, *old_handle;
+	int err;
+
+	handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!handle)
+		return -ENOEXEC;
+
+	/* Loading the running effect again restarts it */
+	pthread_mutex_lock(&priv->lock);
+	if (handle == priv->handle) {
+		priv->start = now_ns();
+		host->render_max = 0;
+		pthread_mutex_unlock(&priv->lock);
+		dlclose(handle);
+		return 0;
+	}
+	pthread_mutex_unlock(&priv->lock);
+
+	err = -ENOEXEC;
+	effect = dlsym(handle, WS2801_EFFECT_SYMBOL);
+	if (!effect || !effect->render)
+		goto close_out;
+
+	err = -EPROTONOSUPPORT;
+	if (effect->abi != WS2801_EFFECT_ABI)
+		goto close_out;
+
+	if (effect->init) {
+		err = effect->init(host->ws->num_leds);
+		if (err)
+			goto close_out;
+	}
+
+	pthread_mutex_lock(&priv->lock);
+	old_handle = priv->handle;
+	old_effect = priv->effect;
+	priv->handle = handle;
+	priv->effect = effect;
+	priv->start = now_ns();
+	host->render_max = 0;
+	pthread_cond_signal(&priv->cond);
+	pthread_mutex_unlock(&priv->lock);
+
+	if (old_effect)
+		ws2801_host_unload(old_handle, old_effect);
+
+	return 0;
+
+close_out:
+	dlclose(handle);
+	return err;
+}
+
+int ws2801_host_init(struct ws2801_host *host, struct ws2801_driver *ws,
+		     unsigned int fps)
+{
+	struct ws2801_host_priv *priv;
+	int err;
+
+	if (!fps)
+		return -EINVAL;
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv)
+		return -ENOMEM;
+
+	host->ws = ws;
+	host->fps = fps;
+	host->render_last = 0;
+	host->render_max = 0;
+	host->priv = priv;
+
+	err = -ENOMEM;
+	priv->frame = calloc(ws->num_leds, sizeof(*priv->frame));
+	if (!priv->frame)
+		goto free_out;
+
+	err = -pthread_mutex_init(&priv->lock, NULL);
+	if (err)
+		goto free_out;
+
+	err = -pthread_cond_init(&priv->cond, NULL);
+	if (err)
+		goto destroy_lock_out;
+
+	err = -pthread_create(&priv->thread, NULL, ws2801_host_task, host);
+	if (err)
+		goto destroy_cond_out;
+
+	return 0;
+
+destroy_cond_out:
+	pthread_cond_destroy(&priv->cond);
+
+destroy_lock_out:
+	pthread_mutex_destroy(&priv->lock);
+
+free_out:
+	free(priv->frame);
+	free(priv);
+	return err;
+}
+
+void ws2801_host_free(struct ws2801_host *host)
+{
+	struct ws2801_host_priv *priv = host->priv;
+
+	pthread_mutex_lock(&priv->lock);
+	priv->stop = true;
+	pthread_cond_signal(&priv->cond);
+	pthread_mutex_unlock(&priv->lock);
+
+	pthread_join(priv->thread, NULL);
+
+	if (priv->effect)
+		ws2801_host_unload(priv->handle, priv->effect);
+
+	pthread_cond_destroy(&priv->cond);
+	pthread_mutex_destroy(&priv->lock);
+	free(priv->frame);
+	free(priv);
+}
@@ -0,0 +1,228 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ws2801-common.h"
+#include "ws2801-simd.h"
+
+/* The lerp kernel processes eight channels per iteration */
+#define CHANNELS_PER_VECTOR 8
+#define ROUND_UP(x) (((x) + CHANNELS_PER_VECTOR - 1) & \
+		     ~(CHANNELS_PER_VECTOR - 1))
+
+struct ws2801_interp_priv {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	bool stop;
+
+	/* Fade from prev at start to next at end. Protected by lock. */
+	unsigned char *prev;
+	unsigned char *next;
+	unsigned long long start;
+	unsigned long long end;
+	bool active;
+
+	/* Last output. Only written by the output thread, under lock */
+	unsigned char *out;
+	unsigned int num_channels;
+};
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* dst = a + (b - a) * t / 256, for t in [0, 256] */
+static void lerp(unsigned char *dst, const unsigned char *a,
+		 const unsigned char *b, unsigned int num_channels,
+		 unsigned short t)
+{
+	unsigned short u = 256 - t;
+	unsigned int i;
+	v8u16 va, vb;
+
+	for (i = 0; i < num_channels; i += CHANNELS_PER_VECTOR) {
+		va = v8u16_load(a + i);
+		vb = v8u16_load(b + i);
+		v8u16_store(dst + i, (va * u + vb * t) >> 8);
+	}
+}
+
+static void *ws2801_interp_task(void *data)
+{
+	struct ws2801_interp *interp = data;
+	struct ws2801_interp_priv *priv = interp->priv;
+	unsigned long long period, tick, now;
+	struct timespec ts;
+	unsigned short t;
+	bool done;
+
+	period = 1000000000ULL / interp->fps;
+	tick = now_ns();
+
+	pthread_mutex_lock(&priv->lock);
+	while (!priv->stop) {
+		if (!priv->active) {
+			pthread_cond_wait(&priv->cond, &priv->lock);
+			/* Start ticking with the first frame */
+			tick = now_ns();
+			continue;
+		}
+
+		now = now_ns();
+		if (now >= priv->end) {
+			t = 256;
+			done = true;
+		} else {
+			t = (now - priv->start) * 256 /
+			    (priv->end - priv->start);
+			done = false;
+		}
+		lerp(priv->out, priv->prev, priv->next, priv->num_channels, t);
+		/* Once the target is reached, refreshes keep it on the strip */
+		if (done)
+			priv->active = false;
+		pthread_mutex_unlock(&priv->lock);
+
+		/* Frames are dropped while the driver is in indexed mode */
+		if (interp->ws->set_leds(interp->ws, (struct led *)priv->out, 0,
+					 interp->ws->num_leds) >= 0)
+			interp->ws->commit(interp->ws);
+
+		tick += period;
+		if (tick < now)
+			tick = now + period;
+		ts.tv_sec = tick / 1000000000ULL;
+		ts.tv_nsec = tick % 1000000000ULL;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+				       NULL) == EINTR);
+
+		pthread_mutex_lock(&priv->lock);
+	}
+	pthread_mutex_unlock(&priv->lock);
+
+	return NULL;
+}
+
+int ws2801_interp_submit(struct ws2801_interp *interp, const struct led *leds,
+			 unsigned long long when)
+{
+	struct ws2801_interp_priv *priv = interp->priv;
+
+	pthread_mutex_lock(&priv->lock);
+
+	/* Fade from what the strip shows right now */
+	memcpy(priv->prev, priv->out, priv->num_channels);
+
+	memcpy(priv->next, leds, interp->ws->num_leds * sizeof(*leds));
+	priv->start = now_ns();
+	priv->end = when;
+	priv->active = true;
+
+	pthread_cond_signal(&priv->cond);
+	pthread_mutex_unlock(&priv->lock);
+
+	return 0;
+}
+
+int ws2801_interp_init(struct ws2801_interp *interp, struct ws2801_driver *ws,
+		       unsigned int fps)
+{
+	struct ws2801_interp_priv *priv;
+	unsigned int num_channels;
+	int err;
+
+	if (!fps)
+		return -EINVAL;
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv)
+		return -ENOMEM;
+
+	interp->ws = ws;
+	interp->fps = fps;
+	interp->priv = priv;
+
+	num_channels = ROUND_UP(ws->num_leds * sizeof(struct led));
+	priv->num_channels = num_channels;
+
+	err = -ENOMEM;
+	priv->prev = calloc(num_channels, 1);
+	priv->next = calloc(num_channels, 1);
+	priv->out = calloc(num_channels, 1);
+	if (!priv->prev || !priv->next || !priv->out)
+		goto free_out;
+
+	/* Start from the current content of the strip */
+	pthread_mutex_lock(&ws->data_lock);
+	if (ws->index) {
+		pthread_mutex_unlock(&ws->data_lock);
+		err = -EBUSY;
+		goto free_out;
+	}
+	memcpy(priv->out, ws->leds, ws->num_leds * sizeof(*ws->leds));
+	pthread_mutex_unlock(&ws->data_lock);
+
+	err = -pthread_mutex_init(&priv->lock, NULL);
+	if (err)
+		goto free_out;
+
+	err = -pthread_cond_init(&priv->cond, NULL);
+	if (err)
+		goto destroy_lock_out;
+
+	err = -pthread_create(&priv->thread, NULL, ws2801_interp_task, interp);
+	if (err)
+		goto destroy_cond_out;
+
+	return 0;
+
+destroy_cond_out:
+	pthread_cond_destroy(&priv->cond);
+
+destroy_lock_out:
+	pthread_mutex_destroy(&priv->lock);
+
+free_out:
+	free(priv->out);
+	free(priv->next);
+	free(priv->prev);
+	free(priv);
+	return err;
+}
+
+void ws2801_interp_free(struct ws2801_interp *interp)
+{
+	struct ws2801_interp_priv *priv = interp->priv;
+
+	pthread_mutex_lock(&priv->lock);
+	priv->stop = true;
+	pthread_cond_signal(&priv->cond);
+	pthread_mutex_unlock(&priv->lock);
+
+	pthread_join(priv->thread, NULL);
+
+	pthread_cond_destroy(&priv->cond);
+	pthread_mutex_destroy(&priv->lock);
+	free(priv->out);
+	free(priv->next);
+	free(priv->prev);
+	free(priv);
+}
@@ -12,56 +12,228 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "ws2801-common.h"
 
-#define WS2801_SYSFS "/sys/devices/ws2801/devices/"
+#define WS2801_SYSFS_ROOT "/sys/devices/ws2801/"
+#define WS2801_SYSFS WS2801_SYSFS_ROOT "devices/"
+#define WS2801_SYSFS_GROUP_COMMIT WS2801_SYSFS_ROOT "group_commit"
+#define WS2801_SYSFS_GROUP_SKEW WS2801_SYSFS_ROOT "group_skew"
 
 #define WS2801_SYSFS_COMMIT "commit"
+#define WS2801_SYSFS_COMMIT_SEQ "commit_seq"
 #define WS2801_SYSFS_NUM_LEDS "num_leds"
 #define WS2801_SYSFS_REFRESH_RATE "refresh_rate"
 #define WS2801_SYSFS_SET_RAW "set_raw"
+#define WS2801_SYSFS_SET_RAW_COMMIT "set_raw_commit"
+
+/* The LED buffer is handed to the kernel as it is */
+_Static_assert(sizeof(struct led) == 3, "struct led must be packed RGB");
 
 struct ws2801_kernel {
+	char *device_name;
 	int fd_commit;
 	int fd_refresh_rate;
 	int fd_set_raw;
+	/* Not available on older modules, -1 in that case */
+	int fd_set_raw_commit;
 	int fd_num_leds;
-	struct __attribute__((packed)) led *leds_packed;
+	/* Not available on older modules, -1 in that case */
+	int fd_commit_seq;
+
+	/* Protected by the data_lock of the driver */
+	struct ws2801_power power;
+	/* Dimmed copy of the LEDs */
+	struct led *tx;
 };
 
+/* Returns the frame to hand to the kernel: the LEDs themselves, or a dimmed
+ * copy, if they exceed the power budget. Must be called with data_lock
+ * held. */
+static const struct led *ws2801_kernel_frame(struct ws2801_driver *ws_driver)
+{
+	struct ws2801_kernel *ws = ws_driver->drv_data;
+	unsigned int scale;
+
+	scale = ws2801_power_update(&ws->power, ws_driver->leds,
+				    ws_driver->num_leds);
+	if (scale == WS2801_POWER_SCALE_NONE)
+		return ws_driver->leds;
+
+	ws2801_power_apply(ws->tx, ws_driver->leds, ws_driver->num_leds,
+			   scale);
+	return ws->tx;
+}
+
 static void ws2801_kernel_commit(struct ws2801_driver *ws_driver)
 {
 	struct ws2801_kernel *ws = ws_driver->drv_data;
-	unsigned int i;
-	struct __attribute__((packed)) led *dst = ws->leds_packed;
-	struct led *src = ws_driver->leds;
+	size_t len = ws_driver->num_leds * sizeof(*ws_driver->leds);
+	const struct led *frame;
+	ssize_t written;
 
+	/* Hold the lock during the write, so that the frame can't tear */
 	pthread_mutex_lock(&ws_driver->data_lock);
-
-	for (i = 0; i < ws_driver->num_leds; i++, dst++, src++) {
-		dst->r = src->r;
-		dst->g = src->g;
-		dst->b = src->b;
+	frame = ws2801_kernel_frame(ws_driver);
+	if (ws->fd_set_raw_commit >= 0) {
+		written = write(ws->fd_set_raw_commit, frame, len);
+	} else {
+		written = write(ws->fd_set_raw, frame, len);
+		if (written != -1)
+			written = write(ws->fd_commit, "", 1);
 	}
-
+	if (written != -1)
+		ws2801_record_commit(ws_driver);
 	pthread_mutex_unlock(&ws_driver->data_lock);
 
-	if (write(ws->fd_set_raw, ws->leds_packed,
-		  ws_driver->num_leds * sizeof(*dst)) == -1) {
-		fprintf(stderr, "ws2801: error during set_raw\n");
+	if (written == -1) {
+		fprintf(stderr, "ws2801: error during commit\n");
 		exit(-errno);
 	}
 
-	if (write(ws->fd_commit, "", 1) == -1) {
-		fprintf(stderr, "ws2801: error during commit\n");
-		exit(-errno);
+	ws2801_commit_hook(ws_driver);
+}
+
+/* The module shifts out all members and latches them together */
+static int ws2801_kernel_group_commit(struct ws2801_group *group)
+{
+	struct ws2801_driver *ws_driver;
+	struct ws2801_kernel *ws;
+	unsigned long long skew_last, skew_max;
+	char *names, *pos, buffer[64];
+	size_t len = 1;
+	ssize_t bytes;
+	unsigned int i;
+	int fd, err = 0;
+
+	for (i = 0; i < group->num_members; i++) {
+		ws = group->members[i]->drv_data;
+		len += strlen(ws->device_name) + 1;
 	}
+
+	names = malloc(len);
+	if (!names)
+		return -ENOMEM;
+
+	pos = names;
+	for (i = 0; i < group->num_members; i++) {
+		ws_driver = group->members[i];
+		ws = ws_driver->drv_data;
+		pos += sprintf(pos, "%s ", ws->device_name);
+
+		pthread_mutex_lock(&ws_driver->data_lock);
+		bytes = write(ws->fd_set_raw, ws2801_kernel_frame(ws_driver),
+			      ws_driver->num_leds * sizeof(*ws_driver->leds));
+		/* This is the frame that the group commit latches */
+		if (bytes != -1)
+			ws2801_record_commit(ws_driver);
+		pthread_mutex_unlock(&ws_driver->data_lock);
+		if (bytes == -1) {
+			err = -errno;
+			goto free_out;
+		}
+	}
+	pos[-1] = '\n';
+
+	fd = open(WS2801_SYSFS_GROUP_COMMIT, O_WRONLY);
+	if (fd == -1) {
+		err = -errno;
+		goto free_out;
+	}
+	if (write(fd, names, pos - names) == -1)
+		err = -errno;
+	close(fd);
+	if (err)
+		goto free_out;
+
+	/* The skew of the last group commit, and the maximum of the module */
+	fd = open(WS2801_SYSFS_GROUP_SKEW, O_RDONLY);
+	if (fd != -1) {
+		bytes = read(fd, buffer, sizeof(buffer) - 1);
+		if (bytes > 0) {
+			buffer[bytes] = 0;
+			if (sscanf(buffer, "%llu %llu", &skew_last,
+				   &skew_max) == 2) {
+				group->skew_last = skew_last;
+				if (skew_last > group->skew_max)
+					group->skew_max = skew_last;
+			}
+		}
+		close(fd);
+	}
+
+	for (i = 0; i < group->num_members; i++)
+		ws2801_commit_hook(group->members[i]);
+
+free_out:
+	free(names);
+	return err;
+}
+
+static int ws2801_kernel_wait_commit(struct ws2801_driver *ws_driver,
+				     int timeout_ms)
+{
+	struct ws2801_kernel *ws = ws_driver->drv_data;
+	struct pollfd pfd = {
+		.fd = ws->fd_commit_seq,
+		.events = POLLPRI,
+	};
+	char buffer[32];
+	int err;
+
+	if (ws->fd_commit_seq < 0)
+		return -ENOSYS;
+
+	/*
+	 * sysfs only reports changes that happen after the last read, so
+	 * read first to arm poll()
+	 */
+	if (pread(ws->fd_commit_seq, buffer, sizeof(buffer), 0) == -1)
+		return -errno;
+
+	err = poll(&pfd, 1, timeout_ms);
+	if (err == -1)
+		return -errno;
+	else if (err == 0)
+		return -ETIMEDOUT;
+
+	return 0;
+}
+
+/* Transmissions are not visible to userspace, only the power limiter is
+ * accounted */
+static int ws2801_kernel_get_stats(struct ws2801_driver *ws_driver,
+				   struct ws2801_stats *stats)
+{
+	struct ws2801_kernel *ws = ws_driver->drv_data;
+
+	memset(stats, 0, sizeof(*stats));
+
+	pthread_mutex_lock(&ws_driver->data_lock);
+	ws2801_power_stats(&ws->power, stats);
+	pthread_mutex_unlock(&ws_driver->data_lock);
+
+	return 0;
+}
+
+static int ws2801_kernel_set_power_limit(struct ws2801_driver *ws_driver,
+					 const struct ws2801_power_limit *limit)
+{
+	struct ws2801_kernel *ws = ws_driver->drv_data;
+	int err;
+
+	pthread_mutex_lock(&ws_driver->data_lock);
+	err = ws2801_power_set_limit(&ws->power, limit);
+	pthread_mutex_unlock(&ws_driver->data_lock);
+
+	return err;
 }
 
 static int ws2801_kernel_set_refresh_rate(struct ws2801_driver *ws_driver,
@@ -89,11 +261,12 @@ static void __ws2801_kernel_free(struct ws2801_kernel *ws)
 	__close_handle(ws->fd_commit);
 	__close_handle(ws->fd_refresh_rate);
 	__close_handle(ws->fd_set_raw);
+	__close_handle(ws->fd_set_raw_commit);
 	__close_handle(ws->fd_num_leds);
+	__close_handle(ws->fd_commit_seq);
 
-	if (ws->leds_packed)
-		free(ws->leds_packed);
-
+	free(ws->tx);
+	free(ws->device_name);
 	free(ws);
 }
 
@@ -134,10 +307,14 @@ int ws2801_kernel_init(unsigned int num_leds, const char *device_name,
 	if (!ws)
 		return -ENOMEM;
 
-	ws->leds_packed = malloc(num_leds * sizeof(*ws->leds_packed));
-	if (!ws->leds_packed) {
-		err = -ENOMEM;
-		goto free_out;
+	ws->fd_set_raw_commit = -1;
+	ws->fd_commit_seq = -1;
+	ws2801_power_init(&ws->power);
+
+	ws->device_name = strdup(device_name);
+	if (!ws->device_name) {
+		free(ws);
+		return -ENOMEM;
 	}
 
 	err = ws2801_init(ws_driver, num_leds);
@@ -146,6 +323,12 @@ int ws2801_kernel_init(unsigned int num_leds, const char *device_name,
 
 	ws_driver->drv_data = ws;
 
+	ws->tx = calloc(num_leds, sizeof(*ws->tx));
+	if (!ws->tx) {
+		err = -ENOMEM;
+		goto free_out;
+	}
+
 #define OPEN_SYSFS_ATTRIBUTE(__fd, __attribute) \
 	snprintf(buffer, sizeof(buffer), WS2801_SYSFS "%s/" __attribute, \
 		 device_name); \
@@ -162,6 +345,14 @@ int ws2801_kernel_init(unsigned int num_leds, const char *device_name,
 	OPEN_SYSFS_ATTRIBUTE(ws->fd_num_leds, WS2801_SYSFS_NUM_LEDS);
 #undef OPEN_SYSFS_ATTRIBUTE
 
+	snprintf(buffer, sizeof(buffer), WS2801_SYSFS "%s/"
+		 WS2801_SYSFS_SET_RAW_COMMIT, device_name);
+	ws->fd_set_raw_commit = open(buffer, O_WRONLY);
+
+	snprintf(buffer, sizeof(buffer), WS2801_SYSFS "%s/"
+		 WS2801_SYSFS_COMMIT_SEQ, device_name);
+	ws->fd_commit_seq = open(buffer, O_RDONLY);
+
 	err = ws2801_kernel_set_num_leds(ws_driver, num_leds);
 	if (err)
 		goto free_out;
@@ -170,9 +361,17 @@ int ws2801_kernel_init(unsigned int num_leds, const char *device_name,
 	ws_driver->clear = ws2801_clear;
 	ws_driver->commit = ws2801_kernel_commit;
 	ws_driver->set_refresh_rate = ws2801_kernel_set_refresh_rate;
+	ws_driver->refresh = ws2801_refresh;
+	ws_driver->group_commit = ws2801_kernel_group_commit;
 	ws_driver->set_led = ws2801_set_led;
 	ws_driver->set_leds = ws2801_set_leds;
 	ws_driver->full_on = ws2801_full_on;
+	ws_driver->update = ws2801_update;
+	ws_driver->update_mask = ws2801_update_mask;
+	ws_driver->get_stats = ws2801_kernel_get_stats;
+	ws_driver->set_power_limit = ws2801_kernel_set_power_limit;
+	ws_driver->wait_commit = ws2801_kernel_wait_commit;
+	ws_driver->set_indexed = ws2801_no_indexed;
 	ws_driver->free = ws2801_kernel_free;
 
 	return 0;
@@ -0,0 +1,173 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "ws2801-common.h"
+#include "ws2801-simd.h"
+
+/* The sum kernel processes 16 LEDs, six vectors, per iteration. As 48 is a
+ * multiple of three, every lane of the accumulators always sums up the same
+ * channel. */
+#define SUM_VECTORS 6
+#define SUM_BLOCK (SUM_VECTORS * 8)
+/* 16 bit lanes can take this many blocks without overflow */
+#define SUM_BLOCKS_MAX 256
+
+/* Sums up every channel of num_leds LEDs */
+static void ws2801_power_sum(const struct led *leds, unsigned int num_leds,
+			     unsigned long long sum[3])
+{
+	const unsigned char *src = (const unsigned char *)leds;
+	size_t i = 0, len = num_leds * sizeof(*leds);
+	v8u16 acc[SUM_VECTORS];
+	unsigned int block, k, j;
+
+	sum[0] = sum[1] = sum[2] = 0;
+
+	while (len - i >= SUM_BLOCK) {
+		memset(acc, 0, sizeof(acc));
+		for (block = 0; block < SUM_BLOCKS_MAX &&
+		     len - i >= SUM_BLOCK; block++, i += SUM_BLOCK)
+			for (k = 0; k < SUM_VECTORS; k++)
+				acc[k] += v8u16_load(src + i + 8 * k);
+
+		for (k = 0; k < SUM_VECTORS; k++)
+			for (j = 0; j < 8; j++)
+				sum[(8 * k + j) % 3] += acc[k][j];
+	}
+
+	for (; i < len; i++)
+		sum[i % 3] += src[i];
+}
+
+/* Same as ws2801_power_sum(), for an indexed frame. LEDs are counted per
+ * palette index first, so that every palette color is only looked up once. */
+static void ws2801_power_sum_indexed(const unsigned char *index,
+				     const struct led *palette,
+				     unsigned int num_leds,
+				     unsigned long long sum[3])
+{
+	unsigned int count[WS2801_PALETTE_SIZE] = { 0 };
+	unsigned int i;
+
+	for (i = 0; i < num_leds; i++)
+		count[index[i]]++;
+
+	sum[0] = sum[1] = sum[2] = 0;
+	for (i = 0; i < WS2801_PALETTE_SIZE; i++) {
+		sum[0] += (unsigned long long)count[i] * palette[i].r;
+		sum[1] += (unsigned long long)count[i] * palette[i].g;
+		sum[2] += (unsigned long long)count[i] * palette[i].b;
+	}
+}
+
+void ws2801_power_init(struct ws2801_power *power)
+{
+	memset(power, 0, sizeof(*power));
+	power->scale = WS2801_POWER_SCALE_NONE;
+}
+
+int ws2801_power_set_limit(struct ws2801_power *power,
+			   const struct ws2801_power_limit *limit)
+{
+	if (!limit) {
+		power->limit.budget_ma = 0;
+		return 0;
+	}
+
+	if (!limit->r_ma && !limit->g_ma && !limit->b_ma)
+		return -EINVAL;
+
+	power->limit = *limit;
+
+	return 0;
+}
+
+static unsigned int ws2801_power_unlimited(struct ws2801_power *power)
+{
+	power->current_ma = 0;
+	power->scale = WS2801_POWER_SCALE_NONE;
+	return power->scale;
+}
+
+/* Estimates the current from the channel sums of a frame */
+static unsigned int ws2801_power_scale(struct ws2801_power *power,
+				       const unsigned long long sum[3])
+{
+	const struct ws2801_power_limit *limit = &power->limit;
+	unsigned long long current_ma;
+
+	current_ma = (sum[0] * limit->r_ma + sum[1] * limit->g_ma +
+		      sum[2] * limit->b_ma) / 255;
+
+	power->current_ma = current_ma;
+	if (current_ma > limit->budget_ma) {
+		power->scale = limit->budget_ma * WS2801_POWER_SCALE_NONE /
+			       current_ma;
+		power->frames_limited++;
+	} else {
+		power->scale = WS2801_POWER_SCALE_NONE;
+	}
+
+	return power->scale;
+}
+
+unsigned int ws2801_power_update(struct ws2801_power *power,
+				 const struct led *leds, unsigned int num_leds)
+{
+	unsigned long long sum[3];
+
+	if (!power->limit.budget_ma)
+		return ws2801_power_unlimited(power);
+
+	ws2801_power_sum(leds, num_leds, sum);
+	return ws2801_power_scale(power, sum);
+}
+
+unsigned int ws2801_power_update_indexed(struct ws2801_power *power,
+					 const unsigned char *index,
+					 const struct led *palette,
+					 unsigned int num_leds)
+{
+	unsigned long long sum[3];
+
+	if (!power->limit.budget_ma)
+		return ws2801_power_unlimited(power);
+
+	ws2801_power_sum_indexed(index, palette, num_leds, sum);
+	return ws2801_power_scale(power, sum);
+}
+
+void ws2801_power_apply(struct led *dst, const struct led *src,
+			unsigned int num_leds, unsigned int scale)
+{
+	const unsigned char *s = (const unsigned char *)src;
+	unsigned char *d = (unsigned char *)dst;
+	size_t i, len = num_leds * sizeof(*src);
+	unsigned short f = scale;
+
+	for (i = 0; i + 8 <= len; i += 8)
+		v8u16_store(d + i, (v8u16_load(s + i) * f) >> 8);
+
+	for (; i < len; i++)
+		d[i] = (s[i] * f) >> 8;
+}
+
+void ws2801_power_stats(const struct ws2801_power *power,
+			struct ws2801_stats *stats)
+{
+	stats->power_ma = power->current_ma;
+	stats->power_scale = power->scale;
+	stats->frames_limited = power->frames_limited;
+}
@@ -0,0 +1,355 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ws2801-common.h"
+
+#define NEVER ULLONG_MAX
+
+struct ws2801_sched_entry {
+	struct ws2801_driver *ws;
+	int priority;
+	/* when the refresh op has to be called next, in ns */
+	unsigned long long due;
+	/* the refresh op is currently called by a worker */
+	bool busy;
+	/* the refresh rate changed while the entry was busy */
+	bool woken;
+};
+
+struct ws2801_sched_priv {
+	pthread_mutex_t lock;
+	/* Workers wait here for due entries */
+	pthread_cond_t cond;
+	/* Removals wait here for busy entries */
+	pthread_cond_t idle_cond;
+	bool stop;
+
+	struct ws2801_sched_entry **entries;
+	unsigned int num_entries;
+	unsigned int max_entries;
+
+	pthread_t *workers;
+};
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Returns the due entry with the highest priority. Among equal priorities,
+ * the entry that is due for the longest time wins, so that strips of the same
+ * priority are served round-robin. If no entry is due, next is set to the
+ * time when the next one becomes due. */
+static struct ws2801_sched_entry *
+ws2801_sched_pick(struct ws2801_sched_priv *priv, unsigned long long now,
+		  unsigned long long *next)
+{
+	struct ws2801_sched_entry *e, *best = NULL;
+	unsigned int i;
+
+	*next = NEVER;
+	for (i = 0; i < priv->num_entries; i++) {
+		e = priv->entries[i];
+		if (e->busy)
+			continue;
+
+		if (e->due > now) {
+			if (e->due < *next)
+				*next = e->due;
+			continue;
+		}
+
+		if (!best || e->priority > best->priority ||
+		    (e->priority == best->priority && e->due < best->due))
+			best = e;
+	}
+
+	return best;
+}
+
+static int ws2801_sched_wait(struct ws2801_sched_priv *priv,
+			     unsigned long long until)
+{
+	struct timespec ts;
+
+	if (until == NEVER)
+		return pthread_cond_wait(&priv->cond, &priv->lock);
+
+	ts.tv_sec = until / 1000000000ULL;
+	ts.tv_nsec = until % 1000000000ULL;
+
+	return pthread_cond_timedwait(&priv->cond, &priv->lock, &ts);
+}
+
+static void *ws2801_sched_worker(void *data)
+{
+	struct ws2801_sched_priv *priv = data;
+	struct ws2801_sched_entry *e;
+	unsigned long long next;
+	int delay;
+
+	pthread_mutex_lock(&priv->lock);
+	while (!priv->stop) {
+		e = ws2801_sched_pick(priv, now_ns(), &next);
+		if (!e) {
+			ws2801_sched_wait(priv, next);
+			continue;
+		}
+
+		e->busy = true;
+		pthread_mutex_unlock(&priv->lock);
+
+		delay = e->ws->refresh(e->ws);
+
+		pthread_mutex_lock(&priv->lock);
+		e->busy = false;
+		if (e->woken) {
+			e->woken = false;
+			e->due = now_ns();
+		} else if (delay > 0) {
+			e->due = now_ns() + delay * 1000000ULL;
+		} else {
+			/* Refreshes are off, or failed */
+			e->due = NEVER;
+		}
+
+		/* Sleeping workers did not consider this entry */
+		pthread_cond_signal(&priv->cond);
+		pthread_cond_broadcast(&priv->idle_cond);
+	}
+	pthread_mutex_unlock(&priv->lock);
+
+	return NULL;
+}
+
+static int ws2801_sched_find(struct ws2801_sched_priv *priv,
+			     struct ws2801_driver *ws)
+{
+	unsigned int i;
+
+	for (i = 0; i < priv->num_entries; i++)
+		if (priv->entries[i]->ws == ws)
+			return i;
+
+	return -ENOENT;
+}
+
+int ws2801_sched_wake(struct ws2801_sched *sched, struct ws2801_driver *ws)
+{
+	struct ws2801_sched_priv *priv = sched->priv;
+	struct ws2801_sched_entry *e;
+	int i, err = 0;
+
+	pthread_mutex_lock(&priv->lock);
+	i = ws2801_sched_find(priv, ws);
+	if (i < 0) {
+		err = i;
+		goto unlock_out;
+	}
+
+	e = priv->entries[i];
+	if (e->busy) {
+		e->woken = true;
+	} else {
+		e->due = now_ns();
+		pthread_cond_signal(&priv->cond);
+	}
+
+unlock_out:
+	pthread_mutex_unlock(&priv->lock);
+	return err;
+}
+
+int ws2801_sched_add(struct ws2801_sched *sched, struct ws2801_driver *ws,
+		     int priority)
+{
+	struct ws2801_sched_priv *priv = sched->priv;
+	struct ws2801_sched_entry *e, **entries;
+	unsigned int max_entries;
+	int err = 0;
+
+	if (ws->refresh == ws2801_refresh)
+		return -ENOSYS;
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return -ENOMEM;
+
+	e->ws = ws;
+	e->priority = priority;
+	/* The first call of the refresh op takes the refreshes over */
+	e->due = now_ns();
+
+	pthread_mutex_lock(&priv->lock);
+	if (priv->num_entries == priv->max_entries) {
+		max_entries = priv->max_entries ? priv->max_entries * 2 : 16;
+		entries = realloc(priv->entries,
+				  max_entries * sizeof(*entries));
+		if (!entries) {
+			err = -ENOMEM;
+			goto free_out;
+		}
+		priv->entries = entries;
+		priv->max_entries = max_entries;
+	}
+
+	/* The driver might belong to another scheduler */
+	pthread_mutex_lock(&ws->data_lock);
+	if (ws->sched)
+		err = -EBUSY;
+	else
+		ws->sched = sched;
+	pthread_mutex_unlock(&ws->data_lock);
+	if (err)
+		goto free_out;
+
+	priv->entries[priv->num_entries++] = e;
+	pthread_cond_signal(&priv->cond);
+	pthread_mutex_unlock(&priv->lock);
+
+	return 0;
+
+free_out:
+	pthread_mutex_unlock(&priv->lock);
+	free(e);
+	return err;
+}
+
+void ws2801_sched_remove(struct ws2801_sched *sched, struct ws2801_driver *ws)
+{
+	struct ws2801_sched_priv *priv = sched->priv;
+	struct ws2801_sched_entry *e;
+	int i;
+
+	pthread_mutex_lock(&priv->lock);
+	i = ws2801_sched_find(priv, ws);
+	if (i < 0) {
+		pthread_mutex_unlock(&priv->lock);
+		return;
+	}
+
+	e = priv->entries[i];
+	while (e->busy)
+		pthread_cond_wait(&priv->idle_cond, &priv->lock);
+
+	/* The entry might have moved while we were waiting */
+	i = ws2801_sched_find(priv, ws);
+	priv->entries[i] = priv->entries[--priv->num_entries];
+	pthread_mutex_lock(&ws->data_lock);
+	ws->sched = NULL;
+	pthread_mutex_unlock(&ws->data_lock);
+	pthread_mutex_unlock(&priv->lock);
+
+	free(e);
+
+	/* Without a scheduler, the driver takes its refreshes back */
+	ws->refresh(ws);
+}
+
+int ws2801_sched_init(struct ws2801_sched *sched, unsigned int num_workers)
+{
+	struct ws2801_sched_priv *priv;
+	pthread_condattr_t attr;
+	unsigned int i;
+	int err;
+
+	if (!num_workers)
+		return -EINVAL;
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv)
+		return -ENOMEM;
+
+	priv->workers = calloc(num_workers, sizeof(*priv->workers));
+	if (!priv->workers) {
+		err = -ENOMEM;
+		goto free_out;
+	}
+
+	err = -pthread_mutex_init(&priv->lock, NULL);
+	if (err)
+		goto free_workers_out;
+
+	/* Deadlines are taken from the monotonic clock */
+	err = -pthread_condattr_init(&attr);
+	if (err)
+		goto free_lock_out;
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	err = -pthread_cond_init(&priv->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	if (err)
+		goto free_lock_out;
+
+	err = -pthread_cond_init(&priv->idle_cond, NULL);
+	if (err)
+		goto free_cond_out;
+
+	sched->priv = priv;
+	sched->num_workers = 0;
+	for (i = 0; i < num_workers; i++) {
+		err = -pthread_create(&priv->workers[i], NULL,
+				      ws2801_sched_worker, priv);
+		if (err) {
+			ws2801_sched_free(sched);
+			return err;
+		}
+		sched->num_workers++;
+	}
+
+	return 0;
+
+free_cond_out:
+	pthread_cond_destroy(&priv->cond);
+
+free_lock_out:
+	pthread_mutex_destroy(&priv->lock);
+
+free_workers_out:
+	free(priv->workers);
+
+free_out:
+	free(priv);
+	return err;
+}
+
+void ws2801_sched_free(struct ws2801_sched *sched)
+{
+	struct ws2801_sched_priv *priv = sched->priv;
+	unsigned int i;
+
+	pthread_mutex_lock(&priv->lock);
+	priv->stop = true;
+	pthread_cond_broadcast(&priv->cond);
+	pthread_mutex_unlock(&priv->lock);
+
+	for (i = 0; i < sched->num_workers; i++)
+		pthread_join(priv->workers[i], NULL);
+
+	/* No worker is left, so no entry is busy */
+	while (priv->num_entries)
+		ws2801_sched_remove(sched, priv->entries[0]->ws);
+
+	pthread_cond_destroy(&priv->idle_cond);
+	pthread_cond_destroy(&priv->cond);
+	pthread_mutex_destroy(&priv->lock);
+	free(priv->entries);
+	free(priv->workers);
+	free(priv);
+}
@@ -0,0 +1,666 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#define _GNU_SOURCE
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ws2801-common.h"
+#include "ws2801-seq.h"
+
+struct ws2801_seq_priv {
+	void *map;
+	size_t map_size;
+	const unsigned char *frames;
+	size_t frames_size;
+	size_t stride;
+	bool timestamps;
+	/* only required if the file is not in RGB order */
+	struct led *scratch;
+
+	/* State of the decoder of compressed sequences */
+	bool compressed;
+	size_t frame_size;
+	/* offset of the record of next_frame */
+	size_t pos;
+	unsigned int next_frame;
+	unsigned long long cur_ts;
+	/* bytes of cur that changed since the last load */
+	size_t lo, hi;
+	/* last frame that was looked up by ws2801_seq_time */
+	unsigned int lookup_frame;
+	unsigned long long lookup_ts;
+	struct led *cur;
+};
+
+struct ws2801_seq_record {
+	unsigned long long ts;
+	unsigned char type;
+	const unsigned char *payload;
+	size_t size;
+	size_t next;
+};
+
+struct ws2801_recorder_priv {
+	struct ws2801_driver *ws;
+	FILE *file;
+	unsigned int fps;
+
+	/* Serialises records. Protects everything below. */
+	pthread_mutex_t lock;
+	unsigned int num_frames;
+	unsigned long long start;
+	/* Timestamp and frame, written at once */
+	unsigned char *record;
+	size_t record_size;
+	/* Recording stopped after a short write */
+	bool failed;
+};
+
+/* Byte offset of red, green and blue for each color order */
+static const unsigned char order_offsets[][3] = {
+	[WS2801_ORDER_RGB] = { 0, 1, 2 },
+	[WS2801_ORDER_RBG] = { 0, 2, 1 },
+	[WS2801_ORDER_GRB] = { 1, 0, 2 },
+	[WS2801_ORDER_GBR] = { 2, 0, 1 },
+	[WS2801_ORDER_BRG] = { 1, 2, 0 },
+	[WS2801_ORDER_BGR] = { 2, 1, 0 },
+};
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int ws2801_seq_record(const struct ws2801_seq_priv *priv, size_t pos,
+			     struct ws2801_seq_record *rec)
+{
+	const unsigned char *p = priv->frames + pos;
+	size_t avail = priv->frames_size - pos;
+	uint64_t ts = 0;
+	uint32_t size;
+
+	if (priv->timestamps) {
+		if (avail < sizeof(ts))
+			return -EINVAL;
+		memcpy(&ts, p, sizeof(ts));
+		p += sizeof(ts);
+		avail -= sizeof(ts);
+	}
+
+	if (avail < WS2801_SEQ_RECORD_HEADER_SIZE)
+		return -EINVAL;
+	memcpy(&size, p, sizeof(size));
+	size = le32toh(size);
+	rec->type = p[sizeof(size)];
+	p += WS2801_SEQ_RECORD_HEADER_SIZE;
+	avail -= WS2801_SEQ_RECORD_HEADER_SIZE;
+
+	if (size > avail || rec->type > WS2801_SEQ_DELTA)
+		return -EINVAL;
+
+	rec->ts = le64toh(ts);
+	rec->payload = p;
+	rec->size = size;
+	rec->next = p + size - priv->frames;
+
+	return 0;
+}
+
+static int read_varint(const unsigned char **p, const unsigned char *end,
+		       size_t *value)
+{
+	unsigned int shift = 0;
+	unsigned char byte;
+
+	*value = 0;
+	do {
+		if (*p == end || shift > 28)
+			return -EINVAL;
+		byte = *(*p)++;
+		*value |= (size_t)(byte & 0x7f) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+
+	return 0;
+}
+
+/* XOR the runs of a record into the current frame */
+static int ws2801_seq_apply(struct ws2801_seq_priv *priv,
+			    const struct ws2801_seq_record *rec)
+{
+	const unsigned char *p = rec->payload, *end = p + rec->size;
+	unsigned char *cur = (unsigned char *)priv->cur;
+	size_t pos = 0, skip, count, i;
+
+	if (rec->type == WS2801_SEQ_KEYFRAME) {
+		memset(cur, 0, priv->frame_size);
+		priv->lo = 0;
+		priv->hi = priv->frame_size;
+	}
+
+	while (p < end) {
+		if (read_varint(&p, end, &skip) ||
+		    read_varint(&p, end, &count))
+			return -EINVAL;
+
+		if (skip > priv->frame_size - pos ||
+		    count > priv->frame_size - pos - skip ||
+		    count > end - p)
+			return -EINVAL;
+		pos += skip;
+
+		if (count) {
+			if (pos < priv->lo)
+				priv->lo = pos;
+			if (pos + count > priv->hi)
+				priv->hi = pos + count;
+		}
+
+		for (i = 0; i < count; i++)
+			cur[pos + i] ^= p[i];
+		pos += count;
+		p += count;
+	}
+
+	return 0;
+}
+
+/* Number of records of a compressed sequence that was never finished */
+static unsigned int ws2801_seq_count(const struct ws2801_seq_priv *priv)
+{
+	struct ws2801_seq_record rec;
+	unsigned int num_frames = 0;
+	size_t pos = 0;
+
+	while (!ws2801_seq_record(priv, pos, &rec)) {
+		pos = rec.next;
+		num_frames++;
+	}
+
+	return num_frames;
+}
+
+int ws2801_seq_open(struct ws2801_seq *seq, const char *path)
+{
+	const struct ws2801_seq_header *hdr;
+	struct ws2801_seq_priv *priv;
+	unsigned int avail;
+	struct stat st;
+	int fd, err;
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv)
+		return -ENOMEM;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		err = -errno;
+		goto free_out;
+	}
+
+	if (fstat(fd, &st)) {
+		err = -errno;
+		goto close_out;
+	}
+
+	err = -EINVAL;
+	if (st.st_size < sizeof(*hdr))
+		goto close_out;
+
+	priv->map_size = st.st_size;
+	priv->map = mmap(NULL, priv->map_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (priv->map == MAP_FAILED) {
+		err = -errno;
+		goto close_out;
+	}
+	close(fd);
+
+	/* frames are usually played from the first to the last one */
+	madvise(priv->map, priv->map_size, MADV_SEQUENTIAL);
+
+	hdr = priv->map;
+	if (memcmp(hdr->magic, WS2801_SEQ_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != WS2801_SEQ_VERSION ||
+	    hdr->order > WS2801_ORDER_BGR)
+		goto unmap_out;
+
+	seq->num_leds = le32toh(hdr->num_leds);
+	seq->num_frames = le32toh(hdr->num_frames);
+	seq->fps = le32toh(hdr->fps);
+	seq->order = hdr->order;
+	seq->priv = priv;
+
+	priv->timestamps = le16toh(hdr->flags) & WS2801_SEQ_TIMESTAMPS;
+	priv->compressed = le16toh(hdr->flags) & WS2801_SEQ_COMPRESSED;
+	if (!seq->num_leds || (!priv->timestamps && !seq->fps))
+		goto unmap_out;
+
+	priv->frames = (const void *)(hdr + 1);
+	priv->frames_size = priv->map_size - sizeof(*hdr);
+	priv->frame_size = seq->num_leds * sizeof(struct led);
+	priv->stride = priv->frame_size;
+	if (priv->timestamps)
+		priv->stride += sizeof(uint64_t);
+
+	if (priv->compressed) {
+		/* Records have a variable length, so the number of frames of
+		 * unfinished recordings is only known after a full scan */
+		if (!seq->num_frames)
+			seq->num_frames = ws2801_seq_count(priv);
+
+		err = -ENOMEM;
+		priv->cur = malloc(priv->frame_size);
+		if (!priv->cur)
+			goto unmap_out;
+		priv->lo = priv->frame_size;
+		priv->lookup_frame = UINT_MAX;
+	} else {
+		avail = priv->frames_size / priv->stride;
+		if (!seq->num_frames)
+			seq->num_frames = avail;
+		else if (seq->num_frames > avail)
+			goto unmap_out;
+	}
+
+	if (seq->order != WS2801_ORDER_RGB) {
+		priv->scratch = malloc(seq->num_leds * sizeof(struct led));
+		if (!priv->scratch) {
+			err = -ENOMEM;
+			goto unmap_out;
+		}
+	}
+
+	return 0;
+
+unmap_out:
+	free(priv->cur);
+	munmap(priv->map, priv->map_size);
+	free(priv);
+	return err;
+
+close_out:
+	close(fd);
+
+free_out:
+	free(priv);
+	return err;
+}
+
+void ws2801_seq_close(struct ws2801_seq *seq)
+{
+	struct ws2801_seq_priv *priv = seq->priv;
+
+	munmap(priv->map, priv->map_size);
+	free(priv->scratch);
+	free(priv->cur);
+	free(priv);
+}
+
+static unsigned long long
+ws2801_seq_time_compressed(struct ws2801_seq_priv *priv, unsigned int frame)
+{
+	struct ws2801_seq_record rec;
+	unsigned int i;
+	size_t pos;
+
+	/* Players ask for the time of the frame they just loaded */
+	if (frame + 1 == priv->next_frame)
+		return priv->cur_ts;
+
+	if (frame == priv->lookup_frame)
+		return priv->lookup_ts;
+
+	if (frame >= priv->next_frame) {
+		i = priv->next_frame;
+		pos = priv->pos;
+	} else {
+		i = 0;
+		pos = 0;
+	}
+
+	for (; i <= frame; i++) {
+		if (ws2801_seq_record(priv, pos, &rec))
+			return ULLONG_MAX;
+		pos = rec.next;
+	}
+
+	priv->lookup_frame = frame;
+	priv->lookup_ts = rec.ts;
+
+	return rec.ts;
+}
+
+unsigned long long ws2801_seq_time(const struct ws2801_seq *seq,
+				   unsigned int frame)
+{
+	struct ws2801_seq_priv *priv = seq->priv;
+	uint64_t ts;
+
+	if (frame >= seq->num_frames)
+		return ULLONG_MAX;
+
+	if (!priv->timestamps)
+		return frame * 1000000000ULL / seq->fps;
+
+	if (priv->compressed)
+		return ws2801_seq_time_compressed(priv, frame);
+
+	/* timestamps are not necessarily aligned in the file */
+	memcpy(&ts, priv->frames + frame * priv->stride, sizeof(ts));
+	return le64toh(ts);
+}
+
+/* Hand num_leds LEDs, starting at first, to the driver */
+static int ws2801_seq_output(struct ws2801_seq *seq, struct ws2801_driver *ws,
+			     const struct led *src, unsigned int first,
+			     unsigned int num_leds)
+{
+	struct ws2801_seq_priv *priv = seq->priv;
+	const unsigned char *offsets, *px;
+	unsigned int i;
+	int ret;
+
+	src += first;
+	if (priv->scratch) {
+		offsets = order_offsets[seq->order];
+		for (i = 0; i < num_leds; i++) {
+			px = (const unsigned char *)(src + i);
+			priv->scratch[i].r = px[offsets[0]];
+			priv->scratch[i].g = px[offsets[1]];
+			priv->scratch[i].b = px[offsets[2]];
+		}
+		src = priv->scratch;
+	}
+
+	ret = ws->set_leds(ws, src, first, num_leds);
+	if (ret < 0)
+		return ret;
+
+	return 0;
+}
+
+static int ws2801_seq_load_compressed(struct ws2801_seq *seq,
+				      struct ws2801_driver *ws,
+				      unsigned int frame)
+{
+	struct ws2801_seq_priv *priv = seq->priv;
+	struct ws2801_seq_record rec;
+	unsigned int i, key, first;
+	size_t pos, key_pos;
+	int err;
+
+	/* Deltas only go forward, so seeking back restarts at the beginning */
+	if (frame < priv->next_frame) {
+		priv->next_frame = 0;
+		priv->pos = 0;
+	}
+
+	/* Nothing before the last keyframe up to frame needs to be decoded */
+	key = priv->next_frame;
+	key_pos = pos = priv->pos;
+	for (i = priv->next_frame; i <= frame; i++) {
+		err = ws2801_seq_record(priv, pos, &rec);
+		if (err)
+			return err;
+		if (rec.type == WS2801_SEQ_KEYFRAME) {
+			key = i;
+			key_pos = pos;
+		}
+		pos = rec.next;
+	}
+
+	for (i = key, pos = key_pos; i <= frame; i++) {
+		ws2801_seq_record(priv, pos, &rec);
+		if (i == 0 && rec.type != WS2801_SEQ_KEYFRAME)
+			err = -EINVAL;
+		else
+			err = ws2801_seq_apply(priv, &rec);
+		if (err) {
+			/* The current frame is garbage now */
+			priv->next_frame = 0;
+			priv->pos = 0;
+			return err;
+		}
+		pos = rec.next;
+	}
+
+	priv->next_frame = frame + 1;
+	priv->pos = pos;
+	priv->cur_ts = rec.ts;
+
+	if (priv->lo >= priv->hi)
+		return 0;
+
+	/* Only the LEDs that actually changed are handed to the driver */
+	first = priv->lo / sizeof(struct led);
+	err = ws2801_seq_output(seq, ws, priv->cur, first,
+				(priv->hi + sizeof(struct led) - 1) /
+				sizeof(struct led) - first);
+	/* On errors, the changes are handed over with the next frame */
+	if (err)
+		return err;
+
+	priv->lo = priv->frame_size;
+	priv->hi = 0;
+
+	return 0;
+}
+
+int ws2801_seq_load(struct ws2801_seq *seq, struct ws2801_driver *ws,
+		    unsigned int frame)
+{
+	struct ws2801_seq_priv *priv = seq->priv;
+	const struct led *src;
+
+	if (frame >= seq->num_frames)
+		return -ERANGE;
+
+	if (priv->compressed)
+		return ws2801_seq_load_compressed(seq, ws, frame);
+
+	/* RGB frames are handed to the driver right from the mapping */
+	src = (const void *)(priv->frames + frame * priv->stride);
+	if (priv->timestamps)
+		src = (const void *)((const uint64_t *)src + 1);
+
+	return ws2801_seq_output(seq, ws, src, 0, seq->num_leds);
+}
+
+static int ws2801_record_write_header(struct ws2801_recorder_priv *priv)
+{
+	struct ws2801_seq_header hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, WS2801_SEQ_MAGIC, sizeof(hdr.magic));
+	hdr.version = WS2801_SEQ_VERSION;
+	hdr.order = WS2801_ORDER_RGB;
+	hdr.flags = htole16(WS2801_SEQ_TIMESTAMPS);
+	hdr.num_leds = htole32(priv->ws->num_leds);
+	hdr.num_frames = htole32(priv->num_frames);
+	hdr.fps = htole32(priv->fps);
+
+	if (fwrite(&hdr, sizeof(hdr), 1, priv->file) != 1)
+		return -EIO;
+
+	return 0;
+}
+
+void ws2801_record_frame(struct ws2801_driver *ws)
+{
+	struct ws2801_recorder_priv *priv = ws->recorder->priv;
+	unsigned long long now = now_ns();
+	uint64_t ts;
+
+	pthread_mutex_lock(&priv->lock);
+	if (priv->failed)
+		goto unlock_out;
+
+	if (!priv->num_frames)
+		priv->start = now;
+
+	ts = htole64(now - priv->start);
+	memcpy(priv->record, &ts, sizeof(ts));
+	ws2801_copy_frame((struct led *)(priv->record + sizeof(ts)), ws);
+
+	/* Records after a partial one would be misaligned, so the recording
+	 * ends here */
+	if (fwrite(priv->record, priv->record_size, 1, priv->file) != 1) {
+		priv->failed = true;
+		goto unlock_out;
+	}
+
+	priv->num_frames++;
+
+unlock_out:
+	pthread_mutex_unlock(&priv->lock);
+}
+
+int ws2801_record_start(struct ws2801_recorder *rec, struct ws2801_driver *ws,
+			const char *path, unsigned int fps)
+{
+	struct ws2801_recorder_priv *priv;
+	int err = 0;
+
+	/* Reserve the driver before the file is touched, so that a running
+	 * recording is left alone. Frames are only recorded once priv is
+	 * set. */
+	pthread_mutex_lock(&ws->data_lock);
+	if (ws->recorder) {
+		err = -EBUSY;
+	} else {
+		rec->priv = NULL;
+		ws->recorder = rec;
+	}
+	pthread_mutex_unlock(&ws->data_lock);
+	if (err)
+		return err;
+
+	err = -ENOMEM;
+	priv = calloc(1, sizeof(*priv));
+	if (!priv)
+		goto release_out;
+
+	priv->ws = ws;
+	priv->fps = fps;
+	priv->record_size = sizeof(uint64_t) +
+			    ws->num_leds * sizeof(struct led);
+
+	err = -ENOMEM;
+	priv->record = malloc(priv->record_size);
+	if (!priv->record)
+		goto free_out;
+
+	err = -pthread_mutex_init(&priv->lock, NULL);
+	if (err)
+		goto free_out;
+
+	/* Existing files are never truncated */
+	priv->file = fopen(path, "wx");
+	if (!priv->file) {
+		err = -errno;
+		goto destroy_out;
+	}
+
+	/* The header is written again once the number of frames is known.
+	 * Until then, num_frames is zero. */
+	err = ws2801_record_write_header(priv);
+	if (err)
+		goto close_out;
+
+	pthread_mutex_lock(&ws->data_lock);
+	rec->priv = priv;
+	pthread_mutex_unlock(&ws->data_lock);
+
+	return 0;
+
+close_out:
+	fclose(priv->file);
+	unlink(path);
+
+destroy_out:
+	pthread_mutex_destroy(&priv->lock);
+
+free_out:
+	free(priv->record);
+	free(priv);
+
+release_out:
+	pthread_mutex_lock(&ws->data_lock);
+	ws->recorder = NULL;
+	pthread_mutex_unlock(&ws->data_lock);
+	return err;
+}
+
+int ws2801_record_stop(struct ws2801_recorder *rec)
+{
+	struct ws2801_recorder_priv *priv = rec->priv;
+	struct ws2801_driver *ws = priv->ws;
+	unsigned int complete;
+	struct stat st;
+	int err = 0;
+
+	/* Records are written under data_lock, so none is in flight after
+	 * this */
+	pthread_mutex_lock(&ws->data_lock);
+	ws->recorder = NULL;
+	pthread_mutex_unlock(&ws->data_lock);
+
+	/* Only complete records are kept, a partial one is dropped */
+	if (fflush(priv->file))
+		priv->failed = true;
+	if (fstat(fileno(priv->file), &st)) {
+		err = -errno;
+	} else if (st.st_size < sizeof(struct ws2801_seq_header)) {
+		err = -EIO;
+	} else {
+		complete = (st.st_size - sizeof(struct ws2801_seq_header)) /
+			   priv->record_size;
+		if (complete < priv->num_frames)
+			priv->num_frames = complete;
+		if (ftruncate(fileno(priv->file),
+			      sizeof(struct ws2801_seq_header) +
+			      (off_t)priv->num_frames * priv->record_size))
+			err = -errno;
+	}
+
+	if (!err && fseek(priv->file, 0, SEEK_SET))
+		err = -errno;
+
+	if (!err)
+		err = ws2801_record_write_header(priv);
+
+	if (fclose(priv->file) && !err)
+		err = -errno;
+
+	if (!err && priv->failed)
+		err = -EIO;
+
+	pthread_mutex_destroy(&priv->lock);
+	free(priv->record);
+	free(priv);
+
+	return err;
+}
@@ -0,0 +1,61 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+/* On-disk format of frame sequences. All fields are little endian.
+ *
+ *   struct ws2801_seq_header
+ *   num_frames times:
+ *     uint64_t timestamp in ns, only if WS2801_SEQ_TIMESTAMPS is set
+ *     num_leds * 3 bytes of LEDs, in the given color order
+ *
+ * Without timestamps, frames are played at a constant frame rate of fps.  If
+ * num_frames is zero, the file ends with the last complete frame.  This way,
+ * recordings stay usable even if the recorder was never stopped.
+ *
+ * If WS2801_SEQ_COMPRESSED is set, frames are stored as records of variable
+ * length instead:
+ *
+ *     uint64_t timestamp in ns, only if WS2801_SEQ_TIMESTAMPS is set
+ *     uint32_t size of the payload
+ *     uint8_t type, WS2801_SEQ_KEYFRAME or WS2801_SEQ_DELTA
+ *     payload
+ *
+ * The payload is a list of runs over the bytes of the frame, XORed with the
+ * previous frame.  Each run consists of two unsigned LEB128 numbers, the
+ * number of unchanged bytes to skip, and the number of changed bytes that
+ * follow.  Keyframes are XORed with a black frame, so they can be decoded
+ * without any previous frame.  The first frame is always a keyframe.
+ */
+
+#include <stdint.h>
+
+#define WS2801_SEQ_MAGIC "WSEQ"
+#define WS2801_SEQ_VERSION 1
+
+#define WS2801_SEQ_TIMESTAMPS (1 << 0)
+#define WS2801_SEQ_COMPRESSED (1 << 1)
+
+#define WS2801_SEQ_KEYFRAME 0
+#define WS2801_SEQ_DELTA 1
+
+#define WS2801_SEQ_RECORD_HEADER_SIZE 5
+
+struct ws2801_seq_header {
+	char magic[4];
+	uint8_t version;
+	uint8_t order;
+	uint16_t flags;
+	uint32_t num_leds;
+	uint32_t num_frames;
+	uint32_t fps;
+	uint32_t reserved[3];
+} __attribute__((packed));
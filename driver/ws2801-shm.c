@@ -0,0 +1,208 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ws2801-common.h"
+#include "ws2801-shm.h"
+
+struct ws2801_shm {
+	int sock;
+	int efd;
+	struct ws2801_shm_ring *ring;
+	size_t ring_size;
+	unsigned int seq;
+};
+
+static int ws2801_shm_request(struct ws2801_shm *ws,
+			      const struct ws2801d_request *req,
+			      struct ws2801d_reply *reply, int *fds)
+{
+	char control[CMSG_SPACE(2 * sizeof(int))];
+	struct iovec iov = {
+		.iov_base = reply,
+		.iov_len = sizeof(*reply),
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+	struct cmsghdr *cmsg;
+
+	if (send(ws->sock, req, sizeof(*req), 0) != sizeof(*req))
+		return -errno;
+
+	if (recvmsg(ws->sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(*reply))
+		return -EPROTO;
+
+	if (reply->err || !fds)
+		return reply->err;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS ||
+	    cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int)))
+		return -EPROTO;
+
+	memcpy(fds, CMSG_DATA(cmsg), 2 * sizeof(int));
+
+	return 0;
+}
+
+static void ws2801_shm_commit(struct ws2801_driver *ws_driver)
+{
+	struct ws2801_shm *ws = ws_driver->drv_data;
+	struct ws2801_shm_ring *ring = ws->ring;
+	uint64_t kick = 1;
+
+	pthread_mutex_lock(&ws_driver->data_lock);
+	ws2801_copy_frame(ws2801_shm_slot(ring, ws_driver->num_leds, ws->seq), ws_driver);
+	atomic_store(&ring->seq, ++ws->seq);
+	ws2801_record_commit(ws_driver);
+	pthread_mutex_unlock(&ws_driver->data_lock);
+
+	/* Only wake up the daemon if it is about to sleep */
+	if (atomic_exchange(&ring->waiting, 0) &&
+	    write(ws->efd, &kick, sizeof(kick)) == -1) {
+		fprintf(stderr, "ws2801: error during commit\n");
+		exit(-errno);
+	}
+
+	ws2801_commit_hook(ws_driver);
+}
+
+static int ws2801_shm_set_refresh_rate(struct ws2801_driver *ws_driver,
+				       unsigned int refresh_rate)
+{
+	struct ws2801_shm *ws = ws_driver->drv_data;
+	struct ws2801d_request req = {
+		.cmd = WS2801D_SET_REFRESH_RATE,
+		.arg = refresh_rate,
+	};
+	struct ws2801d_reply reply;
+
+	return ws2801_shm_request(ws, &req, &reply, NULL);
+}
+
+static void __ws2801_shm_free(struct ws2801_shm *ws)
+{
+	if (ws->ring)
+		munmap(ws->ring, ws->ring_size);
+	if (ws->efd != -1)
+		close(ws->efd);
+	if (ws->sock != -1)
+		close(ws->sock);
+
+	free(ws);
+}
+
+static void ws2801_shm_free(struct ws2801_driver *ws_driver)
+{
+	__ws2801_shm_free(ws_driver->drv_data);
+
+	ws2801_free(ws_driver);
+}
+
+int ws2801_shm_init(const char *socket_path, const char *strip,
+		    struct ws2801_driver *ws_driver)
+{
+	struct ws2801d_request req = {
+		.cmd = WS2801D_ATTACH,
+	};
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+	struct ws2801d_reply reply;
+	struct ws2801_shm *ws;
+	int err, fds[2];
+
+	if (!socket_path)
+		socket_path = WS2801D_SOCKET;
+
+	if (strlen(strip) >= sizeof(req.strip) ||
+	    strlen(socket_path) >= sizeof(addr.sun_path))
+		return -EINVAL;
+
+	strcpy(req.strip, strip);
+	strcpy(addr.sun_path, socket_path);
+
+	ws = calloc(1, sizeof(*ws));
+	if (!ws)
+		return -ENOMEM;
+	ws->efd = -1;
+
+	ws->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (ws->sock == -1) {
+		err = -errno;
+		goto free_out;
+	}
+
+	if (connect(ws->sock, (struct sockaddr *)&addr, sizeof(addr))) {
+		err = -errno;
+		goto free_out;
+	}
+
+	err = ws2801_shm_request(ws, &req, &reply, fds);
+	if (err)
+		goto free_out;
+
+	ws->efd = fds[1];
+	ws->ring_size = ws2801_shm_ring_size(reply.num_leds);
+	ws->ring = mmap(NULL, ws->ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fds[0], 0);
+	if (ws->ring == MAP_FAILED) {
+		ws->ring = NULL;
+		err = -errno;
+		close(fds[0]);
+		goto free_out;
+	}
+	close(fds[0]);
+	ws->seq = atomic_load(&ws->ring->seq);
+
+	err = ws2801_init(ws_driver, reply.num_leds);
+	if (err)
+		goto free_out;
+
+	ws_driver->drv_data = ws;
+
+	ws_driver->clear = ws2801_clear;
+	ws_driver->set_auto_commit = ws2801_set_auto_commit;
+	ws_driver->set_led = ws2801_set_led;
+	ws_driver->set_leds = ws2801_set_leds;
+	ws_driver->set_refresh_rate = ws2801_shm_set_refresh_rate;
+	ws_driver->refresh = ws2801_refresh;
+	ws_driver->group_commit = ws2801_no_group_commit;
+	ws_driver->commit = ws2801_shm_commit;
+	ws_driver->full_on = ws2801_full_on;
+	ws_driver->update = ws2801_update;
+	ws_driver->update_mask = ws2801_update_mask;
+	ws_driver->get_stats = ws2801_get_stats;
+	ws_driver->set_power_limit = ws2801_no_power_limit;
+	ws_driver->wait_commit = ws2801_wait_commit;
+	ws_driver->set_indexed = ws2801_set_indexed;
+	ws_driver->free = ws2801_shm_free;
+
+	return 0;
+
+free_out:
+	__ws2801_shm_free(ws);
+	return err;
+}
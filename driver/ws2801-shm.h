@@ -0,0 +1,70 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+/* Protocol between ws2801d and its clients.
+ *
+ * Clients connect to the daemon's SOCK_SEQPACKET Unix socket and attach to a
+ * strip by name.  The daemon replies with a memfd holding a frame ring and an
+ * eventfd.  Clients write frames into the ring and publish them by
+ * incrementing seq.  Only if the daemon announced that it went to sleep, the
+ * client kicks the eventfd.  As long as the daemon is busy, no syscalls are
+ * required on the client side.
+ */
+
+#include <stdatomic.h>
+
+#define WS2801D_SOCKET "/run/ws2801d.sock"
+#define WS2801D_NAME_MAX 32
+
+#define WS2801_SHM_SLOTS 4
+
+enum ws2801d_cmd {
+	WS2801D_ATTACH,
+	WS2801D_SET_REFRESH_RATE,
+};
+
+struct ws2801d_request {
+	unsigned int cmd;
+	unsigned int arg;
+	char strip[WS2801D_NAME_MAX];
+};
+
+/* On WS2801D_ATTACH, the memfd and the eventfd are passed along */
+struct ws2801d_reply {
+	int err;
+	unsigned int num_leds;
+};
+
+struct ws2801_shm_ring {
+	/* Number of published frames. The latest one is in slot
+	 * (seq - 1) % WS2801_SHM_SLOTS */
+	atomic_uint seq;
+	/* Set by the daemon before it waits on the eventfd */
+	atomic_uint waiting;
+	/* Informational only. The ring is writable by both sides, so the
+	 * slots are always located with the num_leds of the attach reply. */
+	unsigned int num_leds;
+	struct led frames[];
+};
+
+static inline size_t ws2801_shm_ring_size(unsigned int num_leds)
+{
+	return sizeof(struct ws2801_shm_ring) +
+	       WS2801_SHM_SLOTS * num_leds * sizeof(struct led);
+}
+
+static inline struct led *ws2801_shm_slot(struct ws2801_shm_ring *ring,
+					  unsigned int num_leds,
+					  unsigned int seq)
+{
+	return ring->frames + (seq % WS2801_SHM_SLOTS) * num_leds;
+}
@@ -0,0 +1,99 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+/* Portable SIMD helpers, based on GCC vector extensions. The compiler lowers
+ * them to SSE2 or NEON instructions where available, and to scalar code
+ * otherwise. */
+
+#include <string.h>
+
+typedef unsigned char v8u8 __attribute__((vector_size(8)));
+typedef unsigned short v8u16 __attribute__((vector_size(16)));
+typedef unsigned char v16u8 __attribute__((vector_size(16)));
+
+static inline v8u16 v8u16_load(const void *src)
+{
+	v8u8 v;
+
+	memcpy(&v, src, sizeof(v));
+	return __builtin_convertvector(v, v8u16);
+}
+
+static inline void v8u16_store(void *dst, v8u16 v)
+{
+	v8u8 r = __builtin_convertvector(v, v8u8);
+
+	memcpy(dst, &r, sizeof(r));
+}
+
+/* x / 255, correctly rounded for products of two 8 bit values */
+static inline v8u16 v8u16_div255(v8u16 x)
+{
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+static inline v8u16 v8u16_min(v8u16 a, v8u16 b)
+{
+	v8u16 mask = (v8u16)(a < b);
+
+	return (a & mask) | (b & ~mask);
+}
+
+static inline v8u16 v8u16_max(v8u16 a, v8u16 b)
+{
+	v8u16 mask = (v8u16)(a > b);
+
+	return (a & mask) | (b & ~mask);
+}
+
+/* Load eight packed 3-byte pixels, and split them into one vector per
+ * channel */
+static inline void v8u16_load3(const void *src, v8u16 *c0, v8u16 *c1,
+			       v8u16 *c2)
+{
+	/* lo holds bytes 0-15, hi bytes 8-23 of the pixels */
+	static const v16u8 sel0 = { 0, 3, 6, 9, 12, 15, 26, 29 };
+	static const v16u8 sel1 = { 1, 4, 7, 10, 13, 24, 27, 30 };
+	static const v16u8 sel2 = { 2, 5, 8, 11, 14, 25, 28, 31 };
+	v16u8 lo, hi, c;
+
+	memcpy(&lo, src, sizeof(lo));
+	memcpy(&hi, (const unsigned char *)src + 8, sizeof(hi));
+
+	c = __builtin_shuffle(lo, hi, sel0);
+	*c0 = v8u16_load(&c);
+	c = __builtin_shuffle(lo, hi, sel1);
+	*c1 = v8u16_load(&c);
+	c = __builtin_shuffle(lo, hi, sel2);
+	*c2 = v8u16_load(&c);
+}
+
+/* Merge one vector per channel into eight packed 3-byte pixels */
+static inline void v8u16_store3(void *dst, v8u16 c0, v8u16 c1, v8u16 c2)
+{
+	/* c01 holds c0 in bytes 0-7 and c1 in bytes 8-15, c2x holds c2 in
+	 * bytes 16-23 */
+	static const v16u8 sel_lo = { 0, 8, 16, 1, 9, 17, 2, 10,
+				      18, 3, 11, 19, 4, 12, 20, 5 };
+	static const v16u8 sel_hi = { 13, 21, 6, 14, 22, 7, 15, 23 };
+	v16u8 c01, c2x = { 0 }, lo, hi;
+
+	v8u16_store(&c01, c0);
+	v8u16_store((unsigned char *)&c01 + 8, c1);
+	v8u16_store(&c2x, c2);
+
+	lo = __builtin_shuffle(c01, c2x, sel_lo);
+	hi = __builtin_shuffle(c01, c2x, sel_hi);
+	memcpy(dst, &lo, sizeof(lo));
+	memcpy((unsigned char *)dst + 16, &hi, 8);
+}
@@ -0,0 +1,110 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+/*
+ * Tests of the common driver functions that don't need any hardware. Run by
+ * make check.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ws2801-common.h"
+
+#define TEST_NUM_LEDS 10
+
+static unsigned int failed;
+
+#define EXPECT_EQ(a, b)							\
+	do {								\
+		long long _a = (a), _b = (b);				\
+		if (_a != _b) {						\
+			fprintf(stderr, "%s:%d: %s == %lld, expected %lld\n", \
+				__FILE__, __LINE__, #a, _a, _b);	\
+			failed++;					\
+		}							\
+	} while (0)
+
+static unsigned int commits;
+
+static void test_commit(struct ws2801_driver *ws)
+{
+	commits++;
+}
+
+static void test_init(struct ws2801_driver *ws)
+{
+	if (ws2801_init(ws, TEST_NUM_LEDS)) {
+		fprintf(stderr, "ws2801_init failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	ws->set_auto_commit = ws2801_set_auto_commit;
+	ws->clear = ws2801_clear;
+	ws->commit = test_commit;
+	ws->set_led = ws2801_set_led;
+	ws->set_leds = ws2801_set_leds;
+	ws->update = ws2801_update;
+	ws->update_mask = ws2801_update_mask;
+	ws->full_on = ws2801_full_on;
+	ws->set_indexed = ws2801_set_indexed;
+}
+
+/* The RGB setters must not touch the LEDs of a driver in indexed mode */
+static void test_indexed_setters(void)
+{
+	const struct led color = { 1, 2, 3 };
+	struct led leds[TEST_NUM_LEDS] = { };
+	const struct ws2801_update update = { .num = 1, .color = color };
+	const unsigned long mask = 1;
+	struct ws2801_interp interp;
+	struct ws2801_driver ws;
+
+	test_init(&ws);
+	ws.set_auto_commit(&ws, true);
+	EXPECT_EQ(ws.set_indexed(&ws, true), 0);
+	commits = 0;
+
+	EXPECT_EQ(ws.set_led(&ws, 0, &color), -EBUSY);
+	EXPECT_EQ(ws.set_led(&ws, TEST_NUM_LEDS, &color), -ERANGE);
+	EXPECT_EQ(ws.clear(&ws), -EBUSY);
+	EXPECT_EQ(ws.set_leds(&ws, leds, 0, TEST_NUM_LEDS), -EBUSY);
+	EXPECT_EQ(ws.update(&ws, &update, 1), -EBUSY);
+	EXPECT_EQ(ws.update_mask(&ws, &mask, &color), -EBUSY);
+	EXPECT_EQ(ws.full_on(&ws, &color), -EBUSY);
+	EXPECT_EQ(ws2801_interp_init(&interp, &ws, 25), -EBUSY);
+	/* Refused changes are not auto-committed */
+	EXPECT_EQ(commits, 0);
+
+	/* Back in RGB mode, the setters work again */
+	EXPECT_EQ(ws.set_indexed(&ws, false), 0);
+	EXPECT_EQ(ws.set_led(&ws, 0, &color), 0);
+	EXPECT_EQ(ws.leds[0].b, 3);
+	EXPECT_EQ(ws.clear(&ws), 0);
+	EXPECT_EQ(ws.leds[0].b, 0);
+	EXPECT_EQ(commits, 2);
+
+	ws2801_free(&ws);
+}
+
+int main(void)
+{
+	test_indexed_setters();
+
+	if (failed) {
+		fprintf(stderr, "%u checks failed\n", failed);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -16,11 +16,15 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <linux/gpio.h>
 
@@ -29,19 +33,87 @@
 #define IDX_CLK 0
 #define IDX_DO 1
 
+#define BIT_CLK (1 << IDX_CLK)
+#define BIT_DO (1 << IDX_DO)
+
+#define WS2801_LINE_DRIVE (WS2801_LINE_OPEN_DRAIN | WS2801_LINE_OPEN_SOURCE)
+#define WS2801_LINE_BIAS (WS2801_LINE_BIAS_PULL_UP | \
+			  WS2801_LINE_BIAS_PULL_DOWN | \
+			  WS2801_LINE_BIAS_DISABLED)
+
 #define INIT_CLEAR_MAX 100
 
+/* The strip latches if the clock stays low for this long */
+#define LATCH_NS 1000000ULL
+
 struct ws2801_user {
 	pthread_cond_t cond;
 	pthread_mutex_t commit_lock;
+
+	/* Refreshes are either sent by an own thread, or by the scheduler of
+	 * the driver. refresh_lock serialises starting and stopping the
+	 * thread. */
+	pthread_mutex_t refresh_lock;
 	pthread_t refresh_task;
+	bool refresh_running;
 
 	volatile unsigned int refresh_rate;
 
+	/* Optional transmit thread. Requests are served in order of their
+	 * ticket, several pending requests are served by one transmission. */
+	pthread_mutex_t tx_lock;
+	pthread_cond_t tx_cond;
+	pthread_cond_t tx_done_cond;
+	pthread_t tx_task;
+	bool tx_running;
+	bool tx_stop;
+	unsigned long tx_requested;
+	unsigned long tx_taken;
+	unsigned long tx_done;
+	/* time of the oldest request that was not yet taken */
+	unsigned long long tx_time;
+	/* any of the requests that were not yet taken is a commit */
+	bool tx_commit;
+
+	/* protected by commit_lock */
+	unsigned long long latch_time;
+	/* when the next refresh is due */
+	unsigned long long refresh_due;
+	struct ws2801_stats stats;
+	unsigned long long tx_sum;
+	unsigned long long latency_sum;
+	unsigned long long latency_frames;
+	struct ws2801_power power;
+	/* Snapshot of the frame that is shifted out. Depending on the mode of
+	 * the driver, either frame or frame_index and frame_palette are
+	 * allocated. */
+	struct led *frame;
+	unsigned char *frame_index;
+	struct led *frame_palette;
+
+	/* optional mapping of the state file, holds the last frame */
+	struct led *state;
+	size_t state_size;
+
 	int fd;
 	int req_fd;
+	/* Lines are requested through the v2 uAPI, if available */
+	bool v2;
+	/* last level of the data line, only tracked for v2 */
+	unsigned int data_bit;
+	int gpio_clk;
+	int gpio_do;
+	unsigned int line_flags;
 };
 
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 static int msleep(pthread_cond_t *cond, pthread_mutex_t *mutex,
 		  unsigned int ms)
 {
@@ -67,7 +139,7 @@ static int msleep(pthread_cond_t *cond, pthread_mutex_t *mutex,
 	return pthread_cond_timedwait(cond, mutex, &then);
 }
 
-static inline int ws2801_byte(int req_fd, unsigned char byte)
+static inline int ws2801_byte_v1(int req_fd, unsigned char byte)
 {
 	int ret;
 	unsigned char mask;
@@ -90,125 +162,796 @@ static inline int ws2801_byte(int req_fd, unsigned char byte)
 	return 0;
 }
 
-static inline int ws2801_latch(int req_fd)
+#ifdef GPIO_V2_LINES_MAX
+/* The v2 uAPI allows to only touch lines that change: the data line is only
+ * written if the bit differs from the previous one. */
+static inline int ws2801_byte_v2(struct ws2801_user *ws, unsigned char byte)
+{
+	struct gpio_v2_line_values clk_high = {
+		.bits = BIT_CLK,
+		.mask = BIT_CLK,
+	};
+	struct gpio_v2_line_values clk_low;
+	unsigned char mask;
+	unsigned int bit;
+	int ret;
+
+	for (mask = 0x80; mask; mask >>= 1) {
+		bit = (byte & mask) ? BIT_DO : 0;
+		clk_low.bits = bit;
+		clk_low.mask = BIT_CLK;
+		if (bit != ws->data_bit)
+			clk_low.mask |= BIT_DO;
+		ws->data_bit = bit;
+
+		ret = ioctl(ws->req_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &clk_low);
+		if (ret == -1)
+			return ret;
+
+		ret = ioctl(ws->req_fd, GPIO_V2_LINE_SET_VALUES_IOCTL,
+			    &clk_high);
+		if (ret == -1)
+			return ret;
+	}
+
+	return 0;
+}
+#endif
+
+static inline int ws2801_byte(struct ws2801_user *ws, unsigned char byte)
+{
+#ifdef GPIO_V2_LINES_MAX
+	if (ws->v2)
+		return ws2801_byte_v2(ws, byte);
+#endif
+	return ws2801_byte_v1(ws->req_fd, byte);
+}
+
+static inline int ws2801_latch(struct ws2801_user *ws)
 {
 	struct gpiohandle_data data;
+	int err;
+
+#ifdef GPIO_V2_LINES_MAX
+	struct gpio_v2_line_values values = {
+		.bits = 0,
+		.mask = BIT_CLK,
+	};
+
+	if (ws->v2)
+		err = ioctl(ws->req_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values);
+	else
+#endif
+	{
+		data.values[IDX_CLK] = 0;
+		data.values[IDX_DO] = 0;
+		err = ioctl(ws->req_fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL,
+			    &data);
+	}
+	ws->latch_time = now_ns();
 
-	data.values[IDX_CLK] = 0;
-	return ioctl(req_fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data);
+	return err;
 }
 
-static void ws2801_user_commit(struct ws2801_driver *ws_driver)
+/* Wait until the strip latched the previous frame. Instead of sleeping after
+ * every frame, this is done right before the next one. */
+static void ws2801_wait_latch(struct ws2801_user *ws)
+{
+	unsigned long long until = ws->latch_time + LATCH_NS;
+	struct timespec ts;
+
+	if (now_ns() >= until)
+		return;
+
+	ts.tv_sec = until / 1000000000ULL;
+	ts.tv_nsec = until % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR);
+}
+
+/* Must be called with commit_lock held */
+static void ws2801_user_account(struct ws2801_user *ws,
+				unsigned long long start, unsigned long long end,
+				unsigned long long requested)
+{
+	struct ws2801_stats *stats = &ws->stats;
+	unsigned long long tx = end - start;
+	long long d;
+
+	if (stats->frames) {
+		d = tx - stats->tx_last;
+		if (d < 0)
+			d = -d;
+		stats->tx_jitter += (d - (long long)stats->tx_jitter) / 16;
+	}
+
+	if (!stats->frames || tx < stats->tx_min)
+		stats->tx_min = tx;
+	if (tx > stats->tx_max)
+		stats->tx_max = tx;
+	stats->tx_last = tx;
+	ws->tx_sum += tx;
+	stats->frames++;
+
+	if (requested) {
+		if (start - requested > stats->latency_max)
+			stats->latency_max = start - requested;
+		ws->latency_sum += start - requested;
+		ws->latency_frames++;
+	}
+}
+
+/* Takes the snapshot of the frame that is shifted out next. The state file
+ * and the recording get the very same frame. Commits are recorded,
+ * refreshes are not. Must be called with commit_lock held. */
+static void ws2801_user_snapshot(struct ws2801_driver *ws_driver, bool commit)
 {
 	struct ws2801_user *ws = ws_driver->drv_data;
-	unsigned int i;
+
+	pthread_mutex_lock(&ws_driver->data_lock);
+	if (ws_driver->index) {
+		memcpy(ws->frame_index, ws_driver->index, ws_driver->num_leds);
+		memcpy(ws->frame_palette, ws_driver->palette,
+		       WS2801_PALETTE_SIZE * sizeof(*ws->frame_palette));
+	} else {
+		memcpy(ws->frame, ws_driver->leds,
+		       ws_driver->num_leds * sizeof(*ws->frame));
+	}
+
+	if (ws->state)
+		ws2801_copy_frame(ws->state, ws_driver);
+
+	if (commit)
+		ws2801_record_commit(ws_driver);
+	pthread_mutex_unlock(&ws_driver->data_lock);
+}
+
+/* Shifts out a snapshot of the frame, but doesn't latch it yet: the clock
+ * stays high. Returns the start of the transmission. Must be called with
+ * commit_lock held. */
+static unsigned long long ws2801_user_shift(struct ws2801_driver *ws_driver,
+					    bool commit)
+{
+	struct ws2801_user *ws = ws_driver->drv_data;
+	unsigned long long start;
+	unsigned int i, scale;
+	const struct led *led;
 	int err;
 
-	pthread_mutex_lock(&ws->commit_lock);
+	ws2801_user_snapshot(ws_driver, commit);
+
+	/* Dimming is applied on the fly, the LEDs stay untouched */
+	if (ws->frame_index)
+		scale = ws2801_power_update_indexed(&ws->power,
+						    ws->frame_index,
+						    ws->frame_palette,
+						    ws_driver->num_leds);
+	else
+		scale = ws2801_power_update(&ws->power, ws->frame,
+					    ws_driver->num_leds);
+
+	ws2801_wait_latch(ws);
+	start = now_ns();
 
 #define SEND_LED(__color) \
-	err = ws2801_byte(ws->req_fd, ws_driver->leds[i].__color); \
+	err = ws2801_byte(ws, (led->__color * scale) >> 8); \
 	if (err < 0) { \
 		fprintf(stderr, "ws2801: error during commit\n"); \
 		exit(err); \
 	}
 
 	for (i = 0; i < ws_driver->num_leds; i++) {
+		/* Indexed frames are expanded on the fly as well */
+		if (ws->frame_index)
+			led = &ws->frame_palette[ws->frame_index[i]];
+		else
+			led = &ws->frame[i];
+
 		SEND_LED(r);
 		SEND_LED(g);
 		SEND_LED(b);
 	}
 #undef SEND_LED
 
-	err = ws2801_latch(ws->req_fd);
+	return start;
+}
+
+/* Latches a frame that was shifted out. Must be called with commit_lock
+ * held. */
+static void ws2801_user_finish(struct ws2801_driver *ws_driver,
+			       unsigned long long start,
+			       unsigned long long requested)
+{
+	struct ws2801_user *ws = ws_driver->drv_data;
+	int err;
+
+	err = ws2801_latch(ws);
 	if (err) {
 		fprintf(stderr, "ws2801: error during commit\n");
 		exit(err);
 	}
 
-	usleep(1000);
+	ws2801_user_account(ws, start, ws->latch_time, requested);
+}
 
+static void ws2801_user_send(struct ws2801_driver *ws_driver,
+			     unsigned long long requested, bool commit)
+{
+	struct ws2801_user *ws = ws_driver->drv_data;
+	unsigned long long start;
+
+	pthread_mutex_lock(&ws->commit_lock);
+	start = ws2801_user_shift(ws_driver, commit);
+	ws2801_user_finish(ws_driver, start, requested);
 	pthread_mutex_unlock(&ws->commit_lock);
 }
 
+static void *ws2801_tx_task(void *data)
+{
+	struct ws2801_driver *ws_driver = data;
+	struct ws2801_user *ws = ws_driver->drv_data;
+	unsigned long long requested;
+	unsigned long ticket;
+	bool commit;
+
+	pthread_mutex_lock(&ws->tx_lock);
+	/* Pending requests are still served when the thread is stopped */
+	while (!ws->tx_stop || ws->tx_done != ws->tx_requested) {
+		if (ws->tx_done == ws->tx_requested) {
+			pthread_cond_wait(&ws->tx_cond, &ws->tx_lock);
+			continue;
+		}
+
+		ticket = ws->tx_requested;
+		ws->tx_taken = ticket;
+		requested = ws->tx_time;
+		commit = ws->tx_commit;
+		ws->tx_commit = false;
+		pthread_mutex_unlock(&ws->tx_lock);
+
+		ws2801_user_send(ws_driver, requested, commit);
+
+		pthread_mutex_lock(&ws->tx_lock);
+		ws->tx_done = ticket;
+		pthread_cond_broadcast(&ws->tx_done_cond);
+	}
+	ws->tx_running = false;
+	pthread_mutex_unlock(&ws->tx_lock);
+
+	return NULL;
+}
+
+static void ws2801_user_transmit(struct ws2801_driver *ws_driver,
+				 bool commit)
+{
+	struct ws2801_user *ws = ws_driver->drv_data;
+	unsigned long ticket;
+
+	pthread_mutex_lock(&ws->tx_lock);
+	if (!ws->tx_running) {
+		pthread_mutex_unlock(&ws->tx_lock);
+		ws2801_user_send(ws_driver, 0, commit);
+		return;
+	}
+
+	if (ws->tx_taken == ws->tx_requested)
+		ws->tx_time = now_ns();
+	if (commit)
+		ws->tx_commit = true;
+	ticket = ++ws->tx_requested;
+	pthread_cond_signal(&ws->tx_cond);
+
+	while (ws->tx_done < ticket)
+		pthread_cond_wait(&ws->tx_done_cond, &ws->tx_lock);
+	pthread_mutex_unlock(&ws->tx_lock);
+}
+
+static int ws2801_user_stop_tx(struct ws2801_user *ws)
+{
+	pthread_mutex_lock(&ws->tx_lock);
+	if (!ws->tx_running) {
+		pthread_mutex_unlock(&ws->tx_lock);
+		return 0;
+	}
+	ws->tx_stop = true;
+	pthread_cond_signal(&ws->tx_cond);
+	pthread_mutex_unlock(&ws->tx_lock);
+
+	return pthread_join(ws->tx_task, NULL);
+}
+
+int ws2801_user_set_rt(struct ws2801_driver *ws_driver,
+		       const struct ws2801_rt *rt)
+{
+	struct ws2801_user *ws = ws_driver->drv_data;
+	struct sched_param param;
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	int err;
+
+	err = ws2801_user_stop_tx(ws);
+	if (err || !rt)
+		return -err;
+
+	if (rt->lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE))
+		return -errno;
+
+	err = pthread_attr_init(&attr);
+	if (err)
+		return -err;
+
+	if (rt->priority) {
+		param.sched_priority = rt->priority;
+		err = pthread_attr_setinheritsched(&attr,
+						   PTHREAD_EXPLICIT_SCHED);
+		if (!err)
+			err = pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		if (!err)
+			err = pthread_attr_setschedparam(&attr, &param);
+		if (err)
+			goto attr_out;
+	}
+
+	if (rt->cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(rt->cpu, &cpus);
+		err = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+		if (err)
+			goto attr_out;
+	}
+
+	ws->tx_stop = false;
+	ws->tx_running = true;
+	err = pthread_create(&ws->tx_task, &attr, ws2801_tx_task, ws_driver);
+	if (err)
+		ws->tx_running = false;
+
+attr_out:
+	pthread_attr_destroy(&attr);
+	return -err;
+}
+
+struct ws2801_user_group;
+
+struct ws2801_user_shifter {
+	struct ws2801_user_group *group;
+	struct ws2801_driver *ws;
+	pthread_t thread;
+	unsigned long long start;
+};
+
+/* Every member but the first one has an own shifter thread for the lifetime
+ * of the group, the first one is shifted out by the caller. Threads are
+ * woken for every group commit by barriers. */
+struct ws2801_user_group {
+	/* Held while the threads are created */
+	pthread_mutex_t lock;
+	pthread_barrier_t start;
+	pthread_barrier_t done;
+	bool stop;
+	unsigned int num_threads;
+	struct ws2801_user_shifter shifters[];
+};
+
+static void *ws2801_user_shift_task(void *data)
+{
+	struct ws2801_user_shifter *shifter = data;
+	struct ws2801_user_group *ug = shifter->group;
+	bool stop;
+
+	/* The barriers only exist if all threads were created */
+	pthread_mutex_lock(&ug->lock);
+	stop = ug->stop;
+	pthread_mutex_unlock(&ug->lock);
+	if (stop)
+		return NULL;
+
+	for (;;) {
+		pthread_barrier_wait(&ug->start);
+		if (ug->stop)
+			break;
+
+		shifter->start = ws2801_user_shift(shifter->ws, true);
+		pthread_barrier_wait(&ug->done);
+	}
+
+	return NULL;
+}
+
+static void ws2801_user_group_join(struct ws2801_user_group *ug)
+{
+	unsigned int i;
+
+	for (i = 1; i <= ug->num_threads; i++)
+		pthread_join(ug->shifters[i].thread, NULL);
+}
+
+static int ws2801_user_group_init(struct ws2801_group *group)
+{
+	struct ws2801_user_group *ug;
+	unsigned int i;
+	int err = 0;
+
+	ug = calloc(1, sizeof(*ug) +
+		    group->num_members * sizeof(*ug->shifters));
+	if (!ug)
+		return -ENOMEM;
+
+	for (i = 0; i < group->num_members; i++) {
+		ug->shifters[i].group = ug;
+		ug->shifters[i].ws = group->members[i];
+	}
+
+	err = pthread_mutex_init(&ug->lock, NULL);
+	if (err)
+		goto free_out;
+
+	pthread_mutex_lock(&ug->lock);
+	for (i = 1; i < group->num_members && !err; i++) {
+		err = pthread_create(&ug->shifters[i].thread, NULL,
+				     ws2801_user_shift_task, &ug->shifters[i]);
+		if (!err)
+			ug->num_threads++;
+	}
+
+	if (!err)
+		err = pthread_barrier_init(&ug->start, NULL,
+					   group->num_members);
+	if (!err) {
+		err = pthread_barrier_init(&ug->done, NULL,
+					   group->num_members);
+		if (err)
+			pthread_barrier_destroy(&ug->start);
+	}
+
+	/* On errors, the threads that were created exit right away */
+	ug->stop = !!err;
+	pthread_mutex_unlock(&ug->lock);
+	if (err)
+		goto join_out;
+
+	group->priv = ug;
+
+	return 0;
+
+join_out:
+	ws2801_user_group_join(ug);
+	pthread_mutex_destroy(&ug->lock);
+
+free_out:
+	free(ug);
+	return -err;
+}
+
+static void ws2801_user_group_free(struct ws2801_group *group)
+{
+	struct ws2801_user_group *ug = group->priv;
+
+	ug->stop = true;
+	pthread_barrier_wait(&ug->start);
+	ws2801_user_group_join(ug);
+
+	pthread_barrier_destroy(&ug->done);
+	pthread_barrier_destroy(&ug->start);
+	pthread_mutex_destroy(&ug->lock);
+	free(ug);
+}
+
+/* All members are shifted out in parallel, while their clocks stay high.
+ * Then, the clocks are pulled low back to back, so that all strips latch at
+ * the same time. Transmit threads of members are bypassed. */
+static int ws2801_user_group_commit(struct ws2801_group *group)
+{
+	struct ws2801_user_group *ug = group->priv;
+	unsigned long long first, last;
+	struct ws2801_user *ws;
+	unsigned int i;
+
+	/* Members are sorted, so concurrent groups lock in the same order */
+	for (i = 0; i < group->num_members; i++) {
+		ws = group->members[i]->drv_data;
+		pthread_mutex_lock(&ws->commit_lock);
+	}
+
+	pthread_barrier_wait(&ug->start);
+	ug->shifters[0].start = ws2801_user_shift(group->members[0], true);
+	pthread_barrier_wait(&ug->done);
+
+	for (i = 0; i < group->num_members; i++)
+		ws2801_user_finish(group->members[i], ug->shifters[i].start, 0);
+
+	first = ((struct ws2801_user *)group->members[0]->drv_data)->latch_time;
+	last = first;
+	for (i = 0; i < group->num_members; i++) {
+		ws = group->members[i]->drv_data;
+		if (ws->latch_time < first)
+			first = ws->latch_time;
+		if (ws->latch_time > last)
+			last = ws->latch_time;
+		pthread_mutex_unlock(&ws->commit_lock);
+	}
+
+	group->skew_last = last - first;
+	if (group->skew_last > group->skew_max)
+		group->skew_max = group->skew_last;
+
+	for (i = 0; i < group->num_members; i++)
+		ws2801_commit_hook(group->members[i]);
+
+	return 0;
+}
+
+static int ws2801_user_get_stats(struct ws2801_driver *ws_driver,
+				 struct ws2801_stats *stats)
+{
+	struct ws2801_user *ws = ws_driver->drv_data;
+
+	pthread_mutex_lock(&ws->commit_lock);
+	*stats = ws->stats;
+	if (stats->frames)
+		stats->tx_avg = ws->tx_sum / stats->frames;
+	if (ws->latency_frames)
+		stats->latency_avg = ws->latency_sum / ws->latency_frames;
+	ws2801_power_stats(&ws->power, stats);
+	pthread_mutex_unlock(&ws->commit_lock);
+
+	return 0;
+}
+
+static int ws2801_user_set_power_limit(struct ws2801_driver *ws_driver,
+				       const struct ws2801_power_limit *limit)
+{
+	struct ws2801_user *ws = ws_driver->drv_data;
+	int err;
+
+	pthread_mutex_lock(&ws->commit_lock);
+	err = ws2801_power_set_limit(&ws->power, limit);
+	pthread_mutex_unlock(&ws->commit_lock);
+
+	return err;
+}
+
+/* The snapshot of the frame follows the mode of the driver. Its buffers are
+ * only swapped between transmissions. */
+static int ws2801_user_set_indexed(struct ws2801_driver *ws_driver,
+				   bool indexed)
+{
+	struct ws2801_user *ws = ws_driver->drv_data;
+	struct led *frame = NULL, *palette = NULL, *old_frame, *old_palette;
+	unsigned char *index = NULL, *old_index;
+	int err = -ENOMEM;
+
+	if (indexed) {
+		index = malloc(ws_driver->num_leds);
+		palette = malloc(WS2801_PALETTE_SIZE * sizeof(*palette));
+		if (!index || !palette)
+			goto free_out;
+	} else {
+		frame = malloc(ws_driver->num_leds * sizeof(*frame));
+		if (!frame)
+			goto free_out;
+	}
+
+	pthread_mutex_lock(&ws->commit_lock);
+	err = ws2801_set_indexed(ws_driver, indexed);
+	/* Switching to the current mode succeeds without a change */
+	if (!err && indexed != !!ws->frame_index) {
+		old_frame = ws->frame;
+		old_index = ws->frame_index;
+		old_palette = ws->frame_palette;
+		ws->frame = frame;
+		ws->frame_index = index;
+		ws->frame_palette = palette;
+		frame = old_frame;
+		index = old_index;
+		palette = old_palette;
+	}
+	pthread_mutex_unlock(&ws->commit_lock);
+
+free_out:
+	free(palette);
+	free(index);
+	free(frame);
+	return err;
+}
+
+static void ws2801_user_commit(struct ws2801_driver *ws_driver)
+{
+	ws2801_user_transmit(ws_driver, true);
+	ws2801_commit_hook(ws_driver);
+}
+
+/* Refreshes are only sent if the strip was idle for a full refresh period.
+ * Any commit in the meantime postpones the refresh.
+ *
+ * Returns the time in ms until the next refresh is due, or 0 if refreshes
+ * are disabled. */
+static unsigned int ws2801_user_refresh_once(struct ws2801_driver *ws_driver)
+{
+	struct ws2801_user *ws = ws_driver->drv_data;
+	unsigned long long now, idle, period, due;
+	bool refresh;
+
+	period = ws->refresh_rate * 1000000ULL;
+	if (!period)
+		return 0;
+
+	now = now_ns();
+	pthread_mutex_lock(&ws->commit_lock);
+	idle = now - ws->latch_time;
+	refresh = idle >= period;
+	/* Early calls, e.g. after a changed refresh rate, are no skips */
+	if (!refresh && now >= ws->refresh_due)
+		ws->stats.refreshes_skipped++;
+	pthread_mutex_unlock(&ws->commit_lock);
+
+	if (refresh) {
+		ws2801_user_transmit(ws_driver, false);
+
+		pthread_mutex_lock(&ws->commit_lock);
+		ws->stats.refreshes++;
+		pthread_mutex_unlock(&ws->commit_lock);
+	}
+
+	pthread_mutex_lock(&ws->commit_lock);
+	due = ws->latch_time + period;
+	ws->refresh_due = due;
+	pthread_mutex_unlock(&ws->commit_lock);
+
+	now = now_ns();
+	if (due <= now)
+		return 1;
+	return (due - now + 999999) / 1000000;
+}
+
 static void *ws2801_refresh_task(void *data)
 {
 	struct ws2801_driver *ws_driver = data;
 	struct ws2801_user *ws = ws_driver->drv_data;
+	unsigned int delay;
 	int err;
 
+	delay = ws->refresh_rate;
+	pthread_mutex_lock(&ws_driver->data_lock);
 	while (1) {
-		pthread_mutex_lock(&ws_driver->data_lock);
-
-		err = msleep(&ws->cond, &ws_driver->data_lock, ws->refresh_rate);
-		if (err && err != ETIMEDOUT) {
-			goto unlock_out;
-		}
+		err = msleep(&ws->cond, &ws_driver->data_lock, delay);
+		if (err && err != ETIMEDOUT)
+			break;
 
-		if (!ws->refresh_rate) {
+		/* Refreshes were disabled or handed over to a scheduler */
+		if (!ws->refresh_rate || ws_driver->sched) {
 			err = 0;
-			goto unlock_out;
+			break;
 		}
 
 		pthread_mutex_unlock(&ws_driver->data_lock);
-		ws2801_user_commit(ws_driver);
+		delay = ws2801_user_refresh_once(ws_driver);
+		pthread_mutex_lock(&ws_driver->data_lock);
 	}
-
-unlock_out:
 	pthread_mutex_unlock(&ws_driver->data_lock);
+
 	return (void*)(long)err;
 }
 
-static int ws2801_user_set_refresh_rate(struct ws2801_driver *ws_driver,
-					unsigned int refresh_rate)
+static struct ws2801_sched *ws2801_user_sched(struct ws2801_driver *ws_driver)
 {
-	struct ws2801_user *ws = ws_driver->drv_data;
-	unsigned int old = ws->refresh_rate;
-	int err;
+	struct ws2801_sched *sched;
 
-	if (old == refresh_rate)
-		return 0;
+	pthread_mutex_lock(&ws_driver->data_lock);
+	sched = ws_driver->sched;
+	pthread_mutex_unlock(&ws_driver->data_lock);
 
-	ws->refresh_rate = refresh_rate;
+	return sched;
+}
+
+/* Starts, stops or notifies the refresh thread, depending on the refresh
+ * rate and whether a scheduler took over */
+static int ws2801_user_update_refresh_task(struct ws2801_driver *ws_driver)
+{
+	struct ws2801_user *ws = ws_driver->drv_data;
+	bool want;
+	int err = 0;
 
-	if (!old && refresh_rate) {
+	want = ws->refresh_rate && !ws2801_user_sched(ws_driver);
+
+	pthread_mutex_lock(&ws->refresh_lock);
+	if (want && !ws->refresh_running) {
 		/* start auto update task */
 		err = pthread_create(&ws->refresh_task, NULL,
 				     ws2801_refresh_task, ws_driver);
-		if (err)
-			return err;
-	} else if (old && !refresh_rate) {
+		if (!err)
+			ws->refresh_running = true;
+	} else if (!want && ws->refresh_running) {
 		/* stop thread */
 		err = pthread_cond_signal(&ws->cond);
-		if (err)
-			return err;
-		err = pthread_join(ws->refresh_task, NULL);
-		if (err)
-			return err;
-	} else {
+		if (!err)
+			err = pthread_join(ws->refresh_task, NULL);
+		if (!err)
+			ws->refresh_running = false;
+	} else if (ws->refresh_running) {
 		/* notify thread */
 		err = pthread_cond_signal(&ws->cond);
-		if (err)
-			return err;
 	}
+	pthread_mutex_unlock(&ws->refresh_lock);
 
-	return 0;
+	return err;
+}
+
+static int ws2801_user_set_refresh_rate(struct ws2801_driver *ws_driver,
+					unsigned int refresh_rate)
+{
+	struct ws2801_user *ws = ws_driver->drv_data;
+	struct ws2801_sched *sched;
+
+	if (ws->refresh_rate == refresh_rate)
+		return 0;
+
+	pthread_mutex_lock(&ws->commit_lock);
+	ws->refresh_due = now_ns() + refresh_rate * 1000000ULL;
+	pthread_mutex_unlock(&ws->commit_lock);
+	ws->refresh_rate = refresh_rate;
+
+	sched = ws2801_user_sched(ws_driver);
+	if (sched)
+		return ws2801_sched_wake(sched, ws_driver);
+
+	return ws2801_user_update_refresh_task(ws_driver);
+}
+
+/* Called by the scheduler. Hands the refreshes over from the own thread to
+ * the scheduler, or back, if the driver was removed from it. */
+static int ws2801_user_refresh(struct ws2801_driver *ws_driver)
+{
+	int err;
+
+	err = ws2801_user_update_refresh_task(ws_driver);
+	if (err)
+		return -err;
+
+	if (!ws2801_user_sched(ws_driver))
+		return 0;
+
+	return ws2801_user_refresh_once(ws_driver);
 }
 
 static void ws2801_user_free(struct ws2801_driver *ws_driver)
 {
 	struct ws2801_user *ws = ws_driver->drv_data;
+	struct ws2801_sched *sched;
 	int err;
 
 	err = ws2801_user_set_refresh_rate(ws_driver, 0);
+	sched = ws2801_user_sched(ws_driver);
+	if (!err && sched)
+		ws2801_sched_remove(sched, ws_driver);
 	if (err) {
 		fprintf(stderr, "fatal: stopping auto update thread\n");
 		exit(-err);
 	}
 
+	err = ws2801_user_stop_tx(ws);
+	if (err) {
+		fprintf(stderr, "fatal: stopping transmit thread\n");
+		exit(-err);
+	}
+
+	pthread_cond_destroy(&ws->tx_done_cond);
+	pthread_cond_destroy(&ws->tx_cond);
+	pthread_mutex_destroy(&ws->tx_lock);
+	pthread_mutex_destroy(&ws->refresh_lock);
 	pthread_mutex_destroy(&ws->commit_lock);
 	pthread_cond_destroy(&ws->cond);
 
+	if (ws->state)
+		munmap(ws->state, ws->state_size);
+
+	free(ws->frame_palette);
+	free(ws->frame_index);
+	free(ws->frame);
+
+	if (ws->req_fd != -1)
+		close(ws->req_fd);
+
 	if (ws->fd != -1)
 		close(ws->fd);
 
@@ -217,13 +960,171 @@ static void ws2801_user_free(struct ws2801_driver *ws_driver)
 	ws2801_free(ws_driver);
 }
 
-int ws2801_user_init(unsigned int num_leds, unsigned int gpiochip, int gpio_clk,
-		     int gpio_do, struct ws2801_driver *ws_driver)
+static int ws2801_user_request_v1(struct ws2801_user *ws, unsigned int flags)
+{
+	struct gpiohandle_request req;
+
+	/* Both lines start low, so the strip does not see a clock edge */
+	memset(&req, 0, sizeof(req));
+	strcpy(req.consumer_label, "ws2801");
+	req.lineoffsets[IDX_CLK] = ws->gpio_clk;
+	req.lineoffsets[IDX_DO] = ws->gpio_do;
+	req.lines = 2;
+	req.flags = GPIOHANDLE_REQUEST_OUTPUT;
+
+	if (flags & WS2801_LINE_OPEN_DRAIN)
+		req.flags |= GPIOHANDLE_REQUEST_OPEN_DRAIN;
+	if (flags & WS2801_LINE_OPEN_SOURCE)
+		req.flags |= GPIOHANDLE_REQUEST_OPEN_SOURCE;
+	if (flags & WS2801_LINE_BIAS_PULL_UP)
+		req.flags |= GPIOHANDLE_REQUEST_BIAS_PULL_UP;
+	if (flags & WS2801_LINE_BIAS_PULL_DOWN)
+		req.flags |= GPIOHANDLE_REQUEST_BIAS_PULL_DOWN;
+	if (flags & WS2801_LINE_BIAS_DISABLED)
+		req.flags |= GPIOHANDLE_REQUEST_BIAS_DISABLE;
+
+	if (ioctl(ws->fd, GPIO_GET_LINEHANDLE_IOCTL, &req) == -1)
+		return -errno;
+
+	ws->req_fd = req.fd;
+	ws->v2 = false;
+
+	return 0;
+}
+
+#ifdef GPIO_V2_LINES_MAX
+static int ws2801_user_request_v2(struct ws2801_user *ws, unsigned int flags)
+{
+	struct gpio_v2_line_request req;
+
+	/* Without an output value attribute, both lines start low */
+	memset(&req, 0, sizeof(req));
+	strcpy(req.consumer, "ws2801");
+	req.offsets[IDX_CLK] = ws->gpio_clk;
+	req.offsets[IDX_DO] = ws->gpio_do;
+	req.num_lines = 2;
+	req.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+
+	if (flags & WS2801_LINE_OPEN_DRAIN)
+		req.config.flags |= GPIO_V2_LINE_FLAG_OPEN_DRAIN;
+	if (flags & WS2801_LINE_OPEN_SOURCE)
+		req.config.flags |= GPIO_V2_LINE_FLAG_OPEN_SOURCE;
+	if (flags & WS2801_LINE_BIAS_PULL_UP)
+		req.config.flags |= GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+	if (flags & WS2801_LINE_BIAS_PULL_DOWN)
+		req.config.flags |= GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN;
+	if (flags & WS2801_LINE_BIAS_DISABLED)
+		req.config.flags |= GPIO_V2_LINE_FLAG_BIAS_DISABLED;
+
+	if (ioctl(ws->fd, GPIO_V2_GET_LINE_IOCTL, &req) == -1)
+		return -errno;
+
+	ws->req_fd = req.fd;
+	ws->v2 = true;
+	ws->data_bit = 0;
+
+	return 0;
+}
+#endif
+
+/* Requests both lines, preferably through the v2 uAPI */
+static int ws2801_user_request_lines(struct ws2801_user *ws,
+				     unsigned int flags)
+{
+	int err;
+
+	if ((flags & WS2801_LINE_DRIVE) == WS2801_LINE_DRIVE ||
+	    __builtin_popcount(flags & WS2801_LINE_BIAS) > 1)
+		return -EINVAL;
+
+	if (ws->req_fd != -1) {
+		close(ws->req_fd);
+		ws->req_fd = -1;
+	}
+
+#ifdef GPIO_V2_LINES_MAX
+	if (!(flags & WS2801_LINE_UAPI_V1)) {
+		err = ws2801_user_request_v2(ws, flags);
+		/* Kernels before 5.10 don't know the v2 uAPI */
+		if (err != -ENOTTY && err != -EINVAL)
+			return err;
+	}
+#endif
+	err = ws2801_user_request_v1(ws, flags);
+
+	return err;
+}
+
+int ws2801_user_set_line_flags(struct ws2801_driver *ws_driver,
+			       unsigned int flags)
+{
+	struct ws2801_user *ws = ws_driver->drv_data;
+	int err;
+
+	pthread_mutex_lock(&ws->commit_lock);
+	err = ws2801_user_request_lines(ws, flags);
+	/* Don't leave the driver without lines */
+	if (err)
+		ws2801_user_request_lines(ws, ws->line_flags);
+	else
+		ws->line_flags = flags;
+	pthread_mutex_unlock(&ws->commit_lock);
+
+	return err;
+}
+
+/* Maps the state file, and loads the frame it holds into the LEDs. Returns 1
+ * if there was a frame to restore. */
+static int ws2801_user_open_state(struct ws2801_driver *ws_driver,
+				  const char *path)
+{
+	struct ws2801_user *ws = ws_driver->drv_data;
+	size_t size = ws_driver->num_leds * sizeof(struct led);
+	struct stat st;
+	bool valid;
+	int fd, err;
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return -errno;
+
+	if (fstat(fd, &st)) {
+		err = -errno;
+		goto close_out;
+	}
+
+	/* A state file of a different strip length is useless */
+	valid = st.st_size == size;
+	if (!valid && ftruncate(fd, size)) {
+		err = -errno;
+		goto close_out;
+	}
+
+	ws->state = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ws->state == MAP_FAILED) {
+		ws->state = NULL;
+		err = -errno;
+		goto close_out;
+	}
+	ws->state_size = size;
+
+	if (valid)
+		memcpy(ws_driver->leds, ws->state, size);
+	err = valid;
+
+close_out:
+	close(fd);
+	return err;
+}
+
+static int ws2801_user_open(unsigned int num_leds, unsigned int gpiochip,
+			    int gpio_clk, int gpio_do, const char *state_path,
+			    struct ws2801_driver *ws_driver)
 {
 	struct ws2801_user *ws;
 	char *chrdev_name;
+	bool restored = false;
 	int i, ret;
-	struct gpiohandle_request req;
 
 	if (!ws_driver || (gpio_clk == gpio_do))
 		return -EINVAL;
@@ -244,38 +1145,70 @@ int ws2801_user_init(unsigned int num_leds, unsigned int gpiochip, int gpio_clk,
 		goto chrdev_name_out;
 	}
 	ws->fd = -1;
+	ws->req_fd = -1;
+	ws2801_power_init(&ws->power);
 	ws_driver->drv_data = ws;
 
+	ws->frame = calloc(num_leds, sizeof(*ws->frame));
+	if (!ws->frame) {
+		ret = -ENOMEM;
+		goto free_ws_out;
+	}
+
 	ret = pthread_mutex_init(&ws->commit_lock, NULL);
 	if (ret)
-		goto free_ws_out;
+		goto free_frame_out;
 
-	ret = pthread_cond_init(&ws->cond, NULL);
+	ret = pthread_mutex_init(&ws->refresh_lock, NULL);
 	if (ret)
 		goto free_commit_lock_out;
 
+	ret = pthread_cond_init(&ws->cond, NULL);
+	if (ret)
+		goto free_refresh_lock_out;
+
+	ret = pthread_mutex_init(&ws->tx_lock, NULL);
+	if (ret)
+		goto free_cond_out;
+
+	ret = pthread_cond_init(&ws->tx_cond, NULL);
+	if (ret)
+		goto free_tx_lock_out;
+
+	ret = pthread_cond_init(&ws->tx_done_cond, NULL);
+	if (ret)
+		goto free_tx_cond_out;
+
 	ws->fd = open(chrdev_name, 0);
 	if (ws->fd == -1) {
 		ret = -errno;
 		goto free_out;
 	}
 
-	strcpy(req.consumer_label, "ws2801");
-	req.lineoffsets[IDX_CLK] = gpio_clk;
-	req.lineoffsets[IDX_DO] = gpio_do;
-	req.lines = 2;
-	req.flags = GPIOHANDLE_REQUEST_OUTPUT;
-
-	ret = ioctl(ws->fd, GPIO_GET_LINEHANDLE_IOCTL, &req);
-	if (ret == -1) {
-		ret = -errno;
+	ws->gpio_clk = gpio_clk;
+	ws->gpio_do = gpio_do;
+	ret = ws2801_user_request_lines(ws, 0);
+	if (ret)
 		goto free_out;
+
+	if (state_path) {
+		ret = ws2801_user_open_state(ws_driver, state_path);
+		if (ret < 0)
+			goto free_out;
+		restored = ret;
 	}
 
-	ws->req_fd = req.fd;
+	if (restored) {
+		/* The strip most likely still shows this frame */
+		ws2801_user_send(ws_driver, 0, false);
+	} else {
+		for (i = 0; i < INIT_CLEAR_MAX; i++) {
+			ret = ws2801_byte(ws, 0);
+			if (ret)
+				goto free_out;
+		}
 
-	for (i = 0; i < INIT_CLEAR_MAX; i++) {
-		ret = ws2801_byte(ws->req_fd, 0);
+		ret = ws2801_latch(ws);
 		if (ret)
 			goto free_out;
 	}
@@ -285,9 +1218,19 @@ int ws2801_user_init(unsigned int num_leds, unsigned int gpiochip, int gpio_clk,
 	ws_driver->set_led = ws2801_set_led;
 	ws_driver->set_leds = ws2801_set_leds;
 	ws_driver->set_refresh_rate = ws2801_user_set_refresh_rate;
+	ws_driver->refresh = ws2801_user_refresh;
+	ws_driver->group_init = ws2801_user_group_init;
+	ws_driver->group_free = ws2801_user_group_free;
+	ws_driver->group_commit = ws2801_user_group_commit;
 	ws_driver->commit = ws2801_user_commit;
 	ws_driver->full_on = ws2801_full_on;
+	ws_driver->update = ws2801_update;
+	ws_driver->update_mask = ws2801_update_mask;
 	ws_driver->free = ws2801_user_free;
+	ws_driver->get_stats = ws2801_user_get_stats;
+	ws_driver->set_power_limit = ws2801_user_set_power_limit;
+	ws_driver->wait_commit = ws2801_wait_commit;
+	ws_driver->set_indexed = ws2801_user_set_indexed;
 
 	ret = ws2801_user_set_refresh_rate(ws_driver,
 					   WS2801_DEFAULT_REFRESH_RATE);
@@ -307,9 +1250,24 @@ free_out:
 	ws2801_user_free(ws_driver);
 	return ret;
 
+free_tx_cond_out:
+	pthread_cond_destroy(&ws->tx_cond);
+
+free_tx_lock_out:
+	pthread_mutex_destroy(&ws->tx_lock);
+
+free_cond_out:
+	pthread_cond_destroy(&ws->cond);
+
+free_refresh_lock_out:
+	pthread_mutex_destroy(&ws->refresh_lock);
+
 free_commit_lock_out:
 	pthread_mutex_destroy(&ws->commit_lock);
 
+free_frame_out:
+	free(ws->frame);
+
 free_ws_out:
 	free(ws);
 
@@ -321,3 +1279,21 @@ chrdev_name_out:
 
 	return ret;
 }
+
+int ws2801_user_init(unsigned int num_leds, unsigned int gpiochip, int gpio_clk,
+		     int gpio_do, struct ws2801_driver *ws_driver)
+{
+	return ws2801_user_open(num_leds, gpiochip, gpio_clk, gpio_do, NULL,
+				ws_driver);
+}
+
+int ws2801_user_attach(unsigned int num_leds, unsigned int gpiochip,
+		       int gpio_clk, int gpio_do, const char *state_path,
+		       struct ws2801_driver *ws_driver)
+{
+	if (!state_path)
+		return -EINVAL;
+
+	return ws2801_user_open(num_leds, gpiochip, gpio_clk, gpio_do,
+				state_path, ws_driver);
+}
@@ -12,8 +12,17 @@
  * the COPYING file in the top-level directory.
  */
 
+#ifndef _WS2801_H
+#define _WS2801_H
+
 #include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 #define WS2801_DEFAULT_REFRESH_RATE 5000
 #define WS2801_DEFAULT_AUTO_COMMIT false
@@ -24,6 +33,78 @@ struct led {
 	unsigned char b;
 };
 
+struct led_rgba {
+	unsigned char r;
+	unsigned char g;
+	unsigned char b;
+	unsigned char a;
+};
+
+/* Hue, saturation and value. The hue circle spans the full range of h,
+ * starting and ending at red. */
+struct led_hsv {
+	unsigned char h;
+	unsigned char s;
+	unsigned char v;
+};
+
+/* One element of a batched update, see update() */
+struct ws2801_update {
+	unsigned int num;
+	struct led color;
+};
+
+/* Power budget of a strip. Each coefficient is the current in mA that one
+ * channel of one LED draws at full intensity. */
+struct ws2801_power_limit {
+	unsigned int r_ma;
+	unsigned int g_ma;
+	unsigned int b_ma;
+	/* Frames that are estimated to draw more are dimmed uniformly */
+	unsigned int budget_ma;
+};
+
+/* Power scale of frames that were not dimmed */
+#define WS2801_POWER_SCALE_NONE 256
+
+/* Transmission statistics of a driver. All times are in ns. */
+struct ws2801_stats {
+	/* Transmitted frames, including refreshes */
+	unsigned long long frames;
+
+	/* Refreshes that were sent, and refreshes that were skipped, because
+	 * the strip was not idle for a full refresh period */
+	unsigned long long refreshes;
+	unsigned long long refreshes_skipped;
+
+	/* Time it took to transmit a frame */
+	unsigned long long tx_last;
+	unsigned long long tx_min;
+	unsigned long long tx_max;
+	unsigned long long tx_avg;
+
+	/* Smoothed difference of the transmit time of subsequent frames, as
+	 * the interarrival jitter of RFC 3550 */
+	unsigned long long tx_jitter;
+
+	/* Time between a commit() and the start of its transmission. Only
+	 * measured if transmission runs on a dedicated thread. */
+	unsigned long long latency_avg;
+	unsigned long long latency_max;
+
+	/* Estimated current of the last frame before dimming, 0 if no power
+	 * limit is set, and the scale in 1/256 that the frame was dimmed
+	 * with. */
+	unsigned long long power_ma;
+	unsigned int power_scale;
+	/* Frames that were dimmed to meet the power budget */
+	unsigned long long frames_limited;
+};
+
+struct ws2801_group;
+struct ws2801_sched;
+struct ws2801_recorder;
+
 struct ws2801_driver {
 	/* The refresh rate (in ms) forces the driver to commit changes to the
 	 * LED strip after a certain timeout, if no other changes were made.
@@ -35,8 +116,11 @@ struct ws2801_driver {
 	/* Automatically commit any change immediately */
 	void (*set_auto_commit)(struct ws2801_driver *ws, bool auto_commit);
 
-	/* Set all LEDs to RGB (0, 0, 0) */
-	void (*clear)(struct ws2801_driver *ws);
+	/* Set all LEDs to RGB (0, 0, 0)
+	 *
+	 * Returns 0 on success, and negative values in error cases.
+	 */
+	int (*clear)(struct ws2801_driver *ws);
 
 	/* Commit all pending changes to the hardware */
 	void (*commit)(struct ws2801_driver *ws);
@@ -55,6 +139,24 @@ struct ws2801_driver {
 	int (*set_leds)(struct ws2801_driver *ws, const struct led *leds,
 			unsigned int offset, unsigned int num_leds);
 
+	/* Apply many scattered LED updates at once. Either all updates are
+	 * applied, or none of them. In auto-commit mode, this commits once.
+	 *
+	 * Returns 0 on success, and negative values in error cases.
+	 */
+	int (*update)(struct ws2801_driver *ws,
+		      const struct ws2801_update *updates,
+		      unsigned int num_updates);
+
+	/* Like update(), but the LEDs to update are given as bitmap of
+	 * num_leds bits. colors holds one color for every set bit, in
+	 * ascending order of LEDs.
+	 *
+	 * Returns 0 on success, and negative values in error cases.
+	 */
+	int (*update_mask)(struct ws2801_driver *ws, const unsigned long *mask,
+			   const struct led *colors);
+
 	/* Set all LEDs to a specific color, without commit
 	 *
 	 * Returns 0 on success, and negative values in error cases.
@@ -64,12 +166,82 @@ struct ws2801_driver {
 	/* Free the driver structure */
 	void (*free)(struct ws2801_driver *ws);
 
+	/* Get the transmission statistics since the initialisation
+	 *
+	 * Returns 0 on success, and negative values in error cases.
+	 */
+	int (*get_stats)(struct ws2801_driver *ws, struct ws2801_stats *stats);
+
+	/* Dim frames that exceed a power budget on transmission. The LEDs of
+	 * the driver are left untouched. A NULL limit disables the limiter.
+	 *
+	 * Returns 0 on success, and negative values in error cases.
+	 */
+	int (*set_power_limit)(struct ws2801_driver *ws,
+			       const struct ws2801_power_limit *limit);
+
+	/* Wait until the next frame, committed or refreshed, was clocked out
+	 * by the hardware. A negative timeout waits forever.
+	 *
+	 * Returns 0 on success, -ETIMEDOUT if no frame was clocked out in
+	 * time, and negative values in other error cases. Backends that can't
+	 * tell return -ENOSYS.
+	 */
+	int (*wait_commit)(struct ws2801_driver *ws, int timeout_ms);
+
+	/* Refresh the strip, if it was idle for a full refresh period. Only
+	 * called by schedulers, see ws2801_sched_add().
+	 *
+	 * Returns the time in ms until the next refresh is due, 0 if
+	 * refreshes are disabled, and negative values in error cases.
+	 */
+	int (*refresh)(struct ws2801_driver *ws);
+
+	/* Commit all members of a group at once, see ws2801_group_commit().
+	 * All members share the same backend. */
+	int (*group_commit)(struct ws2801_group *group);
+
+	/* Optional setup and teardown of the backend's state of a group, see
+	 * ws2801_group_init(). Called on the first member. May be NULL.
+	 *
+	 * Returns 0 on success, and negative values in error cases.
+	 */
+	int (*group_init)(struct ws2801_group *group);
+	void (*group_free)(struct ws2801_group *group);
+
+	/* Switch the driver into indexed mode, or back to RGB LEDs, see
+	 * ws2801_indexed_init(). Backends that can't expand palette indices
+	 * on transmission return -ENOSYS.
+	 *
+	 * Returns 0 on success, and negative values in error cases.
+	 */
+	int (*set_indexed)(struct ws2801_driver *ws, bool indexed);
+
+	/* Optional hook that is invoked after every commit(), but not on
+	 * refreshes. May be set by the user. */
+	void (*commit_hook)(struct ws2801_driver *ws, void *data);
+	void *commit_hook_data;
+
 	/* Holds the number of LEDs. Do not write access! */
 	unsigned int num_leds;
 	struct led *leds;
+	/* In indexed mode, leds is NULL, and the frame is held as one palette
+	 * index per LED instead. Meanwhile, clear(), set_led(), set_leds(),
+	 * update(), update_mask() and full_on() fail with -EBUSY. Protected
+	 * by data_lock. */
+	unsigned char *index;
+	struct led *palette;
 	bool auto_commit;
 	pthread_mutex_t data_lock;
 
+	/* Scheduler that sends the refreshes, if any. Protected by
+	 * data_lock. Do not write access! */
+	struct ws2801_sched *sched;
+
+	/* Recorder of the commits, if any. Protected by data_lock. Do not
+	 * write access! */
+	struct ws2801_recorder *recorder;
+
 	/* Private driver data structure. Do not access! */
 	void *drv_data;
 };
@@ -77,5 +249,486 @@ struct ws2801_driver {
 int ws2801_user_init(unsigned int num_leds, unsigned int gpiochip,
 		     int gpio_clk, int gpio_do, struct ws2801_driver *ws);
 
+/* Like ws2801_user_init(), but meant for restarts: the strip is not blanked.
+ * The last transmitted frame is kept in the file state_path, preferably on a
+ * tmpfs. If the file holds a frame of the same length, it is restored into
+ * the LEDs and transmitted first. Otherwise, the strip is blanked as usual.
+ *
+ * Returns 0 on success, and negative values in error cases.
+ */
+int ws2801_user_attach(unsigned int num_leds, unsigned int gpiochip,
+		       int gpio_clk, int gpio_do, const char *state_path,
+		       struct ws2801_driver *ws);
+
+/* Electrical configuration of the lines of the userspace driver */
+#define WS2801_LINE_OPEN_DRAIN		(1 << 0)
+#define WS2801_LINE_OPEN_SOURCE		(1 << 1)
+#define WS2801_LINE_BIAS_PULL_UP	(1 << 2)
+#define WS2801_LINE_BIAS_PULL_DOWN	(1 << 3)
+#define WS2801_LINE_BIAS_DISABLED	(1 << 4)
+/* Use the deprecated v1 GPIO uAPI, even if v2 is available */
+#define WS2801_LINE_UAPI_V1		(1 << 5)
+
+/* Requests the lines of a userspace driver again, with the given flags. The
+ * lines are released for a short moment.
+ *
+ * Returns 0 on success, and negative values in error cases.
+ */
+int ws2801_user_set_line_flags(struct ws2801_driver *ws, unsigned int flags);
+
+/* Real-time settings of the transmit thread of the userspace driver */
+struct ws2801_rt {
+	/* SCHED_FIFO priority, or 0 to keep the default policy */
+	int priority;
+	/* CPU the thread is pinned to, or -1 */
+	int cpu;
+	/* Lock all current and future pages of the process into memory */
+	bool lock_memory;
+};
+
+/* Moves all transmissions of a userspace driver, including refreshes, to a
+ * dedicated thread with the given real-time settings. commit() hands the
+ * frame over to the thread and waits until it was sent. If rt is NULL, the
+ * thread is stopped and commits are transmitted by the caller again.
+ *
+ * Returns 0 on success, and negative values in error cases.
+ */
+int ws2801_user_set_rt(struct ws2801_driver *ws, const struct ws2801_rt *rt);
+
 int ws2801_kernel_init(unsigned int num_pixels, const char *device_name,
 		       struct ws2801_driver *ws);
+
+/* Attaches to a strip that is owned by ws2801d. The number of LEDs is
+ * determined by the daemon. If socket_path is NULL, the default socket is
+ * used.
+ */
+int ws2801_shm_init(const char *socket_path, const char *strip,
+		    struct ws2801_driver *ws);
+
+/* The interpolator smooths the output of slow producers. They submit target
+ * frames together with the time the frames should be shown, and an output
+ * thread fades the strip towards them at a fixed frame rate.
+ */
+struct ws2801_interp {
+	struct ws2801_driver *ws;
+	unsigned int fps;
+
+	/* Private interpolator data. Do not access! */
+	void *priv;
+};
+
+/* Drivers in indexed mode are refused with -EBUSY.
+ *
+ * Returns 0 on success, and negative values in error cases.
+ */
+int ws2801_interp_init(struct ws2801_interp *interp, struct ws2801_driver *ws,
+		       unsigned int fps);
+
+void ws2801_interp_free(struct ws2801_interp *interp);
+
+/* Fade from what the strip shows now to leds, which holds num_leds LEDs. The
+ * fade ends at time when, in ns of CLOCK_MONOTONIC. Frames in the past are
+ * shown immediately.
+ *
+ * Returns 0 on success, and negative values in error cases.
+ */
+int ws2801_interp_submit(struct ws2801_interp *interp, const struct led *leds,
+			 unsigned long long when);
+
+/* A commit group spans a scene over several drivers of the same backend.
+ * The frames of all members are shifted out in parallel, and the strips latch
+ * together.
+ */
+struct ws2801_group {
+	/* Sorted by address */
+	struct ws2801_driver **members;
+	unsigned int num_members;
+
+	/* Time between the first and the last latch of the last group commit,
+	 * and its maximum since the initialisation, in ns */
+	unsigned long long skew_last;
+	unsigned long long skew_max;
+
+	/* Private backend data. Do not access! */
+	void *priv;
+};
+
+/* All members must use the same backend, either the userspace or the kernel
+ * backend.
+ *
+ * Returns 0 on success, and negative values in error cases.
+ */
+int ws2801_group_init(struct ws2801_group *group,
+		      struct ws2801_driver *const *members,
+		      unsigned int num_members);
+
+/* Must be called before any of the members is freed */
+void ws2801_group_free(struct ws2801_group *group);
+
+/* Commit the LEDs of all members. Commit hooks of the members are invoked.
+ *
+ * Returns 0 on success, and negative values in error cases.
+ */
+int ws2801_group_commit(struct ws2801_group *group);
+
+/* A scheduler sends the refreshes of many userspace drivers with a fixed
+ * pool of worker threads, instead of one refresh thread per driver. Strips
+ * that are due are served in order of their priority, strips of the same
+ * priority in the order they became due.
+ */
+struct ws2801_sched {
+	unsigned int num_workers;
+
+	/* Private scheduler data. Do not access! */
+	void *priv;
+};
+
+/* Returns 0 on success, and negative values in error cases. */
+int ws2801_sched_init(struct ws2801_sched *sched, unsigned int num_workers);
+
+/* Stops all workers. Drivers that are still registered refresh on their own
+ * again. */
+void ws2801_sched_free(struct ws2801_sched *sched);
+
+/* Hands the refreshes of a driver over to the scheduler. Higher priorities
+ * are served first. Drivers that refresh on their own, like the kernel and
+ * the daemon backend, can't be added.
+ *
+ * Returns 0 on success, and negative values in error cases.
+ */
+int ws2801_sched_add(struct ws2801_sched *sched, struct ws2801_driver *ws,
+		     int priority);
+
+/* Hands the refreshes of a driver back to the driver. Freeing a driver
+ * removes it from its scheduler. */
+void ws2801_sched_remove(struct ws2801_sched *sched, struct ws2801_driver *ws);
+
+enum ws2801_blend_mode {
+	WS2801_BLEND_OVER,
+	WS2801_BLEND_ADD,
+	WS2801_BLEND_MAX,
+};
+
+/* The compositor blends several RGBA layers into the LEDs of a driver. Layer
+ * 0 is the bottom layer.  Layers are only blended again on commit, if any of
+ * them changed.
+ */
+struct ws2801_compositor {
+	struct ws2801_driver *ws;
+	unsigned int num_layers;
+
+	/* Private compositor data. Do not access! */
+	void *priv;
+};
+
+/* All layers start fully transparent, in WS2801_BLEND_OVER mode with full
+ * opacity.
+ *
+ * Returns 0 on success, and negative values in error cases.
+ */
+int ws2801_compositor_init(struct ws2801_compositor *comp,
+			   struct ws2801_driver *ws, unsigned int num_layers);
+
+void ws2801_compositor_free(struct ws2801_compositor *comp);
+
+/* Set a range of LEDs of one layer
+ *
+ * Returns the number of LEDs set, and negative values in error cases.
+ */
+int ws2801_layer_set_leds(struct ws2801_compositor *comp, unsigned int layer,
+			  const struct led_rgba *leds, unsigned int offset,
+			  unsigned int num_leds);
+
+/* Make a layer fully transparent
+ *
+ * Returns 0 on success, and negative values in error cases.
+ */
+int ws2801_layer_clear(struct ws2801_compositor *comp, unsigned int layer);
+
+/* Set blend mode and opacity of a layer
+ *
+ * Returns 0 on success, and negative values in error cases.
+ */
+int ws2801_layer_set_blend(struct ws2801_compositor *comp, unsigned int layer,
+			   enum ws2801_blend_mode mode, unsigned char opacity);
+
+/* Blend all layers into the driver's LEDs, if required, and commit them.
+ * While the driver is in indexed mode, changed layers are neither blended
+ * nor committed. */
+void ws2801_compositor_commit(struct ws2801_compositor *comp);
+
+/* Convert num_leds colors from HSV to RGB. Eight LEDs are converted at once,
+ * using SIMD instructions where available. */
+void ws2801_hsv_to_rgb(struct led *dst, const struct led_hsv *src,
+		       unsigned int num_leds);
+
+/* Look up the colors of num_leds palette indices */
+void ws2801_palette_expand(struct led *dst, const unsigned char *index,
+			   const struct led *palette, unsigned int num_leds);
+
+#define WS2801_PALETTE_SIZE 256
+
+/* In indexed mode, every LED holds an index into a palette of 256 colors,
+ * instead of a color. The indices are only expanded to colors when they are
+ * transmitted, so palette animations only change the palette. Backends that
+ * support it drop their RGB LEDs in indexed mode, the others get the frame
+ * expanded into their LEDs on commit.
+ */
+struct ws2801_indexed {
+	struct ws2801_driver *ws;
+
+	/* Private indexed mode data. Do not access! */
+	void *priv;
+};
+
+/* All LEDs start at index 0, and all palette colors are black. Until
+ * ws2801_indexed_free(), the LEDs of the driver must not be accessed. On
+ * backends that drop their RGB LEDs, the RGB setters of the driver fail
+ * with -EBUSY meanwhile.
+ *
+ * Returns 0 on success, and negative values in error cases.
+ */
+int ws2801_indexed_init(struct ws2801_indexed *ind, struct ws2801_driver *ws);
+
+/* Switch the driver back to RGB LEDs, that hold the last frame. Must be
+ * called before the driver is freed.
+ *
+ * Returns 0 on success, and negative values in error cases. On error, the
+ * driver stays in indexed mode.
+ */
+int ws2801_indexed_free(struct ws2801_indexed *ind);
+
+/* Set the palette indices of a range of LEDs
+ *
+ * Returns the number of LEDs set, and negative values in error cases.
+ */
+int ws2801_indexed_set_leds(struct ws2801_indexed *ind,
+			    const unsigned char *index, unsigned int offset,
+			    unsigned int num_leds);
+
+/* Set num_colors palette colors, starting at index first
+ *
+ * Returns 0 on success, and negative values in error cases.
+ */
+int ws2801_indexed_set_palette(struct ws2801_indexed *ind,
+			       const struct led *colors, unsigned int first,
+			       unsigned int num_colors);
+
+/* Commit the frame. Drivers without indexed mode get the indices expanded
+ * into their LEDs first, if required. */
+void ws2801_indexed_commit(struct ws2801_indexed *ind);
+
+enum ws2801_pixel_format {
+	/* Packed 8 bit RGB */
+	WS2801_FORMAT_RGB24,
+	/* Packed 4:2:2 YUV, Y0 U Y1 V, BT.601 limited range */
+	WS2801_FORMAT_YUYV,
+};
+
+struct ws2801_ambi_config {
+	unsigned int width;
+	unsigned int height;
+	enum ws2801_pixel_format format;
+	/* Bytes per line, 0 if lines are not padded */
+	unsigned int stride;
+
+	/* Number of LEDs along every edge of the screen. LEDs are ordered
+	 * clockwise, starting at the bottom of the left edge. */
+	unsigned int left;
+	unsigned int top;
+	unsigned int right;
+	unsigned int bottom;
+
+	/* How far the regions of the LEDs reach into the screen, in percent */
+	unsigned int depth;
+	/* Weight of the previous colors against the new ones, from 0 (no
+	 * smoothing) to 255 */
+	unsigned int smoothing;
+};
+
+/* The ambient light stage lights LEDs around a screen with the average
+ * colors of the screen's edges. Every LED shows one region of the frame. The
+ * regions are computed on initialisation.
+ */
+struct ws2801_ambi {
+	struct ws2801_driver *ws;
+	/* Number of LEDs that are driven, starting at the first LED */
+	unsigned int num_leds;
+
+	/* Private ambient light data. Do not access! */
+	void *priv;
+};
+
+/* Returns 0 on success, and negative values in error cases. */
+int ws2801_ambi_init(struct ws2801_ambi *ambi, struct ws2801_driver *ws,
+		     const struct ws2801_ambi_config *cfg);
+
+void ws2801_ambi_free(struct ws2801_ambi *ambi);
+
+/* Set the LEDs from a frame of len bytes in the configured format, and
+ * commit them
+ *
+ * Returns 0 on success, and negative values in error cases.
+ */
+int ws2801_ambi_submit(struct ws2801_ambi *ambi, const void *frame,
+		       size_t len);
+
+struct ws2801_audio_config {
+	/* Sample rate in Hz */
+	unsigned int rate;
+	/* Samples per transform, a power of two */
+	unsigned int fft_size;
+	/* A frame is rendered every hop samples */
+	unsigned int hop;
+	/* Every band drives an equal segment of the strip, lowest band first */
+	unsigned int num_bands;
+	/* The bands are spaced logarithmically from min_freq to max_freq Hz */
+	unsigned int min_freq;
+	unsigned int max_freq;
+	/* Time constants of rising and falling band levels in ms */
+	unsigned int attack_ms;
+	unsigned int decay_ms;
+};
+
+/* The audio visualiser shows the level of frequency bands of mono PCM as bars
+ * on segments of the strip. All buffers are allocated on initialisation.
+ */
+struct ws2801_audio {
+	struct ws2801_driver *ws;
+
+	/* Time between capturing the newest sample of a frame and the end of
+	 * its commit, for the last frame and the maximum since the
+	 * initialisation, in ns */
+	unsigned long long latency_last;
+	unsigned long long latency_max;
+
+	/* Private audio data. Do not access! */
+	void *priv;
+};
+
+/* Returns 0 on success, and negative values in error cases. */
+int ws2801_audio_init(struct ws2801_audio *audio, struct ws2801_driver *ws,
+		      const struct ws2801_audio_config *cfg);
+
+void ws2801_audio_free(struct ws2801_audio *audio);
+
+/* Feed num signed 16 bit mono samples. timestamp is the time in ns of
+ * CLOCK_MONOTONIC when the last of them was captured. If a hop completed, a
+ * frame is rendered from the newest samples and committed. If several hops
+ * completed, only one frame is rendered.
+ *
+ * Returns the number of committed frames, and negative values in error cases.
+ */
+int ws2801_audio_feed(struct ws2801_audio *audio, const short *samples,
+		      unsigned int num, unsigned long long timestamp);
+
+#define WS2801_EFFECT_ABI 1
+#define WS2801_EFFECT_SYMBOL "ws2801_effect"
+
+/* Effect plugins are shared objects that export a struct ws2801_effect named
+ * ws2801_effect. render() draws a whole frame of num_leds LEDs, t_ns ns after
+ * the effect was started. init() and exit() are optional.
+ */
+struct ws2801_effect {
+	/* WS2801_EFFECT_ABI */
+	unsigned int abi;
+	const char *name;
+
+	/* Returns 0 on success, and negative values in error cases. */
+	int (*init)(unsigned int num_leds);
+	void (*render)(struct led *out, unsigned int num_leds, uint64_t t_ns);
+	void (*exit)(void);
+};
+
+/* The effect host runs effect plugins on an output thread that renders and
+ * commits frames at a fixed rate.
+ */
+struct ws2801_host {
+	struct ws2801_driver *ws;
+	unsigned int fps;
+
+	/* Duration of the last render() call, and the maximum since the
+	 * current effect was loaded, in ns. Written by the output thread. */
+	unsigned long long render_last;
+	unsigned long long render_max;
+
+	/* Private effect host data. Do not access! */
+	void *priv;
+};
+
+/* Returns 0 on success, and negative values in error cases. */
+int ws2801_host_init(struct ws2801_host *host, struct ws2801_driver *ws,
+		     unsigned int fps);
+
+void ws2801_host_free(struct ws2801_host *host);
+
+/* Load the effect plugin at path, and switch to it. The previous effect is
+ * unloaded, the strip is neither reinitialised nor blanked.
+ *
+ * Returns 0 on success, and negative values in error cases. On errors, the
+ * previous effect keeps running.
+ */
+int ws2801_host_load(struct ws2801_host *host, const char *path);
+
+enum ws2801_color_order {
+	WS2801_ORDER_RGB,
+	WS2801_ORDER_RBG,
+	WS2801_ORDER_GRB,
+	WS2801_ORDER_GBR,
+	WS2801_ORDER_BRG,
+	WS2801_ORDER_BGR,
+};
+
+/* A pre-rendered show, stored in a file. Files are mapped, not loaded, so
+ * even long shows open instantly. */
+struct ws2801_seq {
+	unsigned int num_leds;
+	unsigned int num_frames;
+	unsigned int fps;
+	enum ws2801_color_order order;
+
+	/* Private sequence data. Do not access! */
+	void *priv;
+};
+
+/* Returns 0 on success, and negative values in error cases. */
+int ws2801_seq_open(struct ws2801_seq *seq, const char *path);
+
+void ws2801_seq_close(struct ws2801_seq *seq);
+
+/* Presentation time of a frame in ns, relative to the first frame
+ *
+ * Returns ULLONG_MAX for frames out of range.
+ */
+unsigned long long ws2801_seq_time(const struct ws2801_seq *seq,
+				   unsigned int frame);
+
+/* Load a frame into the LEDs of a driver, without commit
+ *
+ * Returns 0 on success, and negative values in error cases.
+ */
+int ws2801_seq_load(struct ws2801_seq *seq, struct ws2801_driver *ws,
+		    unsigned int frame);
+
+struct ws2801_recorder {
+	/* Private recorder data. Do not access! */
+	void *priv;
+};
+
+/* Record every commit of a driver into a sequence file, until the recorder
+ * is stopped. fps is only informational, frames are stored with timestamps.
+ * The file is created, existing files are refused with -EEXIST.
+ *
+ * Returns 0 on success, and negative values in error cases.
+ */
+int ws2801_record_start(struct ws2801_recorder *rec, struct ws2801_driver *ws,
+			const char *path, unsigned int fps);
+
+/* Returns 0 on success, and negative values in error cases. */
+int ws2801_record_stop(struct ws2801_recorder *rec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _WS2801_H */
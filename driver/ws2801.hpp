@@ -0,0 +1,261 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+/* Header-only C++ interface, requires C++20. Errors are reported as
+ * std::system_error. */
+
+#ifndef _WS2801_HPP
+#define _WS2801_HPP
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <span>
+#include <stdexcept>
+#include <system_error>
+
+#include "ws2801.h"
+
+namespace ws2801 {
+
+inline void check(int err, const char *what)
+{
+	if (err < 0)
+		throw std::system_error(-err, std::generic_category(), what);
+}
+
+struct User {
+	unsigned int num_leds;
+	unsigned int gpiochip;
+	int gpio_clk;
+	int gpio_do;
+	/* If set, attach warm with this state file */
+	const char *state = nullptr;
+};
+
+struct Kernel {
+	unsigned int num_leds;
+	const char *device_name;
+};
+
+struct Daemon {
+	const char *strip;
+	const char *socket_path = nullptr;
+};
+
+/* Owns a driver instance, which is freed on destruction. Drivers hand out
+ * pointers to themselves to their threads, so they can neither be copied
+ * nor moved. */
+class Driver {
+public:
+	explicit Driver(const User &cfg)
+	{
+		if (cfg.state)
+			check(ws2801_user_attach(cfg.num_leds, cfg.gpiochip,
+						 cfg.gpio_clk, cfg.gpio_do,
+						 cfg.state, &ws),
+			      "ws2801_user_attach");
+		else
+			check(ws2801_user_init(cfg.num_leds, cfg.gpiochip,
+					       cfg.gpio_clk, cfg.gpio_do, &ws),
+			      "ws2801_user_init");
+	}
+
+	explicit Driver(const Kernel &cfg)
+	{
+		check(ws2801_kernel_init(cfg.num_leds, cfg.device_name, &ws),
+		      "ws2801_kernel_init");
+	}
+
+	explicit Driver(const Daemon &cfg)
+	{
+		check(ws2801_shm_init(cfg.socket_path, cfg.strip, &ws),
+		      "ws2801_shm_init");
+	}
+
+	Driver(const Driver &) = delete;
+	Driver &operator=(const Driver &) = delete;
+
+	~Driver()
+	{
+		ws.free(&ws);
+	}
+
+	unsigned int size() const noexcept
+	{
+		return ws.num_leds;
+	}
+
+	void set_led(unsigned int num, const led &color)
+	{
+		check(ws.set_led(&ws, num, &color), "set_led");
+	}
+
+	void set_leds(std::span<const led> leds, unsigned int offset = 0)
+	{
+		check(ws.set_leds(&ws, leds.data(), offset, leds.size()),
+		      "set_leds");
+	}
+
+	void update(std::span<const ws2801_update> updates)
+	{
+		check(ws.update(&ws, updates.data(), updates.size()), "update");
+	}
+
+	void full_on(const led &color)
+	{
+		check(ws.full_on(&ws, &color), "full_on");
+	}
+
+	void clear()
+	{
+		check(ws.clear(&ws), "clear");
+	}
+
+	void commit()
+	{
+		ws.commit(&ws);
+	}
+
+	void set_refresh_rate(unsigned int refresh_rate_ms)
+	{
+		check(ws.set_refresh_rate(&ws, refresh_rate_ms),
+		      "set_refresh_rate");
+	}
+
+	void set_auto_commit(bool auto_commit)
+	{
+		ws.set_auto_commit(&ws, auto_commit);
+	}
+
+	ws2801_stats stats()
+	{
+		ws2801_stats stats;
+
+		check(ws.get_stats(&ws, &stats), "get_stats");
+		return stats;
+	}
+
+	void set_power_limit(const ws2801_power_limit &limit)
+	{
+		check(ws.set_power_limit(&ws, &limit), "set_power_limit");
+	}
+
+	void clear_power_limit()
+	{
+		check(ws.set_power_limit(&ws, nullptr), "set_power_limit");
+	}
+
+	/* Returns false if no frame was clocked out within the timeout */
+	bool wait_commit(int timeout_ms = -1)
+	{
+		int err = ws.wait_commit(&ws, timeout_ms);
+
+		if (err == -ETIMEDOUT)
+			return false;
+		check(err, "wait_commit");
+		return true;
+	}
+
+	ws2801_driver &get() noexcept
+	{
+		return ws;
+	}
+
+private:
+	ws2801_driver ws;
+};
+
+/* A frame of N LEDs for a strip whose chips expect the channels in the given
+ * order. Colors are reordered at compile time, pixel access is not bounds
+ * checked, and commit() hands the whole frame to the driver at once. */
+template <std::size_t N, ws2801_color_order Order = WS2801_ORDER_RGB>
+class Strip {
+public:
+	explicit Strip(ws2801_driver &ws) : ws(ws)
+	{
+		if (ws.num_leds < N)
+			throw std::length_error("strip is shorter than N");
+	}
+
+	explicit Strip(Driver &driver) : Strip(driver.get())
+	{
+	}
+
+	static constexpr std::size_t size() noexcept
+	{
+		return N;
+	}
+
+	void set(std::size_t num, const led &color) noexcept
+	{
+		frame[num] = wire(color);
+	}
+
+	void set(std::span<const led> colors, std::size_t offset = 0) noexcept
+	{
+		for (std::size_t i = 0; i < colors.size(); i++)
+			frame[offset + i] = wire(colors[i]);
+	}
+
+	void fill(const led &color) noexcept
+	{
+		frame.fill(wire(color));
+	}
+
+	void clear() noexcept
+	{
+		frame.fill(led{});
+	}
+
+	/* The frame in the order it goes over the wire */
+	std::span<const led, N> data() const noexcept
+	{
+		return frame;
+	}
+
+	/* Hand the frame to the driver, without commit */
+	void load()
+	{
+		check(ws.set_leds(&ws, frame.data(), 0, N), "set_leds");
+	}
+
+	void commit()
+	{
+		load();
+		ws.commit(&ws);
+	}
+
+private:
+	static constexpr led wire(const led &c) noexcept
+	{
+		if constexpr (Order == WS2801_ORDER_RBG)
+			return { c.r, c.b, c.g };
+		else if constexpr (Order == WS2801_ORDER_GRB)
+			return { c.g, c.r, c.b };
+		else if constexpr (Order == WS2801_ORDER_GBR)
+			return { c.g, c.b, c.r };
+		else if constexpr (Order == WS2801_ORDER_BRG)
+			return { c.b, c.r, c.g };
+		else if constexpr (Order == WS2801_ORDER_BGR)
+			return { c.b, c.g, c.r };
+		else
+			return c;
+	}
+
+	ws2801_driver &ws;
+	std::array<led, N> frame{};
+};
+
+} /* namespace ws2801 */
+
+#endif /* _WS2801_HPP */
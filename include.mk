@@ -12,6 +12,8 @@ CFLAGS += -Wall -Wstrict-prototypes -Wtype-limits \
 	  -Wmissing-declarations -Wmissing-prototypes
 CFLAGS += -O2
 
+CXXFLAGS += -Wall -O2
+
 INSTALL ?= install
 INSTALL_FILE ?= $(INSTALL) -m 644
 INSTALL_LIB ?= $(INSTALL_FILE)
@@ -0,0 +1,213 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+/*
+ * KUnit tests of the parser of the set attribute. This file is included by
+ * ws2801.c, so that the static functions can be tested.
+ */
+
+#include <kunit/test.h>
+#include <linux/math64.h>
+
+#define TEST_MAX_OPS 16
+#define TEST_NUM_LEDS 10
+
+#define THROUGHPUT_ROUNDS 1000
+
+static int test_parse(const char *buf, struct ws2801_set_op *ops)
+{
+	return ws2801_parse_set(buf, strlen(buf), ops, TEST_MAX_OPS);
+}
+
+static void expect_op(struct kunit *test, const struct ws2801_set_op *op,
+		      unsigned int first, unsigned int last, u8 r, u8 g, u8 b)
+{
+	KUNIT_EXPECT_EQ(test, op->first, first);
+	KUNIT_EXPECT_EQ(test, op->last, last);
+	KUNIT_EXPECT_EQ(test, op->color.r, r);
+	KUNIT_EXPECT_EQ(test, op->color.g, g);
+	KUNIT_EXPECT_EQ(test, op->color.b, b);
+}
+
+static void ws2801_test_valid(struct kunit *test)
+{
+	struct ws2801_set_op ops[TEST_MAX_OPS];
+
+	KUNIT_ASSERT_EQ(test, test_parse("10 255 0 255", ops), 1);
+	expect_op(test, &ops[0], 10, 10, 255, 0, 255);
+
+	KUNIT_ASSERT_EQ(test, test_parse("10 255 0 255\n11 255 0 0\n", ops),
+			2);
+	expect_op(test, &ops[0], 10, 10, 255, 0, 255);
+	expect_op(test, &ops[1], 11, 11, 255, 0, 0);
+
+	/* Blanks around the fields and empty lines are skipped */
+	KUNIT_ASSERT_EQ(test, test_parse("\n \t\n  3\t1  2 3 \n\n", ops), 1);
+	expect_op(test, &ops[0], 3, 3, 1, 2, 3);
+
+	KUNIT_EXPECT_EQ(test, test_parse("", ops), 0);
+	KUNIT_EXPECT_EQ(test, test_parse("\n\n", ops), 0);
+}
+
+static void ws2801_test_range(struct kunit *test)
+{
+	struct ws2801_set_op ops[TEST_MAX_OPS];
+
+	KUNIT_ASSERT_EQ(test, test_parse("0-9 1 2 3\n5-5 4 5 6\n", ops), 2);
+	expect_op(test, &ops[0], 0, 9, 1, 2, 3);
+	expect_op(test, &ops[1], 5, 5, 4, 5, 6);
+
+	/* Reversed and incomplete ranges */
+	KUNIT_EXPECT_EQ(test, test_parse("9-3 1 2 3", ops), -EINVAL);
+	KUNIT_EXPECT_EQ(test, test_parse("3- 1 2 3", ops), -EINVAL);
+	KUNIT_EXPECT_EQ(test, test_parse("-3 1 2 3", ops), -EINVAL);
+	KUNIT_EXPECT_EQ(test, test_parse("3 -9 1 2 3", ops), -EINVAL);
+}
+
+static void ws2801_test_hex(struct kunit *test)
+{
+	struct ws2801_set_op ops[TEST_MAX_OPS];
+
+	KUNIT_ASSERT_EQ(test, test_parse("0-9 #ff8000\n", ops), 1);
+	expect_op(test, &ops[0], 0, 9, 0xff, 0x80, 0x00);
+
+	KUNIT_ASSERT_EQ(test, test_parse("7 #A0b1C2", ops), 1);
+	expect_op(test, &ops[0], 7, 7, 0xa0, 0xb1, 0xc2);
+
+	KUNIT_EXPECT_EQ(test, test_parse("1 #12345", ops), -EINVAL);
+	KUNIT_EXPECT_EQ(test, test_parse("1 #1234zz", ops), -EINVAL);
+	KUNIT_EXPECT_EQ(test, test_parse("1 #1234567", ops), -EINVAL);
+	KUNIT_EXPECT_EQ(test, test_parse("1 #", ops), -EINVAL);
+}
+
+static void ws2801_test_overflow(struct kunit *test)
+{
+	struct ws2801_set_op ops[TEST_MAX_OPS];
+
+	KUNIT_ASSERT_EQ(test, test_parse("4294967295 1 2 3", ops), 1);
+	expect_op(test, &ops[0], UINT_MAX, UINT_MAX, 1, 2, 3);
+
+	KUNIT_EXPECT_EQ(test, test_parse("4294967296 1 2 3", ops), -EINVAL);
+	KUNIT_EXPECT_EQ(test, test_parse("0-4294967296 1 2 3", ops), -EINVAL);
+	KUNIT_EXPECT_EQ(test, test_parse("99999999999999999999999 1 2 3",
+					 ops), -EINVAL);
+	KUNIT_EXPECT_EQ(test, test_parse("1 256 0 0", ops), -EINVAL);
+	KUNIT_EXPECT_EQ(test, test_parse("1 0 0 4294967296", ops), -EINVAL);
+
+	/* More lines than the caller has room for */
+	KUNIT_EXPECT_EQ(test, ws2801_parse_set("1 1 1 1\n2 2 2 2\n", 16, ops,
+					       1), -EINVAL);
+}
+
+static void ws2801_test_malformed(struct kunit *test)
+{
+	struct ws2801_set_op ops[TEST_MAX_OPS];
+
+	KUNIT_EXPECT_EQ(test, test_parse("3 1 2", ops), -EINVAL);
+	KUNIT_EXPECT_EQ(test, test_parse("3 1 2\n", ops), -EINVAL);
+	KUNIT_EXPECT_EQ(test, test_parse("3", ops), -EINVAL);
+	KUNIT_EXPECT_EQ(test, test_parse("1 2 3 4 x", ops), -EINVAL);
+	KUNIT_EXPECT_EQ(test, test_parse("1 2 3 4 5", ops), -EINVAL);
+	KUNIT_EXPECT_EQ(test, test_parse("a 1 2 3", ops), -EINVAL);
+	KUNIT_EXPECT_EQ(test, test_parse("1 +2 3 4", ops), -EINVAL);
+	KUNIT_EXPECT_EQ(test, test_parse("1 2 3 4\n5", ops), -EINVAL);
+
+	/* The length is honoured, buffers from sysfs aren't terminated */
+	KUNIT_EXPECT_EQ(test, ws2801_parse_set("1 2 3 45", 7, ops,
+					       TEST_MAX_OPS), 1);
+	KUNIT_EXPECT_EQ(test, ops[0].color.b, 4);
+}
+
+/* A write with one bad line leaves all LEDs untouched */
+static void ws2801_test_all_or_nothing(struct kunit *test)
+{
+	static const char * const bad[] = {
+		"0 1 2 3\n1 1 2 3\n10 1 2 3\n",
+		"0 1 2 3\n1-10 1 2 3\n",
+		"0 1 2 3\n1 1 2 300\n",
+		"0 1 2 3\n1 #12345g\n",
+	};
+	const char *good = "0-1 1 2 3\n9 #040506\n";
+	struct ws2801 *ws;
+	unsigned int i;
+
+	ws = kunit_kzalloc(test, sizeof(*ws), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ws);
+	ws->leds = kunit_kcalloc(test, TEST_NUM_LEDS, sizeof(*ws->leds),
+				 GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ws->leds);
+	ws->num_leds = TEST_NUM_LEDS;
+	mutex_init(&ws->data_lock);
+
+	for (i = 0; i < ARRAY_SIZE(bad); i++) {
+		KUNIT_EXPECT_LT(test, set_store(&ws->kobj, NULL, bad[i],
+						strlen(bad[i])), 0);
+		KUNIT_EXPECT_EQ(test, ws->leds[0].r, 0);
+		KUNIT_EXPECT_EQ(test, ws->leds[1].r, 0);
+	}
+
+	KUNIT_EXPECT_EQ(test, set_store(&ws->kobj, NULL, good, strlen(good)),
+			(ssize_t)strlen(good));
+	KUNIT_EXPECT_EQ(test, ws->leds[1].b, 3);
+	KUNIT_EXPECT_EQ(test, ws->leds[2].b, 0);
+	KUNIT_EXPECT_EQ(test, ws->leds[9].r, 4);
+
+	mutex_destroy(&ws->data_lock);
+}
+
+/* Parses a page of single LED lines, as written by libraries */
+static void ws2801_test_throughput(struct kunit *test)
+{
+	unsigned int i, num_lines, max_ops;
+	struct ws2801_set_op *ops;
+	size_t len = 0;
+	u64 start, ns;
+	char *page;
+
+	page = kunit_kmalloc(test, PAGE_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, page);
+	/* Lines are at most 16 characters long */
+	for (num_lines = 0; len + 16 < PAGE_SIZE; num_lines++)
+		len += scnprintf(page + len, PAGE_SIZE - len, "%u %u %u %u\n",
+				 num_lines, num_lines & 0xff, 255, 0);
+
+	max_ops = len / 8 + 1;
+	ops = kunit_kmalloc_array(test, max_ops, sizeof(*ops), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ops);
+
+	start = ktime_get_ns();
+	for (i = 0; i < THROUGHPUT_ROUNDS; i++)
+		KUNIT_ASSERT_EQ(test, ws2801_parse_set(page, len, ops, max_ops),
+				(int)num_lines);
+	ns = ktime_get_ns() - start;
+
+	kunit_info(test, "%u lines, %zu bytes: %llu ns per write\n",
+		   num_lines, len, div_u64(ns, THROUGHPUT_ROUNDS));
+}
+
+static struct kunit_case ws2801_test_cases[] = {
+	KUNIT_CASE(ws2801_test_valid),
+	KUNIT_CASE(ws2801_test_range),
+	KUNIT_CASE(ws2801_test_hex),
+	KUNIT_CASE(ws2801_test_overflow),
+	KUNIT_CASE(ws2801_test_malformed),
+	KUNIT_CASE(ws2801_test_all_or_nothing),
+	KUNIT_CASE(ws2801_test_throughput),
+	{}
+};
+
+static struct kunit_suite ws2801_test_suite = {
+	.name = "ws2801-set",
+	.test_cases = ws2801_test_cases,
+};
+
+kunit_test_suite(ws2801_test_suite);
@@ -16,24 +16,33 @@
 #include <linux/of_gpio.h>
 #include <linux/gpio/consumer.h>
 #include <linux/platform_device.h>
+#include <linux/pm_runtime.h>
 #include <linux/regulator/consumer.h>
 #include <linux/slab.h>
 #include <linux/sched.h>
-#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
 
 #define DRIVER_NAME "ws2801"
 
 #define WS2801_NUM_LEDS_DEFAULT 30
 #define WS2801_DEFAULT_REFRESH_RATE 5000
+#define WS2801_DEFAULT_IDLE_TIMEOUT 30000
 
 #define INIT_CLEAR_MAX 1000
 
+/* The strip latches if the clock stays low for this long */
+#define WS2801_LATCH_US 1000
+
 #define FORMAT_LED "%hhu %hhu %hhu"
-#define FORMAT_NUM_LED "%u " FORMAT_LED
 
 static struct device *ws2801_dev;
 static struct kobject *devices_dir;
 
+/* All probed devices. The lock also serialises group commits. */
+static LIST_HEAD(ws2801_devices);
+static DEFINE_MUTEX(ws2801_devices_lock);
+
 struct led {
 	unsigned char r;
 	unsigned char g;
@@ -46,17 +55,37 @@ struct ws2801 {
 	struct regulator *regulator;
 	struct mutex data_lock;
 	struct mutex commit_lock;
-	struct task_struct *refresh_task;
+	struct delayed_work refresh_work;
 	bool auto_commit;
+	ktime_t latch_time; /* protected by commit_lock */
+	unsigned long commit_seq; /* protected by commit_lock */
+	/* runtime suspended: nothing is clocked out. Protected by commit_lock */
+	bool suspended;
+	/* holds a runtime PM reference, as the LEDs are not all dark.
+	 * Protected by data_lock */
+	bool lit;
 
 	char name[16];
 	unsigned int refresh_rate; /* in ms. 0: off */
+	unsigned long refreshes_skipped;
+	/* only used by the refresh work */
+	ktime_t refresh_due;
+	struct led *refresh_leds;
+	unsigned int refresh_num_leds;
 	unsigned int num_leds;
 	struct led *leds;
 	struct gpio_desc *clk;
 	struct gpio_desc *data;
+
+	struct list_head list;
 };
 
+/* Record of the binary update attribute */
+struct ws2801_update {
+	__le32 num;
+	struct led color;
+} __packed;
+
 const static struct led blank_led = {
 	.r = 0,
 	.g = 0,
@@ -85,17 +114,28 @@ static inline void ws2801_send_led(struct ws2801 *ws, const struct led *led)
 static inline void ws2801_set_latch(struct ws2801 *ws)
 {
 	gpiod_set_value(ws->clk, 0);
-	udelay(1000);
+	ws->latch_time = ktime_get();
 }
 
-static int ws2801_set_led(struct ws2801 *ws, size_t no, struct led *led)
+/* Instead of waiting for the latch after every frame, wait for the remaining
+ * time right before the next frame is sent */
+static void ws2801_wait_latch(struct ws2801 *ws)
 {
-	if (no >= ws->num_leds)
-		return -ERANGE;
+	s64 remaining;
 
-	ws->leds[no] = *led;
+	remaining = WS2801_LATCH_US -
+		    ktime_us_delta(ktime_get(), ws->latch_time);
+	if (remaining > 0)
+		usleep_range(remaining, remaining + 100);
+}
 
-	return 0;
+static inline void ws2801_fill(struct ws2801 *ws, unsigned int first,
+			       unsigned int last, const struct led *led)
+{
+	unsigned int i;
+
+	for (i = first; i <= last; i++)
+		ws->leds[i] = *led;
 }
 
 static inline void ws2801_set_leds(struct ws2801 *ws, const struct led *led)
@@ -106,17 +146,32 @@ static inline void ws2801_set_leds(struct ws2801 *ws, const struct led *led)
 		ws->leds[i] = *led;
 }
 
-static void ws2801_commit(struct ws2801 *ws, const struct led *leds,
-			  unsigned int num_leds)
+/* Shifts out the LEDs, but doesn't latch them yet: the clock stays high.
+ * Must be called with commit_lock held, on devices that are not suspended. */
+static void ws2801_shift(struct ws2801 *ws, const struct led *leds,
+			 unsigned int num_leds)
 {
 	unsigned int i;
 
-	mutex_lock(&ws->commit_lock);
+	ws2801_wait_latch(ws);
 	for (i = 0; i < num_leds; i++)
 		ws2801_send_led(ws, leds + i);
+}
 
-	ws2801_set_latch(ws);
+static void ws2801_commit(struct ws2801 *ws, const struct led *leds,
+			  unsigned int num_leds)
+{
+	mutex_lock(&ws->commit_lock);
+	/* Unpowered strips are left alone, but pollers still see the commit */
+	if (!ws->suspended) {
+		ws2801_shift(ws, leds, num_leds);
+		ws2801_set_latch(ws);
+	}
+	ws->commit_seq++;
 	mutex_unlock(&ws->commit_lock);
+
+	/* Wake up pollers of commit_seq */
+	sysfs_notify(&ws->kobj, NULL, "commit_seq");
 }
 
 static inline void ws2801_clear(struct ws2801 *ws)
@@ -124,95 +179,260 @@ static inline void ws2801_clear(struct ws2801 *ws)
 	memset(ws->leds, 0, ws->num_leds * sizeof(*ws->leds));
 }
 
-static int ws2801_refresh_thread(void *data)
+/* All devices share one workqueue for their refreshes */
+static struct workqueue_struct *ws2801_wq;
+
+static unsigned int refresh_workers = 4;
+module_param(refresh_workers, uint, 0444);
+MODULE_PARM_DESC(refresh_workers,
+		 "Maximum number of strips that are refreshed concurrently");
+
+static void ws2801_refresh_work(struct work_struct *work)
 {
-	struct ws2801 *ws = data;
-	struct led *leds, *new_leds;
-	unsigned int msecs, num_leds;
-	int err = 0;
+	struct ws2801 *ws = container_of(to_delayed_work(work), struct ws2801,
+					 refresh_work);
+	struct led *new_leds;
+	unsigned int msecs;
+	bool suspended;
+	ktime_t now;
+	s64 idle;
 
-	/* get a local copy of the LEDs. This minimises locked sections */
 	mutex_lock(&ws->data_lock);
-	num_leds = ws->num_leds;
-	leds = kmemdup(ws->leds, num_leds * sizeof(*leds), GFP_KERNEL);
-	if (!leds) {
-		mutex_unlock(&ws->data_lock);
-		return -ENOMEM;
+
+	msecs = ws->refresh_rate;
+	if (!msecs)
+		goto unlock_out;
+
+	/* Only refresh if the strip was idle for a full period. Any
+	 * commit in the meantime postpones the refresh. */
+	now = ktime_get();
+	mutex_lock(&ws->commit_lock);
+	idle = ktime_ms_delta(now, ws->latch_time);
+	suspended = ws->suspended;
+	mutex_unlock(&ws->commit_lock);
+
+	/* Refreshes restart with the next commit that lights the strip */
+	if (suspended)
+		goto unlock_out;
+
+	if (idle < msecs) {
+		/* Early runs after a changed refresh rate are no skips */
+		if (ktime_compare(now, ws->refresh_due) >= 0)
+			ws->refreshes_skipped++;
+		goto requeue_out;
 	}
+
+	/* check if number of LEDs changed */
+	if (ws->num_leds != ws->refresh_num_leds) {
+		new_leds = krealloc(ws->refresh_leds,
+				    ws->num_leds * sizeof(*new_leds),
+				    GFP_KERNEL);
+		if (!new_leds) {
+			dev_err(ws->dev, "refresh: out of memory\n");
+			idle = 0;
+			goto requeue_out;
+		}
+		ws->refresh_leds = new_leds;
+		ws->refresh_num_leds = ws->num_leds;
+	}
+
+	/* Copy the current LED configuration, this minimises locked
+	 * sections */
+	memcpy(ws->refresh_leds, ws->leds,
+	       ws->refresh_num_leds * sizeof(*ws->refresh_leds));
 	mutex_unlock(&ws->data_lock);
 
-	while (1) {
-		if (kthread_should_stop())
-			break;
+	ws2801_commit(ws, ws->refresh_leds, ws->refresh_num_leds);
 
-		if (mutex_lock_interruptible(&ws->data_lock) != 0)
-			continue;
+	mutex_lock(&ws->data_lock);
+	/* The refresh rate might have been disabled in the meantime */
+	msecs = ws->refresh_rate;
+	if (!msecs)
+		goto unlock_out;
+	idle = 0;
 
-		msecs = ws->refresh_rate;
+requeue_out:
+	ws->refresh_due = ktime_add_ms(ktime_get(), msecs - idle);
+	queue_delayed_work(ws2801_wq, &ws->refresh_work,
+			   msecs_to_jiffies(msecs - idle));
+unlock_out:
+	mutex_unlock(&ws->data_lock);
+}
 
-		/* check if number of LEDs changed */
-		if (ws->num_leds != num_leds) {
-			num_leds = ws->num_leds;
-			new_leds = krealloc(leds, num_leds * sizeof(*leds),
-					    GFP_KERNEL);
-			if (!new_leds) {
-				err = -ENOMEM;
-				break;
-			}
-			leds = new_leds;
-		}
+/* Must be called with data_lock held */
+static void ws2801_set_refresh_rate(struct ws2801 *ws,
+				    unsigned int refresh_rate)
+{
+	if (ws->refresh_rate == refresh_rate)
+		return;
 
-		/* copy current LED configuration */
-		memcpy(leds, ws->leds, num_leds * sizeof(*leds));
+	ws->refresh_rate = refresh_rate;
 
-		mutex_unlock(&ws->data_lock);
+	/* A running refresh won't requeue itself once the rate is zero.
+	 * Otherwise, let it pick up the new rate right away. */
+	if (!refresh_rate) {
+		cancel_delayed_work(&ws->refresh_work);
+	} else {
+		ws->refresh_due = ktime_add_ms(ktime_get(), refresh_rate);
+		mod_delayed_work(ws2801_wq, &ws->refresh_work, 0);
+	}
+}
 
-		/* we can now safely update leds without holding the lock */
-		ws2801_commit(ws, leds, num_leds);
+/*
+ * Runtime PM: a device holds a usage reference as long as its LEDs are not
+ * all dark. Once they were dark for the autosuspend delay, refreshes stop and
+ * the regulator is cut. Must be called with data_lock held, but without
+ * commit_lock, before the LEDs are committed.
+ */
+static void ws2801_pm_update(struct ws2801 *ws)
+{
+	bool lit;
+	int err;
 
-		schedule_timeout_interruptible(msecs_to_jiffies(msecs));
+	lit = memchr_inv(ws->leds, 0, ws->num_leds * sizeof(*ws->leds));
+	if (lit == ws->lit)
+		return;
+
+	if (!lit) {
+		ws->lit = false;
+		pm_runtime_mark_last_busy(ws->dev);
+		pm_runtime_put_autosuspend(ws->dev);
+		return;
 	}
 
-	kfree(leds);
+	err = pm_runtime_get_sync(ws->dev);
+	if (err < 0) {
+		dev_err(ws->dev, "resume failed: %d\n", err);
+		pm_runtime_put_noidle(ws->dev);
+		return;
+	}
+	ws->lit = true;
 
-	return err;
+	/* Refreshes stopped if the device was suspended */
+	if (ws->refresh_rate) {
+		ws->refresh_due = ktime_add_ms(ktime_get(), ws->refresh_rate);
+		mod_delayed_work(ws2801_wq, &ws->refresh_work,
+				 msecs_to_jiffies(ws->refresh_rate));
+	}
 }
 
-static int ws2801_set_refresh_rate(struct ws2801 *ws, unsigned int refresh_rate)
+/* Commits the LEDs of the device. Must be called with data_lock held. */
+static void ws2801_commit_leds(struct ws2801 *ws)
 {
-	unsigned int old;
+	ws2801_pm_update(ws);
+	ws2801_commit(ws, ws->leds, ws->num_leds);
+}
 
-	old = ws->refresh_rate;
+/* One line of the set attribute: LEDs first to last get color */
+struct ws2801_set_op {
+	unsigned int first;
+	unsigned int last;
+	struct led color;
+};
 
-	if (old == refresh_rate)
-		return 0;
+static inline const char *ws2801_skip_blanks(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	return p;
+}
 
-	ws->refresh_rate = refresh_rate;
+static const char *ws2801_parse_uint(const char *p, const char *end,
+				     unsigned int *val)
+{
+	const char *start = p;
+	u64 v = 0;
 
-	if (refresh_rate && !old) {
-		/* start kthread */
-		ws->refresh_task = kthread_run(ws2801_refresh_thread, ws,
-					       DRIVER_NAME "-%s", ws->name);
-		if (IS_ERR(ws->refresh_task))
-			return PTR_ERR(ws->refresh_task);
-	} else if (!refresh_rate && old) {
-		/* stop kthread */
-		return kthread_stop(ws->refresh_task);
-	} else {
-		/* notify task that update time has changed */
-		wake_up_process(ws->refresh_task);
+	while (p < end && *p >= '0' && *p <= '9') {
+		v = v * 10 + (*p++ - '0');
+		if (v > UINT_MAX)
+			return NULL;
 	}
 
-	return 0;
+	if (p == start)
+		return NULL;
+
+	*val = v;
+	return p;
 }
 
-static inline int ws2801_sysfs_parse_num_led(const char *str, unsigned int *num,
-				             struct led *led)
+static const char *ws2801_parse_u8(const char *p, const char *end, u8 *val)
 {
-	if (sscanf(str, FORMAT_NUM_LED, num, &led->r, &led->g, &led->b) != 4)
-		return -EINVAL;
+	unsigned int v;
 
-	return 0;
+	p = ws2801_parse_uint(p, end, &v);
+	if (!p || v > U8_MAX)
+		return NULL;
+
+	*val = v;
+	return p;
+}
+
+/*
+ * Parses lines of the form "NUM R G B", "FIRST-LAST R G B", "NUM #rrggbb" or
+ * "FIRST-LAST #rrggbb" in a single pass.  Empty lines are skipped.  Returns
+ * the number of parsed operations or -EINVAL.
+ */
+static int ws2801_parse_set(const char *buf, size_t len,
+			    struct ws2801_set_op *ops, unsigned int max_ops)
+{
+	const char *p = buf, *end = buf + len;
+	struct ws2801_set_op *op;
+	unsigned int num_ops = 0;
+	u8 rgb[3];
+
+	while (p < end) {
+		p = ws2801_skip_blanks(p, end);
+		if (p < end && *p == '\n') {
+			p++;
+			continue;
+		}
+		if (p == end)
+			break;
+
+		if (num_ops == max_ops)
+			return -EINVAL;
+		op = &ops[num_ops++];
+
+		p = ws2801_parse_uint(p, end, &op->first);
+		if (!p)
+			return -EINVAL;
+		op->last = op->first;
+		if (p < end && *p == '-') {
+			p = ws2801_parse_uint(p + 1, end, &op->last);
+			if (!p || op->last < op->first)
+				return -EINVAL;
+		}
+
+		p = ws2801_skip_blanks(p, end);
+		if (p < end && *p == '#') {
+			if (end - p < 7 || hex2bin(rgb, p + 1, 3))
+				return -EINVAL;
+			p += 7;
+		} else {
+			p = ws2801_parse_u8(p, end, &rgb[0]);
+			if (p)
+				p = ws2801_parse_u8(ws2801_skip_blanks(p, end),
+						    end, &rgb[1]);
+			if (p)
+				p = ws2801_parse_u8(ws2801_skip_blanks(p, end),
+						    end, &rgb[2]);
+			if (!p)
+				return -EINVAL;
+		}
+		op->color.r = rgb[0];
+		op->color.g = rgb[1];
+		op->color.b = rgb[2];
+
+		p = ws2801_skip_blanks(p, end);
+		if (p < end) {
+			if (*p != '\n')
+				return -EINVAL;
+			p++;
+		}
+	}
+
+	return num_ops;
 }
 
 static inline int ws2801_sysfs_parse_led(const char *str, struct led *led)
@@ -267,7 +487,7 @@ static ssize_t clear_store(struct kobject *kobj, struct kobj_attribute *attr,
 	mutex_lock(&ws->data_lock);
 	ws2801_clear(ws);
 	if (ws->auto_commit)
-		ws2801_commit(ws, ws->leds, ws->num_leds);
+		ws2801_commit_leds(ws);
 	mutex_unlock(&ws->data_lock);
 
 	return len;
@@ -289,7 +509,7 @@ static ssize_t full_on_store(struct kobject *kobj, struct kobj_attribute *attr,
 	mutex_lock(&ws->data_lock);
 	ws2801_set_leds(ws, &led);
 	if (ws->auto_commit)
-		ws2801_commit(ws, ws->leds, ws->num_leds);
+		ws2801_commit_leds(ws);
 	mutex_unlock(&ws->data_lock);
 
 	return len;
@@ -350,13 +570,10 @@ static ssize_t refresh_rate_store(struct kobject *kobj,
 		return -EINVAL;
 
 	mutex_lock(&ws->data_lock);
-	err = ws2801_set_refresh_rate(ws, refresh_rate);
+	ws2801_set_refresh_rate(ws, refresh_rate);
 	mutex_unlock(&ws->data_lock);
 
-	if (!err)
-		err = len;
-
-	return err;
+	return len;
 }
 
 static ssize_t refresh_rate_show(struct kobject *kobj,
@@ -367,68 +584,142 @@ static ssize_t refresh_rate_show(struct kobject *kobj,
 	return sprintf(buf, "%u\n", ws->refresh_rate);
 }
 
+static ssize_t commit_seq_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	struct ws2801 *ws = container_of(kobj, struct ws2801, kobj);
+
+	return sprintf(buf, "%lu\n", READ_ONCE(ws->commit_seq));
+}
+
+static ssize_t refreshes_skipped_show(struct kobject *kobj,
+				      struct kobj_attribute *attr, char *buf)
+{
+	struct ws2801 *ws = container_of(kobj, struct ws2801, kobj);
+
+	return sprintf(buf, "%lu\n", ws->refreshes_skipped);
+}
+
 ATTR_SHOW_EINVAL(set);
 
 static ssize_t set_store(struct kobject *kobj, struct kobj_attribute *attr,
 			 const char *buf, size_t len)
 {
 	struct ws2801 *ws = container_of(kobj, struct ws2801, kobj);
-	int err;
+	struct ws2801_set_op *ops;
+	unsigned int i, max_ops;
+	int num_ops, err;
+
+	/* The shortest line, "0 0 0 0\n", has eight characters */
+	max_ops = len / 8 + 1;
+	ops = kmalloc_array(max_ops, sizeof(*ops), GFP_KERNEL);
+	if (!ops)
+		return -ENOMEM;
 
-	unsigned int num;
-	struct led led;
+	/* Parse without the lock, so that the refresh thread isn't stalled */
+	num_ops = ws2801_parse_set(buf, len, ops, max_ops);
+	if (num_ops < 0) {
+		err = num_ops;
+		goto free_out;
+	}
 
 	mutex_lock(&ws->data_lock);
 
-	do {
-		err = ws2801_sysfs_parse_num_led(buf, &num, &led);
-		if (err)
-			break;
-		err = ws2801_set_led(ws, num, &led);
-		if (err)
-			break;
+	for (i = 0; i < num_ops; i++)
+		if (ops[i].last >= ws->num_leds) {
+			err = -ERANGE;
+			goto unlock_out;
+		}
 
-		while (*buf && *buf != '\n')
-			buf++;
-		if (*buf) /* skip newline */
-			buf++;
-	} while (*buf);
+	for (i = 0; i < num_ops; i++)
+		ws2801_fill(ws, ops[i].first, ops[i].last, &ops[i].color);
 
-	if (!err) {
-		err = len;
-		if (ws->auto_commit)
-			ws2801_commit(ws, ws->leds, ws->num_leds);
-	}
+	if (ws->auto_commit)
+		ws2801_commit_leds(ws);
 
-	mutex_unlock(&ws->data_lock);
+	err = len;
 
+unlock_out:
+	mutex_unlock(&ws->data_lock);
+free_out:
+	kfree(ops);
 	return err;
 }
 
+static int ws2801_set_raw(struct ws2801 *ws, const char *buf, size_t len)
+{
+	/* Raw data is packed RGB, which is exactly the layout of struct led */
+	BUILD_BUG_ON(sizeof(struct led) != 3);
+
+	if (len != ws->num_leds * sizeof(*ws->leds))
+		return -ERANGE;
+
+	memcpy(ws->leds, buf, len);
+
+	return 0;
+}
+
 ATTR_SHOW_EINVAL(set_raw);
 
 static ssize_t set_raw_store(struct kobject *kobj, struct kobj_attribute *attr,
 			     const char *buf, size_t len)
 {
 	struct ws2801 *ws = container_of(kobj, struct ws2801, kobj);
-	int err, i;
+	int err;
 
-	struct __attribute__((packed)) led *led = (void*)buf;
-	struct led *dst;
+	mutex_lock(&ws->data_lock);
+	err = ws2801_set_raw(ws, buf, len);
+	mutex_unlock(&ws->data_lock);
+
+	return err ? err : len;
+}
+
+ATTR_SHOW_EINVAL(set_raw_commit);
+
+static ssize_t set_raw_commit_store(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    const char *buf, size_t len)
+{
+	struct ws2801 *ws = container_of(kobj, struct ws2801, kobj);
+	int err;
 
 	mutex_lock(&ws->data_lock);
-	dst = ws->leds;
+	err = ws2801_set_raw(ws, buf, len);
+	if (!err)
+		ws2801_commit_leds(ws);
+	mutex_unlock(&ws->data_lock);
 
-	if (len != ws->num_leds * 3 * sizeof(unsigned char)) {
-		err = -ERANGE;
-		goto unlock_out;
-	}
+	return err ? err : len;
+}
 
-	for (i = 0; i < ws->num_leds; i++, led++, dst++) {
-		dst->r = led->r;
-		dst->g = led->g;
-		dst->b = led->b;
-	}
+ATTR_SHOW_EINVAL(update);
+
+static ssize_t update_store(struct kobject *kobj, struct kobj_attribute *attr,
+			    const char *buf, size_t len)
+{
+	struct ws2801 *ws = container_of(kobj, struct ws2801, kobj);
+	const struct ws2801_update *update = (const void *)buf;
+	unsigned int i, num_updates;
+	int err;
+
+	if (len % sizeof(*update))
+		return -EINVAL;
+	num_updates = len / sizeof(*update);
+
+	mutex_lock(&ws->data_lock);
+
+	/* Validate first, so that updates are applied all or nothing */
+	for (i = 0; i < num_updates; i++)
+		if (le32_to_cpu(update[i].num) >= ws->num_leds) {
+			err = -ERANGE;
+			goto unlock_out;
+		}
+
+	for (i = 0; i < num_updates; i++)
+		ws->leds[le32_to_cpu(update[i].num)] = update[i].color;
+
+	if (ws->auto_commit)
+		ws2801_commit_leds(ws);
 
 	err = len;
 
@@ -445,7 +736,7 @@ static ssize_t commit_store(struct kobject *kobj, struct kobj_attribute *attr,
 	struct ws2801 *ws = container_of(kobj, struct ws2801, kobj);
 
 	mutex_lock(&ws->data_lock);
-	ws2801_commit(ws, ws->leds, ws->num_leds);
+	ws2801_commit_leds(ws);
 	mutex_unlock(&ws->data_lock);
 
 	return len;
@@ -454,21 +745,30 @@ static ssize_t commit_store(struct kobject *kobj, struct kobj_attribute *attr,
 static struct kobj_attribute auto_commit_attr = __ATTR_RW(auto_commit);
 static struct kobj_attribute clear_attr = __ATTR_RW(clear);
 static struct kobj_attribute commit_attr = __ATTR_RW(commit);
+static struct kobj_attribute commit_seq_attr = __ATTR_RO(commit_seq);
 static struct kobj_attribute full_on_attr = __ATTR_RW(full_on);
 static struct kobj_attribute num_leds_attr = __ATTR_RW(num_leds);
 static struct kobj_attribute refresh_rate_attr = __ATTR_RW(refresh_rate);
+static struct kobj_attribute refreshes_skipped_attr =
+	__ATTR_RO(refreshes_skipped);
 static struct kobj_attribute set_attr = __ATTR_RW(set);
 static struct kobj_attribute set_raw_attr = __ATTR_RW(set_raw);
+static struct kobj_attribute set_raw_commit_attr = __ATTR_RW(set_raw_commit);
+static struct kobj_attribute update_attr = __ATTR_RW(update);
 
 static struct attribute *ws2801_per_device_attrs[] = {
 	&auto_commit_attr.attr,
 	&clear_attr.attr,
 	&commit_attr.attr,
+	&commit_seq_attr.attr,
 	&full_on_attr.attr,
 	&num_leds_attr.attr,
 	&refresh_rate_attr.attr,
+	&refreshes_skipped_attr.attr,
 	&set_attr.attr,
 	&set_raw_attr.attr,
+	&set_raw_commit_attr.attr,
+	&update_attr.attr,
 	NULL
 };
 
@@ -477,7 +777,173 @@ static struct kobj_type device_type = {
 	.default_attrs = ws2801_per_device_attrs,
 };
 
+/* Lockdep allows for eight levels of nesting */
+#define WS2801_GROUP_MAX 8
+
+/* Skew between the first and the last latch of the last group commit, and
+ * its maximum, in ns. Protected by ws2801_devices_lock. */
+static u64 group_skew_last;
+static u64 group_skew_max;
+
+struct ws2801_shift_work {
+	struct work_struct work;
+	struct ws2801 *ws;
+};
+
+static void ws2801_shift_work(struct work_struct *work)
+{
+	struct ws2801_shift_work *sw = container_of(work,
+						    struct ws2801_shift_work,
+						    work);
+
+	ws2801_shift(sw->ws, sw->ws->leds, sw->ws->num_leds);
+}
+
+static struct ws2801 *ws2801_find(const char *name)
+{
+	struct ws2801 *ws;
+
+	list_for_each_entry(ws, &ws2801_devices, list)
+		if (!strcmp(ws->name, name))
+			return ws;
+
+	return NULL;
+}
+
+/*
+ * Shifts out the LEDs of all given devices in parallel, while their clocks
+ * stay high, and then pulls the clocks low back to back, so that all strips
+ * latch at the same time.
+ */
+static int ws2801_group_commit(struct ws2801 **members, unsigned int num)
+{
+	struct ws2801_shift_work works[WS2801_GROUP_MAX];
+	struct ws2801 *first = NULL, *last = NULL;
+	unsigned int i;
+
+	/* Resuming a device takes its commit_lock */
+	for (i = 0; i < num; i++) {
+		mutex_lock_nested(&members[i]->data_lock, i);
+		ws2801_pm_update(members[i]);
+	}
+
+	for (i = 0; i < num; i++)
+		mutex_lock_nested(&members[i]->commit_lock, i);
+
+	/* Not on ws2801_wq: its workers might wait for our data locks.
+	 * Suspended members are unpowered and left alone. */
+	for (i = 0; i < num; i++) {
+		if (members[i]->suspended)
+			continue;
+		INIT_WORK_ONSTACK(&works[i].work, ws2801_shift_work);
+		works[i].ws = members[i];
+		queue_work(system_unbound_wq, &works[i].work);
+	}
+
+	for (i = 0; i < num; i++) {
+		if (members[i]->suspended)
+			continue;
+		flush_work(&works[i].work);
+		destroy_work_on_stack(&works[i].work);
+	}
+
+	for (i = 0; i < num; i++) {
+		if (!members[i]->suspended) {
+			ws2801_set_latch(members[i]);
+			if (!first)
+				first = members[i];
+			last = members[i];
+		}
+		members[i]->commit_seq++;
+	}
+
+	if (first) {
+		group_skew_last = ktime_to_ns(ktime_sub(last->latch_time,
+							first->latch_time));
+		if (group_skew_last > group_skew_max)
+			group_skew_max = group_skew_last;
+	}
+
+	for (i = num; i-- > 0;) {
+		mutex_unlock(&members[i]->commit_lock);
+		mutex_unlock(&members[i]->data_lock);
+		sysfs_notify(&members[i]->kobj, NULL, "commit_seq");
+	}
+
+	return 0;
+}
+
+static ssize_t group_commit_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t len)
+{
+	struct ws2801 *members[WS2801_GROUP_MAX];
+	unsigned int i, num = 0;
+	char *names, *pos, *name;
+	struct ws2801 *ws;
+	int err = 0;
+
+	names = kstrndup(buf, len, GFP_KERNEL);
+	if (!names)
+		return -ENOMEM;
+
+	mutex_lock(&ws2801_devices_lock);
+
+	pos = names;
+	while ((name = strsep(&pos, " \t\n"))) {
+		if (!*name)
+			continue;
+
+		ws = ws2801_find(name);
+		if (!ws) {
+			err = -ENODEV;
+			goto unlock_out;
+		}
+
+		for (i = 0; i < num; i++)
+			if (members[i] == ws) {
+				err = -EINVAL;
+				goto unlock_out;
+			}
+
+		if (num == WS2801_GROUP_MAX) {
+			err = -E2BIG;
+			goto unlock_out;
+		}
+		members[num++] = ws;
+	}
+
+	if (!num) {
+		err = -EINVAL;
+		goto unlock_out;
+	}
+
+	err = ws2801_group_commit(members, num);
+
+unlock_out:
+	mutex_unlock(&ws2801_devices_lock);
+	kfree(names);
+	return err ? err : len;
+}
+
+static ssize_t group_skew_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	ssize_t ret;
+
+	mutex_lock(&ws2801_devices_lock);
+	ret = sprintf(buf, "%llu %llu\n", group_skew_last, group_skew_max);
+	mutex_unlock(&ws2801_devices_lock);
+
+	return ret;
+}
+
+static DEVICE_ATTR_WO(group_commit);
+static DEVICE_ATTR_RO(group_skew);
+
 static struct attribute *ws2801_sysfs_entries[] = {
+	&dev_attr_group_commit.attr,
+	&dev_attr_group_skew.attr,
 	NULL
 };
 
@@ -514,24 +980,96 @@ static void ws2801_init_clear(struct ws2801 *ws)
 	unsigned int i;
 
 	mutex_lock(&ws->commit_lock);
+	ws2801_wait_latch(ws);
 	for (i = 0; i < INIT_CLEAR_MAX; i++)
 		ws2801_send_led(ws, &blank_led);
 	ws2801_set_latch(ws);
+	ws->commit_seq++;
 	mutex_unlock(&ws->commit_lock);
+
+	/* Wake up pollers of commit_seq */
+	sysfs_notify(&ws->kobj, NULL, "commit_seq");
 }
 
+static int ws2801_runtime_suspend(struct device *dev)
+{
+	struct ws2801 *ws = dev_get_drvdata(dev);
+
+	mutex_lock(&ws->commit_lock);
+	ws->suspended = true;
+	/* Don't feed the unpowered chips through their inputs */
+	gpiod_set_value(ws->clk, 0);
+	gpiod_set_value(ws->data, 0);
+	mutex_unlock(&ws->commit_lock);
+
+	/* A running refresh sees the suspended device and won't requeue */
+	cancel_delayed_work(&ws->refresh_work);
+
+	if (!IS_ERR(ws->regulator))
+		return regulator_disable(ws->regulator);
+
+	return 0;
+}
+
+static int ws2801_runtime_resume(struct device *dev)
+{
+	struct ws2801 *ws = dev_get_drvdata(dev);
+	int err;
+
+	if (!IS_ERR(ws->regulator)) {
+		err = regulator_enable(ws->regulator);
+		if (err)
+			return err;
+	}
+
+	mutex_lock(&ws->commit_lock);
+	ws->suspended = false;
+	mutex_unlock(&ws->commit_lock);
+
+	/* Freshly powered chips show random colors */
+	ws2801_init_clear(ws);
+
+	return 0;
+}
+
+static const struct dev_pm_ops ws2801_pm_ops = {
+	SET_RUNTIME_PM_OPS(ws2801_runtime_suspend, ws2801_runtime_resume, NULL)
+};
+
 static int ws2801_remove(struct platform_device *pdev)
 {
 	struct ws2801 *ws = platform_get_drvdata(pdev);
 	int err;
 
+	mutex_lock(&ws2801_devices_lock);
+	list_del(&ws->list);
+	mutex_unlock(&ws2801_devices_lock);
+
 	mutex_lock(&ws->data_lock);
-	err = ws2801_set_refresh_rate(ws, 0);
-	ws2801_init_clear(ws);
+	ws2801_set_refresh_rate(ws, 0);
 	mutex_unlock(&ws->data_lock);
+	cancel_delayed_work_sync(&ws->refresh_work);
+	kfree(ws->refresh_leds);
+
+	/* Power the strip up for the final blanking, and keep it that way */
+	pm_runtime_get_sync(ws->dev);
+	pm_runtime_disable(ws->dev);
+	pm_runtime_dont_use_autosuspend(ws->dev);
+	pm_runtime_put_noidle(ws->dev);
+	if (ws->lit)
+		pm_runtime_put_noidle(ws->dev);
+
+	/* If the resume failed, the strip is already unpowered */
+	err = 0;
+	if (!ws->suspended) {
+		mutex_lock(&ws->data_lock);
+		ws2801_init_clear(ws);
+		mutex_unlock(&ws->data_lock);
 
-	if (!IS_ERR(ws->regulator))
-		err = regulator_disable(ws->regulator);
+		if (!IS_ERR(ws->regulator))
+			err = regulator_disable(ws->regulator);
+	}
+	pm_runtime_set_suspended(ws->dev);
 
 	return err;
 }
@@ -541,7 +1079,7 @@ static int ws2801_probe(struct platform_device *pdev)
 	struct ws2801 *ws;
 	struct device *dev = &pdev->dev;
 	int i, err;
-	unsigned int refresh_rate;
+	unsigned int refresh_rate, idle_timeout;
 
 	ws = devm_kzalloc(dev, sizeof(*ws), GFP_KERNEL);
 	if (!ws)
@@ -551,6 +1089,7 @@ static int ws2801_probe(struct platform_device *pdev)
 
 	mutex_init(&ws->data_lock);
 	mutex_init(&ws->commit_lock);
+	INIT_DELAYED_WORK(&ws->refresh_work, ws2801_refresh_work);
 
 	i = of_property_read_u32(dev->of_node, "num-leds", &ws->num_leds);
 	if (i) {
@@ -567,6 +1106,10 @@ static int ws2801_probe(struct platform_device *pdev)
 			 i, refresh_rate);
 	}
 
+	i = of_property_read_u32(dev->of_node, "idle-timeout", &idle_timeout);
+	if (i)
+		idle_timeout = WS2801_DEFAULT_IDLE_TIMEOUT;
+
 	ws->leds = devm_kzalloc(dev, ws->num_leds * sizeof(struct led),
 				GFP_KERNEL);
 	if (!ws->leds)
@@ -607,12 +1150,29 @@ static int ws2801_probe(struct platform_device *pdev)
 				return err;
 	}
 
-	ws2801_init_clear(ws);
+	/* Blanking takes a while and is visible. Skip it if the strip is
+	 * known to be in a sane state, e.g. after reloading the module. */
+	if (!of_property_read_bool(dev->of_node, "skip-init-clear"))
+		ws2801_init_clear(ws);
 
+	mutex_lock(&ws->data_lock);
 	ws2801_set_refresh_rate(ws, refresh_rate);
+	mutex_unlock(&ws->data_lock);
 
 	platform_set_drvdata(pdev, ws);
 
+	/* The strip is dark, so the idle timer starts right away */
+	pm_runtime_set_active(dev);
+	pm_runtime_set_autosuspend_delay(dev, idle_timeout);
+	pm_runtime_use_autosuspend(dev);
+	pm_runtime_enable(dev);
+	pm_runtime_mark_last_busy(dev);
+	pm_request_autosuspend(dev);
+
+	mutex_lock(&ws2801_devices_lock);
+	list_add_tail(&ws->list, &ws2801_devices);
+	mutex_unlock(&ws2801_devices_lock);
+
 	return 0;
 }
 
@@ -629,6 +1189,7 @@ static struct platform_driver ws2801_driver = {
 		.driver = {
 				.name = DRIVER_NAME,
 				.of_match_table = of_ws2801_match,
+				.pm = &ws2801_pm_ops,
 		},
 };
 
@@ -644,12 +1205,21 @@ static int __init ws2801_module_init(void)
 	if (err)
 		goto dev_out;
 
+	ws2801_wq = alloc_workqueue(DRIVER_NAME, WQ_UNBOUND, refresh_workers);
+	if (!ws2801_wq) {
+		err = -ENOMEM;
+		goto sysfs_unreg;
+	}
+
 	err = platform_driver_register(&ws2801_driver);
 	if (err)
-		goto sysfs_unreg;
+		goto wq_out;
 
 	return 0;
 
+wq_out:
+	destroy_workqueue(ws2801_wq);
+
 sysfs_unreg:
 	ws2801_sysfs_exit(ws2801_dev);
 
@@ -662,6 +1232,7 @@ dev_out:
 static void __exit ws2801_module_exit(void)
 {
 	platform_driver_unregister(&ws2801_driver);
+	destroy_workqueue(ws2801_wq);
 	ws2801_sysfs_exit(ws2801_dev);
 	root_device_unregister(ws2801_dev);
 }
@@ -669,5 +1240,9 @@ static void __exit ws2801_module_exit(void)
 module_init(ws2801_module_init);
 module_exit(ws2801_module_exit);
 
+#ifdef WS2801_KUNIT_TEST
+#include "ws2801-test.c"
+#endif
+
 MODULE_AUTHOR("Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>");
 MODULE_LICENSE("GPL");
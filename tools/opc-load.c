@@ -0,0 +1,196 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+/* Open Pixel Control load generator. Sends 'set pixel colors' messages to an
+ * OPC server as fast as possible, or at a given rate, and reports the
+ * sustained message rate. */
+
+#define OPC_DEFAULT_PORT 7890
+#define OPC_HEADER_LEN 4
+
+#define DEFAULT_NUM_LEDS 100
+#define DEFAULT_DURATION 10
+
+static void __attribute__((noreturn)) usage(int exit_code)
+{
+	FILE *s;
+
+	if (exit_code)
+		s = stderr;
+	else
+		s = stdout;
+
+	fprintf(s, "Usage: [ -a ADDRESS (127.0.0.1) ]\n"
+		   "       [ -p PORT (%u) ]\n"
+		   "       [ -c NUM_CHANNELS (1) ]\n"
+		   "       [ -n NUM_LEDS (%u) ]\n"
+		   "       [ -r MESSAGES_PER_SECOND (0: unlimited) ]\n"
+		   "       [ -t SECONDS (%u) ]\n"
+		   "       [ -h ]\n",
+		   OPC_DEFAULT_PORT, DEFAULT_NUM_LEDS, DEFAULT_DURATION);
+
+	exit(exit_code);
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(unsigned long long ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR);
+}
+
+static int write_all(int fd, const unsigned char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, buf, len);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int num_leds = DEFAULT_NUM_LEDS, duration = DEFAULT_DURATION;
+	unsigned int channels = 1, rate = 0, len, i;
+	unsigned long long start, next, last_report, now, sent, sent_report;
+	const char *address = "127.0.0.1";
+	unsigned short port = OPC_DEFAULT_PORT;
+	struct sockaddr_in addr;
+	unsigned char *msg;
+	int fd, option, err, one = 1;
+
+	while ((option = getopt(argc, argv, "a:p:c:n:r:t:h")) != -1) {
+		switch (option) {
+			case 'a':
+				address = optarg;
+				break;
+			case 'p':
+				port = atoi(optarg);
+				break;
+			case 'c':
+				channels = atoi(optarg);
+				break;
+			case 'n':
+				num_leds = atoi(optarg);
+				break;
+			case 'r':
+				rate = atoi(optarg);
+				break;
+			case 't':
+				duration = atoi(optarg);
+				break;
+			case 'h':
+				usage(0);
+			default:
+				usage(-1);
+		}
+	}
+
+	len = num_leds * 3;
+	if (!channels || channels > 255 || len > 0xffff)
+		usage(-EINVAL);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, address, &addr.sin_addr) != 1)
+		usage(-EINVAL);
+
+	msg = malloc(OPC_HEADER_LEN + len);
+	if (!msg)
+		return -ENOMEM;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		err = -errno;
+		fprintf(stderr, "connecting to %s:%u: %s\n", address, port,
+			strerror(-err));
+		goto free_out;
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	msg[1] = 0; /* set pixel colors */
+	msg[2] = len >> 8;
+	msg[3] = len & 0xff;
+
+	err = 0;
+	sent = sent_report = 0;
+	start = last_report = next = now = now_ns();
+	do {
+		if (rate) {
+			sleep_until(next);
+			next += 1000000000ULL / rate;
+		}
+
+		msg[0] = sent % channels + 1;
+		for (i = 0; i < len; i++)
+			msg[OPC_HEADER_LEN + i] = sent + i;
+
+		err = write_all(fd, msg, OPC_HEADER_LEN + len);
+		if (err) {
+			fprintf(stderr, "sending: %s\n", strerror(-err));
+			break;
+		}
+		sent++;
+
+		now = now_ns();
+		if (now - last_report >= 1000000000ULL) {
+			printf("%llu messages/s\n", (sent - sent_report) *
+			       1000000000ULL / (now - last_report));
+			sent_report = sent;
+			last_report = now;
+		}
+	} while (now - start < duration * 1000000000ULL);
+
+	printf("sent %llu messages in %us, %llu messages/s\n", sent, duration,
+	       sent * 1000000000ULL / (now - start));
+
+	close(fd);
+
+free_out:
+	free(msg);
+	return err;
+}
@@ -0,0 +1,112 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <ws2801.h>
+
+#include "strip.h"
+
+/* Typical current of one WS2801 channel at full intensity */
+#define CHANNEL_MA 20
+
+static int strip_open_gpio(const char *spec, struct ws2801_driver *ws)
+{
+	struct ws2801_rt rt = {
+		.cpu = -1,
+		.lock_memory = true,
+	};
+	struct ws2801_power_limit limit = {
+		.r_ma = CHANNEL_MA,
+		.g_ma = CHANNEL_MA,
+		.b_ma = CHANNEL_MA,
+	};
+	unsigned int chip, num_leds;
+	int clk, data, err, n = 0;
+	char state[256] = "";
+	bool use_rt = false;
+	size_t len;
+
+	if (sscanf(spec, "gpio:%u:%d:%d:%u%n", &chip, &clk, &data, &num_leds,
+		   &n) != 4)
+		return -EINVAL;
+
+	/* Options are appended as :KEY=VALUE */
+	for (spec += n; *spec == ':'; spec += len) {
+		spec++;
+		len = strcspn(spec, ":");
+		if (!strncmp(spec, "rt=", 3)) {
+			n = 0;
+			if (sscanf(spec + 3, "%d%n@%d%n", &rt.priority, &n,
+				   &rt.cpu, &n) < 1 || n != len - 3)
+				return -EINVAL;
+			use_rt = true;
+		} else if (!strncmp(spec, "state=", 6)) {
+			if (len - 6 >= sizeof(state))
+				return -EINVAL;
+			memcpy(state, spec + 6, len - 6);
+			state[len - 6] = 0;
+		} else if (!strncmp(spec, "limit=", 6)) {
+			n = 0;
+			if (sscanf(spec + 6, "%u%n", &limit.budget_ma, &n) != 1 ||
+			    n != len - 6)
+				return -EINVAL;
+		} else {
+			return -EINVAL;
+		}
+	}
+	if (*spec)
+		return -EINVAL;
+
+	if (*state)
+		err = ws2801_user_attach(num_leds, chip, clk, data, state, ws);
+	else
+		err = ws2801_user_init(num_leds, chip, clk, data, ws);
+	if (err)
+		return err;
+
+	if (limit.budget_ma) {
+		err = ws->set_power_limit(ws, &limit);
+		if (err)
+			goto free_out;
+	}
+
+	if (use_rt) {
+		err = ws2801_user_set_rt(ws, &rt);
+		if (err)
+			goto free_out;
+	}
+
+	return 0;
+
+free_out:
+	ws->free(ws);
+	return err;
+}
+
+int strip_open(const char *spec, struct ws2801_driver *ws)
+{
+	unsigned int num_leds;
+	char name[64];
+
+	if (!strncmp(spec, "gpio:", 5))
+		return strip_open_gpio(spec, ws);
+
+	if (sscanf(spec, "kernel:%63[^:]:%u", name, &num_leds) == 2)
+		return ws2801_kernel_init(num_leds, name, ws);
+
+	if (sscanf(spec, "daemon:%63s", name) == 1)
+		return ws2801_shm_init(NULL, name, ws);
+
+	return -EINVAL;
+}
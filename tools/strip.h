@@ -0,0 +1,25 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#define STRIP_USAGE \
+	"STRIP is one of\n" \
+	"    gpio:CHIP_ID:CLK_GPIO_ID:DATA_GPIO_ID:NUM_LEDS[:rt=PRIO[@CPU]]" \
+	"[:state=FILE]\n" \
+	"        [:limit=MA (dim frames above MA, 20mA per channel)]\n" \
+	"    kernel:DEVICE_NAME:NUM_LEDS\n" \
+	"    daemon:STRIP_NAME\n"
+
+/* Initialises a driver instance from a textual strip description.
+ *
+ * Returns 0 on success, and negative values in error cases.
+ */
+int strip_open(const char *spec, struct ws2801_driver *ws);
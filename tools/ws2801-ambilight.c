@@ -0,0 +1,403 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/videodev2.h>
+#include <ws2801.h>
+
+#include "strip.h"
+
+#define NUM_BUFFERS 4
+
+struct buffer {
+	void *start;
+	size_t length;
+};
+
+static volatile sig_atomic_t stop;
+
+static bool verbose;
+static unsigned long stat_frames;
+static unsigned long long stat_latency_sum, stat_latency_max, last_report;
+
+static void __attribute__((noreturn)) usage(int exit_code)
+{
+	FILE *s;
+
+	if (exit_code)
+		s = stderr;
+	else
+		s = stdout;
+
+	fprintf(s, "Usage: -s STRIP -e LEFT:TOP:RIGHT:BOTTOM [ -f FORMAT ] "
+		   "[ -W WIDTH ] [ -H HEIGHT ]\n"
+		   "       [ -d DEPTH ] [ -m SMOOTHING ] [ -v ] [ -h ] INPUT\n"
+		   "       -e: number of LEDs on each edge of the screen\n"
+		   "       -f: rgb24 or yuyv (default)\n"
+		   "       -W, -H: frame size (1920x1080)\n"
+		   "       -d: depth of the regions in percent of the screen "
+		   "(10)\n"
+		   "       -m: temporal smoothing, 0 (off) to 255 (0)\n"
+		   "       -v: print statistics once per second\n"
+		   "INPUT is a V4L2 capture device, or a file or pipe with raw "
+		   "frames ('-' for stdin)\n"
+		   STRIP_USAGE);
+
+	exit(exit_code);
+}
+
+static void handle_signal(int sig)
+{
+	stop = 1;
+}
+
+static unsigned long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static int submit(struct ws2801_ambi *ambi, const void *frame, size_t len,
+		  unsigned long long received)
+{
+	unsigned long long latency, now;
+	int err;
+
+	err = ws2801_ambi_submit(ambi, frame, len);
+	if (err)
+		return err;
+
+	now = now_us();
+	latency = now - received;
+	stat_latency_sum += latency;
+	if (latency > stat_latency_max)
+		stat_latency_max = latency;
+	stat_frames++;
+
+	if (verbose && now - last_report >= 1000000) {
+		printf("%llu frames/s, latency avg %llu us, max %llu us\n",
+		       stat_frames * 1000000ULL / (now - last_report),
+		       stat_latency_sum / stat_frames, stat_latency_max);
+		stat_frames = 0;
+		stat_latency_sum = stat_latency_max = 0;
+		last_report = now;
+	}
+
+	return 0;
+}
+
+static int run_raw(int fd, struct ws2801_ambi *ambi, size_t frame_size)
+{
+	unsigned char *frame;
+	size_t got = 0;
+	ssize_t ret;
+	int err = 0;
+
+	frame = malloc(frame_size);
+	if (!frame)
+		return -ENOMEM;
+
+	while (!stop) {
+		ret = read(fd, frame + got, frame_size - got);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			err = -errno;
+			break;
+		}
+		/* A partial frame at the end of the input is dropped */
+		if (!ret)
+			break;
+
+		got += ret;
+		if (got < frame_size)
+			continue;
+
+		got = 0;
+		err = submit(ambi, frame, frame_size, now_us());
+		if (err)
+			break;
+	}
+
+	free(frame);
+	return err;
+}
+
+static int xioctl(int fd, unsigned long request, void *arg)
+{
+	int ret;
+
+	do
+		ret = ioctl(fd, request, arg);
+	while (ret == -1 && errno == EINTR && !stop);
+
+	return ret == -1 ? -errno : 0;
+}
+
+/*
+ * Negotiates the format with the device. The driver may adjust the frame
+ * size and the line padding, cfg is updated accordingly.
+ */
+static int v4l2_setup(int fd, struct ws2801_ambi_config *cfg)
+{
+	struct v4l2_capability cap;
+	struct v4l2_format fmt;
+	int err;
+
+	err = xioctl(fd, VIDIOC_QUERYCAP, &cap);
+	if (err)
+		return err;
+
+	if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) ||
+	    !(cap.capabilities & V4L2_CAP_STREAMING))
+		return -ENODEV;
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fmt.fmt.pix.width = cfg->width;
+	fmt.fmt.pix.height = cfg->height;
+	fmt.fmt.pix.field = V4L2_FIELD_NONE;
+	if (cfg->format == WS2801_FORMAT_YUYV)
+		fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+	else
+		fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_RGB24;
+
+	err = xioctl(fd, VIDIOC_S_FMT, &fmt);
+	if (err)
+		return err;
+
+	if (fmt.fmt.pix.pixelformat != (cfg->format == WS2801_FORMAT_YUYV ?
+					V4L2_PIX_FMT_YUYV : V4L2_PIX_FMT_RGB24))
+		return -EINVAL;
+
+	cfg->width = fmt.fmt.pix.width;
+	cfg->height = fmt.fmt.pix.height;
+	cfg->stride = fmt.fmt.pix.bytesperline;
+
+	return 0;
+}
+
+static int run_v4l2(int fd, struct ws2801_ambi *ambi)
+{
+	struct v4l2_requestbuffers req;
+	struct buffer buffers[NUM_BUFFERS];
+	enum v4l2_buf_type type;
+	struct v4l2_buffer buf;
+	unsigned int i, num_buffers = 0;
+	int err;
+
+	memset(&req, 0, sizeof(req));
+	req.count = NUM_BUFFERS;
+	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	req.memory = V4L2_MEMORY_MMAP;
+	err = xioctl(fd, VIDIOC_REQBUFS, &req);
+	if (err)
+		return err;
+
+	if (!req.count)
+		return -ENOMEM;
+
+	for (i = 0; i < req.count && i < NUM_BUFFERS; i++) {
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+		err = xioctl(fd, VIDIOC_QUERYBUF, &buf);
+		if (err)
+			goto unmap_out;
+
+		buffers[i].length = buf.length;
+		buffers[i].start = mmap(NULL, buf.length, PROT_READ,
+					MAP_SHARED, fd, buf.m.offset);
+		if (buffers[i].start == MAP_FAILED) {
+			err = -errno;
+			goto unmap_out;
+		}
+		num_buffers++;
+
+		err = xioctl(fd, VIDIOC_QBUF, &buf);
+		if (err)
+			goto unmap_out;
+	}
+
+	type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	err = xioctl(fd, VIDIOC_STREAMON, &type);
+	if (err)
+		goto unmap_out;
+
+	while (!stop) {
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		err = xioctl(fd, VIDIOC_DQBUF, &buf);
+		if (err)
+			break;
+
+		/* Corrupted frames are skipped, not shown */
+		if (!(buf.flags & V4L2_BUF_FLAG_ERROR))
+			err = submit(ambi, buffers[buf.index].start,
+				     buf.bytesused, now_us());
+		if (!err)
+			err = xioctl(fd, VIDIOC_QBUF, &buf);
+		if (err)
+			break;
+	}
+	if (err == -EINTR)
+		err = 0;
+
+	xioctl(fd, VIDIOC_STREAMOFF, &type);
+
+unmap_out:
+	for (i = 0; i < num_buffers; i++)
+		munmap(buffers[i].start, buffers[i].length);
+
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	struct ws2801_ambi_config cfg = {
+		.width = 1920,
+		.height = 1080,
+		.format = WS2801_FORMAT_YUYV,
+		.depth = 10,
+	};
+	const char *strip = NULL, *input;
+	bool have_edges = false, v4l2;
+	struct ws2801_driver ws;
+	struct ws2801_ambi ambi;
+	int option, err, fd;
+	struct stat st;
+
+	while ((option = getopt(argc, argv, "s:e:f:W:H:d:m:vh")) != -1) {
+		switch (option) {
+			case 's':
+				strip = optarg;
+				break;
+			case 'e':
+				if (sscanf(optarg, "%u:%u:%u:%u", &cfg.left,
+					   &cfg.top, &cfg.right,
+					   &cfg.bottom) != 4)
+					usage(-EINVAL);
+				have_edges = true;
+				break;
+			case 'f':
+				if (!strcmp(optarg, "rgb24"))
+					cfg.format = WS2801_FORMAT_RGB24;
+				else if (!strcmp(optarg, "yuyv"))
+					cfg.format = WS2801_FORMAT_YUYV;
+				else
+					usage(-EINVAL);
+				break;
+			case 'W':
+				cfg.width = atoi(optarg);
+				break;
+			case 'H':
+				cfg.height = atoi(optarg);
+				break;
+			case 'd':
+				cfg.depth = atoi(optarg);
+				break;
+			case 'm':
+				cfg.smoothing = atoi(optarg);
+				break;
+			case 'v':
+				verbose = true;
+				break;
+			case 'h':
+				usage(0);
+			default:
+				usage(-1);
+		}
+	}
+
+	if (!strip || !have_edges || optind != argc - 1)
+		usage(-EINVAL);
+
+	input = argv[optind];
+	if (!strcmp(input, "-"))
+		fd = STDIN_FILENO;
+	else
+		fd = open(input, O_RDONLY);
+	if (fd == -1) {
+		err = -errno;
+		fprintf(stderr, "opening %s: %s\n", input, strerror(-err));
+		return err;
+	}
+
+	err = fstat(fd, &st) ? -errno : 0;
+	if (err)
+		goto close_out;
+
+	v4l2 = S_ISCHR(st.st_mode);
+	if (v4l2) {
+		err = v4l2_setup(fd, &cfg);
+		if (err) {
+			fprintf(stderr, "setting up %s: %s\n", input,
+				strerror(-err));
+			goto close_out;
+		}
+	}
+
+	err = strip_open(strip, &ws);
+	if (err) {
+		fprintf(stderr, "initialising strip %s: %s\n", strip,
+			strerror(-err));
+		goto close_out;
+	}
+
+	err = ws2801_ambi_init(&ambi, &ws, &cfg);
+	if (err) {
+		fprintf(stderr, "initialising ambient light: %s\n",
+			strerror(-err));
+		goto free_out;
+	}
+
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+
+	last_report = now_us();
+	if (v4l2)
+		err = run_v4l2(fd, &ambi);
+	else
+		err = run_raw(fd, &ambi, (size_t)cfg.height *
+			      (cfg.stride ? cfg.stride :
+			       cfg.width * (cfg.format == WS2801_FORMAT_YUYV ?
+					    2 : 3)));
+	if (err)
+		fprintf(stderr, "reading %s: %s\n", input, strerror(-err));
+
+	ws2801_ambi_free(&ambi);
+
+free_out:
+	ws.free(&ws);
+
+close_out:
+	if (fd != STDIN_FILENO)
+		close(fd);
+
+	return err;
+}
@@ -0,0 +1,328 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <ws2801.h>
+
+#include "strip.h"
+
+#define WAV_FORMAT_PCM 1
+
+static volatile sig_atomic_t stop;
+
+static void __attribute__((noreturn)) usage(int exit_code)
+{
+	FILE *s;
+
+	if (exit_code)
+		s = stderr;
+	else
+		s = stdout;
+
+	fprintf(s, "Usage: -s STRIP [ -r RATE ] [ -c CHANNELS ] [ -p PERIOD ] "
+		   "[ -n FFT_SIZE ]\n"
+		   "       [ -b BANDS ] [ -a ATTACK ] [ -d DECAY ] [ -v ] [ -h ] "
+		   "INPUT\n"
+		   "       -r, -c: format of raw input (48000 Hz, 2 channels)\n"
+		   "       -p: samples per period, a frame is rendered every "
+		   "period (256)\n"
+		   "       -n: samples per transform, a power of two (1024)\n"
+		   "       -b: number of frequency bands (8)\n"
+		   "       -a, -d: attack and decay time in ms (10, 150)\n"
+		   "       -v: print statistics once per second\n"
+		   "INPUT is a WAV file, played in real time, or '-' for raw "
+		   "signed 16 bit\nlittle endian PCM on stdin, e.g. from "
+		   "arecord\n"
+		   STRIP_USAGE);
+
+	exit(exit_code);
+}
+
+static void handle_signal(int sig)
+{
+	stop = 1;
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(unsigned long long ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR && !stop)
+		;
+}
+
+/* Reads exactly len bytes. Returns 0 on EOF, and len on success. */
+static ssize_t read_full(int fd, void *buf, size_t len)
+{
+	size_t got = 0;
+	ssize_t ret;
+
+	while (got < len) {
+		ret = read(fd, (char *)buf + got, len - got);
+		if (ret < 0) {
+			if (errno == EINTR && !stop)
+				continue;
+			return -errno;
+		}
+		if (!ret)
+			return 0;
+		got += ret;
+	}
+
+	return got;
+}
+
+static uint32_t le32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t le16(const unsigned char *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+/* Skips to the samples of a 16 bit PCM WAV file */
+static int wav_open(int fd, unsigned int *rate, unsigned int *channels)
+{
+	unsigned char hdr[16], chunk[8];
+	bool have_format = false;
+	uint32_t size;
+	ssize_t ret;
+
+	ret = read_full(fd, hdr, 12);
+	if (ret <= 0)
+		return ret ? ret : -EINVAL;
+
+	if (memcmp(hdr, "RIFF", 4) || memcmp(hdr + 8, "WAVE", 4))
+		return -EINVAL;
+
+	for (;;) {
+		ret = read_full(fd, chunk, sizeof(chunk));
+		if (ret <= 0)
+			return ret ? ret : -EINVAL;
+		/* Chunks are padded to an even size */
+		size = le32(chunk + 4) + (le32(chunk + 4) & 1);
+
+		if (!memcmp(chunk, "data", 4))
+			return have_format ? 0 : -EINVAL;
+
+		if (!memcmp(chunk, "fmt ", 4) && size >= 16) {
+			ret = read_full(fd, hdr, 16);
+			if (ret <= 0)
+				return ret ? ret : -EINVAL;
+			if (le16(hdr) != WAV_FORMAT_PCM ||
+			    le16(hdr + 14) != 16)
+				return -ENOTSUP;
+			*channels = le16(hdr + 2);
+			*rate = le32(hdr + 4);
+			have_format = true;
+			size -= 16;
+		}
+
+		if (lseek(fd, size, SEEK_CUR) == -1)
+			return -errno;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct ws2801_audio_config cfg = {
+		.rate = 48000,
+		.fft_size = 1024,
+		.hop = 256,
+		.num_bands = 8,
+		.min_freq = 40,
+		.max_freq = 16000,
+		.attack_ms = 10,
+		.decay_ms = 150,
+	};
+	unsigned long long start, now, last_report, latency_sum = 0;
+	unsigned int channels = 2, i, c, frames = 0;
+	short *interleaved = NULL, *mono = NULL;
+	unsigned long long played = 0;
+	const char *strip = NULL;
+	struct ws2801_audio audio;
+	struct ws2801_driver ws;
+	bool wav, verbose = false;
+	int option, err, fd, sum;
+	ssize_t ret;
+
+	while ((option = getopt(argc, argv, "s:r:c:p:n:b:a:d:vh")) != -1) {
+		switch (option) {
+			case 's':
+				strip = optarg;
+				break;
+			case 'r':
+				cfg.rate = atoi(optarg);
+				break;
+			case 'c':
+				channels = atoi(optarg);
+				break;
+			case 'p':
+				cfg.hop = atoi(optarg);
+				break;
+			case 'n':
+				cfg.fft_size = atoi(optarg);
+				break;
+			case 'b':
+				cfg.num_bands = atoi(optarg);
+				break;
+			case 'a':
+				cfg.attack_ms = atoi(optarg);
+				break;
+			case 'd':
+				cfg.decay_ms = atoi(optarg);
+				break;
+			case 'v':
+				verbose = true;
+				break;
+			case 'h':
+				usage(0);
+			default:
+				usage(-1);
+		}
+	}
+
+	if (!strip || optind != argc - 1)
+		usage(-EINVAL);
+
+	wav = strcmp(argv[optind], "-");
+	if (wav) {
+		fd = open(argv[optind], O_RDONLY);
+		if (fd == -1) {
+			err = -errno;
+			fprintf(stderr, "opening %s: %s\n", argv[optind],
+				strerror(-err));
+			return err;
+		}
+
+		err = wav_open(fd, &cfg.rate, &channels);
+		if (err) {
+			fprintf(stderr, "reading %s: %s\n", argv[optind],
+				strerror(-err));
+			goto close_out;
+		}
+	} else {
+		fd = STDIN_FILENO;
+	}
+
+	err = -EINVAL;
+	if (!channels || !cfg.hop || cfg.max_freq > cfg.rate / 2)
+		goto close_out;
+
+	err = -ENOMEM;
+	interleaved = calloc(cfg.hop * channels, sizeof(*interleaved));
+	mono = calloc(cfg.hop, sizeof(*mono));
+	if (!interleaved || !mono)
+		goto close_out;
+
+	err = strip_open(strip, &ws);
+	if (err) {
+		fprintf(stderr, "initialising strip %s: %s\n", strip,
+			strerror(-err));
+		goto close_out;
+	}
+
+	err = ws2801_audio_init(&audio, &ws, &cfg);
+	if (err) {
+		fprintf(stderr, "initialising visualiser: %s\n",
+			strerror(-err));
+		goto free_out;
+	}
+
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+
+	start = last_report = now_ns();
+	while (!stop) {
+		ret = read_full(fd, interleaved,
+				cfg.hop * channels * sizeof(*interleaved));
+		if (ret <= 0) {
+			err = ret;
+			break;
+		}
+
+		/* Files are paced as if they were captured right now */
+		played += cfg.hop;
+		if (wav)
+			sleep_until(start + played * 1000000000ULL / cfg.rate);
+
+		/* Downmix to mono */
+		for (i = 0; i < cfg.hop; i++) {
+			for (c = 0, sum = 0; c < channels; c++)
+				sum += (short)le16((unsigned char *)
+						   (interleaved + i * channels +
+						    c));
+			mono[i] = sum / (int)channels;
+		}
+
+		err = ws2801_audio_feed(&audio, mono, cfg.hop, now_ns());
+		if (err < 0)
+			break;
+		if (err) {
+			frames++;
+			latency_sum += audio.latency_last;
+		}
+		err = 0;
+
+		now = now_ns();
+		if (verbose && now - last_report >= 1000000000ULL) {
+			printf("%llu frames/s, latency avg %llu us, "
+			       "max %llu us\n",
+			       frames * 1000000000ULL / (now - last_report),
+			       frames ? latency_sum / frames / 1000 : 0,
+			       audio.latency_max / 1000);
+			frames = 0;
+			latency_sum = 0;
+			audio.latency_max = 0;
+			last_report = now;
+		}
+	}
+	if (err)
+		fprintf(stderr, "reading %s: %s\n", argv[optind],
+			strerror(-err));
+
+	ws2801_audio_free(&audio);
+
+free_out:
+	ws.free(&ws);
+
+close_out:
+	free(mono);
+	free(interleaved);
+	if (fd != STDIN_FILENO)
+		close(fd);
+
+	return err;
+}
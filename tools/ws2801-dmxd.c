@@ -0,0 +1,449 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <ws2801.h>
+
+#include "strip.h"
+
+#define E131_PORT 5568
+#define ARTNET_PORT 6454
+
+#define DMX_CHANNELS 512
+#define LEDS_PER_UNIVERSE (DMX_CHANNELS / 3)
+#define MAX_UNIVERSES_PER_STRIP 64
+
+#define MAX_STRIPS 32
+#define BATCH_SIZE 32
+#define PACKET_MAX 640
+
+/* E1.31 (sACN) */
+#define E131_VECTOR_ROOT_DATA 0x00000004
+#define E131_VECTOR_ROOT_EXTENDED 0x00000008
+#define E131_VECTOR_DATA_PACKET 0x00000002
+#define E131_VECTOR_EXTENDED_SYNC 0x00000001
+#define E131_VECTOR_DMP_SET_PROPERTY 0x02
+#define E131_OPT_PREVIEW 0x80
+#define E131_SYNC_LEN 49
+#define E131_DATA_OFFSET 126
+
+/* Art-Net */
+#define ARTNET_OP_DMX 0x5000
+#define ARTNET_OP_SYNC 0x5200
+#define ARTNET_DATA_OFFSET 18
+/* ArtSync is only honoured if it was seen within the last four seconds */
+#define ARTNET_SYNC_TIMEOUT 4
+/* E1.31 sync addresses are 16 bit, so this one never collides */
+#define ARTNET_SYNC_ADDRESS 0x10000
+
+struct strip {
+	struct ws2801_driver ws;
+	unsigned int universe;
+	unsigned int num_universes;
+	unsigned long long received;
+	unsigned int sync_address;
+	bool dirty;
+};
+
+static const unsigned char acn_packet_id[12] = "ASC-E1.17\0\0";
+
+static struct strip strips[MAX_STRIPS];
+static unsigned int num_strips;
+
+static volatile sig_atomic_t stop;
+static time_t artsync_seen;
+
+static unsigned long stat_universes, stat_frames;
+
+static void __attribute__((noreturn)) usage(int exit_code)
+{
+	FILE *s;
+
+	if (exit_code)
+		s = stderr;
+	else
+		s = stdout;
+
+	fprintf(s, "Usage: { -s STRIP@UNIVERSE } ...\n"
+		   "       [ -E ] disable E1.31\n"
+		   "       [ -A ] disable Art-Net\n"
+		   "       [ -v ] print throughput once per second\n"
+		   "       [ -h ]\n"
+		   STRIP_USAGE
+		   "Every strip occupies %u LEDs per universe, starting at UNIVERSE.\n",
+		   LEDS_PER_UNIVERSE);
+
+	exit(exit_code);
+}
+
+static void handle_signal(int sig)
+{
+	stop = 1;
+}
+
+static inline unsigned int be16(const unsigned char *p)
+{
+	return p[0] << 8 | p[1];
+}
+
+static inline unsigned int be32(const unsigned char *p)
+{
+	return (unsigned int)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static time_t now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static void strip_commit(struct strip *s)
+{
+	s->ws.commit(&s->ws);
+	s->received = 0;
+	s->dirty = false;
+	stat_frames++;
+}
+
+static inline bool strip_complete(const struct strip *s)
+{
+	return s->received == (~0ULL >> (64 - s->num_universes));
+}
+
+static void handle_dmx(unsigned int universe, const unsigned char *data,
+		       unsigned int len, unsigned int sync_address)
+{
+	unsigned long long bit;
+	unsigned int i, idx;
+	struct strip *s;
+
+	if (len > DMX_CHANNELS)
+		len = DMX_CHANNELS;
+
+	for (i = 0; i < num_strips; i++) {
+		s = strips + i;
+		if (universe < s->universe ||
+		    universe >= s->universe + s->num_universes)
+			continue;
+
+		idx = universe - s->universe;
+		bit = 1ULL << idx;
+
+		/* The sender started a new frame before the previous one was
+		 * complete, so it will never be. Flush what we have. */
+		if (s->received & bit)
+			strip_commit(s);
+
+		s->ws.set_leds(&s->ws, (const struct led *)data,
+			       idx * LEDS_PER_UNIVERSE, len / 3);
+		s->received |= bit;
+		s->sync_address = sync_address;
+		s->dirty = true;
+
+		if (!sync_address && strip_complete(s))
+			strip_commit(s);
+	}
+
+	stat_universes++;
+}
+
+static void handle_sync(unsigned int sync_address)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_strips; i++)
+		if (strips[i].dirty && strips[i].sync_address == sync_address)
+			strip_commit(strips + i);
+}
+
+static void parse_e131(const unsigned char *buf, unsigned int len)
+{
+	unsigned int count;
+
+	if (len < E131_SYNC_LEN ||
+	    memcmp(buf + 4, acn_packet_id, sizeof(acn_packet_id)))
+		return;
+
+	switch (be32(buf + 18)) {
+	case E131_VECTOR_ROOT_EXTENDED:
+		if (be32(buf + 40) == E131_VECTOR_EXTENDED_SYNC)
+			handle_sync(be16(buf + 45));
+		return;
+	case E131_VECTOR_ROOT_DATA:
+		break;
+	default:
+		return;
+	}
+
+	if (len < E131_DATA_OFFSET ||
+	    be32(buf + 40) != E131_VECTOR_DATA_PACKET ||
+	    buf[112] & E131_OPT_PREVIEW ||
+	    buf[117] != E131_VECTOR_DMP_SET_PROPERTY ||
+	    buf[125] != 0 /* DMX start code */)
+		return;
+
+	/* property value count includes the start code */
+	count = be16(buf + 123);
+	if (!count)
+		return;
+	count = count - 1;
+	if (count > len - E131_DATA_OFFSET)
+		count = len - E131_DATA_OFFSET;
+
+	handle_dmx(be16(buf + 113), buf + E131_DATA_OFFSET, count,
+		   be16(buf + 109));
+}
+
+static void parse_artnet(const unsigned char *buf, unsigned int len)
+{
+	unsigned int count, sync_address;
+
+	if (len < 10 || memcmp(buf, "Art-Net", 8))
+		return;
+
+	switch (buf[8] | buf[9] << 8) {
+	case ARTNET_OP_SYNC:
+		artsync_seen = now_sec();
+		handle_sync(ARTNET_SYNC_ADDRESS);
+		break;
+	case ARTNET_OP_DMX:
+		if (len < ARTNET_DATA_OFFSET)
+			return;
+
+		count = be16(buf + 16);
+		if (count > len - ARTNET_DATA_OFFSET)
+			count = len - ARTNET_DATA_OFFSET;
+
+		sync_address = 0;
+		if (artsync_seen &&
+		    now_sec() - artsync_seen < ARTNET_SYNC_TIMEOUT)
+			sync_address = ARTNET_SYNC_ADDRESS;
+
+		handle_dmx(buf[14] | (buf[15] & 0x7f) << 8,
+			   buf + ARTNET_DATA_OFFSET, count, sync_address);
+		break;
+	}
+}
+
+static int open_socket(unsigned short port, bool multicast)
+{
+	struct sockaddr_in addr;
+	struct ip_mreq mreq;
+	unsigned int i, u;
+	int fd, err, one = 1;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd == -1)
+		return -errno;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)))
+		goto errno_out;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)))
+		goto errno_out;
+
+	if (!multicast)
+		return fd;
+
+	/* E1.31 universes are multicast to 239.255.{universe} */
+	mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+	for (i = 0; i < num_strips; i++)
+		for (u = strips[i].universe;
+		     u < strips[i].universe + strips[i].num_universes; u++) {
+			mreq.imr_multiaddr.s_addr =
+				htonl(0xefff0000 | (u & 0xffff));
+			/* Not fatal: unicast still works without a route */
+			if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+				       &mreq, sizeof(mreq)))
+				fprintf(stderr, "unable to join universe %u: "
+					"%s\n", u, strerror(errno));
+		}
+
+	return fd;
+
+errno_out:
+	err = -errno;
+	close(fd);
+	return err;
+}
+
+static int add_strip(char *arg)
+{
+	struct strip *s;
+	char *at;
+	int err;
+
+	if (num_strips == MAX_STRIPS)
+		return -ENOSPC;
+
+	at = strrchr(arg, '@');
+	if (!at)
+		return -EINVAL;
+	*at++ = 0;
+
+	s = strips + num_strips;
+	s->universe = atoi(at);
+
+	err = strip_open(arg, &s->ws);
+	if (err)
+		return err;
+
+	s->num_universes = (s->ws.num_leds + LEDS_PER_UNIVERSE - 1) /
+			   LEDS_PER_UNIVERSE;
+	if (!s->num_universes ||
+	    s->num_universes > MAX_UNIVERSES_PER_STRIP) {
+		s->ws.free(&s->ws);
+		return -ERANGE;
+	}
+
+	num_strips++;
+
+	return 0;
+}
+
+static void receive(int fd, void (*parse)(const unsigned char *, unsigned int))
+{
+	static unsigned char buffers[BATCH_SIZE][PACKET_MAX];
+	static struct mmsghdr msgs[BATCH_SIZE];
+	static struct iovec iovecs[BATCH_SIZE];
+	int i, n;
+
+	for (i = 0; i < BATCH_SIZE; i++) {
+		iovecs[i].iov_base = buffers[i];
+		iovecs[i].iov_len = PACKET_MAX;
+		msgs[i].msg_hdr.msg_iov = iovecs + i;
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	do {
+		n = recvmmsg(fd, msgs, BATCH_SIZE, MSG_DONTWAIT, NULL);
+		for (i = 0; i < n; i++)
+			parse(buffers[i], msgs[i].msg_len);
+	} while (n == BATCH_SIZE);
+}
+
+int main(int argc, char **argv)
+{
+	void (*parsers[2])(const unsigned char *, unsigned int);
+	bool e131 = true, artnet = true, verbose = false;
+	struct pollfd fds[2];
+	unsigned int i, nfds;
+	time_t now, last_report;
+	int option, err;
+
+	while ((option = getopt(argc, argv, "s:EAvh")) != -1) {
+		switch (option) {
+			case 's':
+				err = add_strip(optarg);
+				if (err) {
+					fprintf(stderr, "initialising strip %s: "
+						"%s\n", optarg, strerror(-err));
+					goto free_out;
+				}
+				break;
+			case 'E':
+				e131 = false;
+				break;
+			case 'A':
+				artnet = false;
+				break;
+			case 'v':
+				verbose = true;
+				break;
+			case 'h':
+				usage(0);
+			default:
+				usage(-1);
+		}
+	}
+
+	if (!num_strips || !(e131 || artnet))
+		usage(-EINVAL);
+
+	nfds = 0;
+	if (e131) {
+		parsers[nfds] = parse_e131;
+		fds[nfds++].fd = open_socket(E131_PORT, true);
+	}
+	if (artnet) {
+		parsers[nfds] = parse_artnet;
+		fds[nfds++].fd = open_socket(ARTNET_PORT, false);
+	}
+
+	for (i = 0; i < nfds; i++) {
+		if (fds[i].fd < 0) {
+			err = fds[i].fd;
+			fprintf(stderr, "opening socket: %s\n", strerror(-err));
+			goto close_out;
+		}
+		fds[i].events = POLLIN;
+	}
+
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+
+	last_report = now_sec();
+	err = 0;
+	while (!stop) {
+		if (poll(fds, nfds, 1000) == -1) {
+			if (errno == EINTR)
+				continue;
+			err = -errno;
+			break;
+		}
+
+		for (i = 0; i < nfds; i++)
+			if (fds[i].revents & POLLIN)
+				receive(fds[i].fd, parsers[i]);
+
+		now = now_sec();
+		if (verbose && now != last_report) {
+			printf("%lu universes/s, %lu frames/s\n",
+			       stat_universes / (now - last_report),
+			       stat_frames / (now - last_report));
+			stat_universes = stat_frames = 0;
+			last_report = now;
+		}
+	}
+
+close_out:
+	for (i = 0; i < nfds; i++)
+		if (fds[i].fd >= 0)
+			close(fds[i].fd);
+
+free_out:
+	for (i = 0; i < num_strips; i++)
+		strips[i].ws.free(&strips[i].ws);
+
+	return err;
+}
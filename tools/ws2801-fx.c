@@ -0,0 +1,156 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ws2801.h>
+
+#include "strip.h"
+
+#define DEFAULT_FPS 50
+
+static volatile sig_atomic_t stop, next;
+
+static void __attribute__((noreturn)) usage(int exit_code)
+{
+	FILE *s;
+
+	if (exit_code)
+		s = stderr;
+	else
+		s = stdout;
+
+	fprintf(s, "Usage: -s STRIP [ -f FPS (%u) ] [ -t SECONDS ] [ -v ] "
+		   "[ -h ] EFFECT...\n"
+		   "       -t: switch to the next effect every SECONDS\n"
+		   "       -v: print render times once per second\n"
+		   "EFFECT is the path of an effect plugin.  SIGUSR1 switches to "
+		   "the next effect.\n"
+		   STRIP_USAGE, DEFAULT_FPS);
+
+	exit(exit_code);
+}
+
+static void handle_signal(int sig)
+{
+	if (sig == SIGUSR1)
+		next = 1;
+	else
+		stop = 1;
+}
+
+static int load(struct ws2801_host *host, const char *path)
+{
+	int err;
+
+	err = ws2801_host_load(host, path);
+	if (err)
+		fprintf(stderr, "loading %s: %s\n", path, strerror(-err));
+
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int fps = DEFAULT_FPS, seconds = 0, elapsed = 0;
+	int option, err, current, running, num_effects;
+	const char *strip = NULL;
+	struct ws2801_driver ws;
+	struct ws2801_host host;
+	bool verbose = false;
+	char **effects;
+
+	while ((option = getopt(argc, argv, "s:f:t:vh")) != -1) {
+		switch (option) {
+			case 's':
+				strip = optarg;
+				break;
+			case 'f':
+				fps = atoi(optarg);
+				break;
+			case 't':
+				seconds = atoi(optarg);
+				break;
+			case 'v':
+				verbose = true;
+				break;
+			case 'h':
+				usage(0);
+			default:
+				usage(-1);
+		}
+	}
+
+	if (!strip || optind == argc)
+		usage(-EINVAL);
+
+	effects = argv + optind;
+	num_effects = argc - optind;
+
+	err = strip_open(strip, &ws);
+	if (err) {
+		fprintf(stderr, "initialising strip %s: %s\n", strip,
+			strerror(-err));
+		return err;
+	}
+
+	err = ws2801_host_init(&host, &ws, fps);
+	if (err) {
+		fprintf(stderr, "initialising effect host: %s\n",
+			strerror(-err));
+		goto free_out;
+	}
+
+	current = running = 0;
+	err = load(&host, effects[current]);
+	if (err)
+		goto host_out;
+
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+	signal(SIGUSR1, handle_signal);
+
+	while (!stop) {
+		/* Interrupted by signals */
+		sleep(1);
+		elapsed++;
+
+		if (verbose)
+			printf("%s: render %llu us, max %llu us\n",
+			       effects[running], host.render_last / 1000,
+			       host.render_max / 1000);
+
+		if (next || (seconds && elapsed >= seconds)) {
+			next = 0;
+			elapsed = 0;
+			/* A broken effect is skipped, the last one keeps
+			 * running */
+			current = (current + 1) % num_effects;
+			if (!load(&host, effects[current]))
+				running = current;
+		}
+	}
+
+host_out:
+	ws2801_host_free(&host);
+
+free_out:
+	ws.free(&ws);
+
+	return err;
+}
@@ -0,0 +1,403 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <ws2801.h>
+
+#include "strip.h"
+
+#define OPC_DEFAULT_PORT 7890
+#define OPC_HEADER_LEN 4
+#define OPC_MAX_PAYLOAD 65535
+
+#define OPC_CMD_SET_PIXELS 0
+
+#define MAX_STRIPS 32
+#define MAX_EVENTS 64
+
+/* Bytes read from one client per readiness event, enough for one message of
+ * any size. Clients that send faster stay ready and are served again on the
+ * next round, after all other ready clients and the timer. */
+#define CLIENT_READ_BUDGET (OPC_HEADER_LEN + OPC_MAX_PAYLOAD)
+
+struct client {
+	int fd;
+	unsigned int got;
+	unsigned char header[OPC_HEADER_LEN];
+	/* struct led is three bytes, exactly like an OPC pixel, so payloads
+	 * are received here and handed to set_leds() as they are */
+	struct led payload[OPC_MAX_PAYLOAD / sizeof(struct led) + 1];
+};
+
+static struct ws2801_driver strips[MAX_STRIPS];
+static bool dirty[MAX_STRIPS];
+static unsigned long long dirty_since[MAX_STRIPS];
+static unsigned int num_strips;
+
+static volatile sig_atomic_t stop;
+
+static unsigned long stat_messages, stat_commits;
+static unsigned long long stat_latency_sum, stat_latency_max;
+
+static void __attribute__((noreturn)) usage(int exit_code)
+{
+	FILE *s;
+
+	if (exit_code)
+		s = stderr;
+	else
+		s = stdout;
+
+	fprintf(s, "Usage: { -s STRIP } ...\n"
+		   "       [ -p PORT (%u) ]\n"
+		   "       [ -f MAX_FPS (0: commit every message) ]\n"
+		   "       [ -v ] print statistics once per second\n"
+		   "       [ -h ]\n"
+		   STRIP_USAGE
+		   "The n-th strip is OPC channel n, channel 0 addresses all "
+		   "strips.\n", OPC_DEFAULT_PORT);
+
+	exit(exit_code);
+}
+
+static void handle_signal(int sig)
+{
+	stop = 1;
+}
+
+static unsigned long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void commit(unsigned int strip, unsigned long long received)
+{
+	unsigned long long latency;
+
+	strips[strip].commit(strips + strip);
+	dirty[strip] = false;
+
+	latency = now_us() - received;
+	stat_latency_sum += latency;
+	if (latency > stat_latency_max)
+		stat_latency_max = latency;
+	stat_commits++;
+}
+
+static void handle_message(struct client *c, unsigned int len, bool capped)
+{
+	unsigned int channel = c->header[0];
+	unsigned long long received = now_us();
+	unsigned int i, first, last;
+
+	stat_messages++;
+
+	if (c->header[1] != OPC_CMD_SET_PIXELS)
+		return;
+
+	if (channel) {
+		if (channel > num_strips)
+			return;
+		first = last = channel - 1;
+	} else {
+		first = 0;
+		last = num_strips - 1;
+	}
+
+	for (i = first; i <= last; i++) {
+		strips[i].set_leds(strips + i, c->payload, 0,
+				   len / sizeof(struct led));
+		if (capped) {
+			if (!dirty[i])
+				dirty_since[i] = received;
+			dirty[i] = true;
+		} else {
+			commit(i, received);
+		}
+	}
+}
+
+/* Returns false if the client should be dropped */
+static bool client_read(struct client *c, bool capped)
+{
+	ssize_t ret, budget = CLIENT_READ_BUDGET;
+	unsigned int len;
+
+	while (budget > 0) {
+		if (c->got < OPC_HEADER_LEN) {
+			ret = read(c->fd, c->header + c->got,
+				   OPC_HEADER_LEN - c->got);
+		} else {
+			len = c->header[2] << 8 | c->header[3];
+			ret = read(c->fd, (unsigned char *)c->payload +
+				   c->got - OPC_HEADER_LEN,
+				   len + OPC_HEADER_LEN - c->got);
+		}
+
+		if (ret == 0)
+			return false;
+		if (ret == -1)
+			return errno == EAGAIN || errno == EINTR;
+
+		budget -= ret;
+		c->got += ret;
+		if (c->got < OPC_HEADER_LEN)
+			continue;
+
+		len = c->header[2] << 8 | c->header[3];
+		if (c->got == len + OPC_HEADER_LEN) {
+			handle_message(c, len, capped);
+			c->got = 0;
+		}
+	}
+
+	return true;
+}
+
+static int open_listener(unsigned short port)
+{
+	struct sockaddr_in addr;
+	int fd, err, one = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd == -1)
+		return -errno;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)))
+		goto errno_out;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(fd, 16))
+		goto errno_out;
+
+	return fd;
+
+errno_out:
+	err = -errno;
+	close(fd);
+	return err;
+}
+
+static int open_frame_timer(unsigned int fps)
+{
+	unsigned long period = 1000000000UL / fps;
+	struct itimerspec its;
+	int fd, err;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (fd == -1)
+		return -errno;
+
+	its.it_interval.tv_sec = period / 1000000000UL;
+	its.it_interval.tv_nsec = period % 1000000000UL;
+	its.it_value = its.it_interval;
+
+	if (timerfd_settime(fd, 0, &its, NULL)) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+
+	return fd;
+}
+
+static void accept_clients(int epfd, int listen_fd)
+{
+	struct epoll_event ev;
+	struct client *c;
+	int fd, one = 1;
+
+	while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK)) != -1) {
+		c = malloc(sizeof(*c));
+		if (!c) {
+			close(fd);
+			continue;
+		}
+
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		c->fd = fd;
+		c->got = 0;
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) {
+			close(fd);
+			free(c);
+		}
+	}
+}
+
+static void print_stats(unsigned long long elapsed_us)
+{
+	printf("%llu messages/s, %llu commits/s, latency avg %llu us, "
+	       "max %llu us\n",
+	       stat_messages * 1000000ULL / elapsed_us,
+	       stat_commits * 1000000ULL / elapsed_us,
+	       stat_commits ? stat_latency_sum / stat_commits : 0,
+	       stat_latency_max);
+
+	stat_messages = stat_commits = 0;
+	stat_latency_sum = stat_latency_max = 0;
+}
+
+int main(int argc, char **argv)
+{
+	int listen_fd = -1, timer_fd = -1, epfd = -1;
+	unsigned short port = OPC_DEFAULT_PORT;
+	unsigned long long last_report, now;
+	struct epoll_event ev, events[MAX_EVENTS];
+	unsigned int fps = 0, i;
+	uint64_t expirations;
+	bool verbose = false;
+	int option, err, n;
+	struct client *c;
+
+	while ((option = getopt(argc, argv, "s:p:f:vh")) != -1) {
+		switch (option) {
+			case 's':
+				if (num_strips == MAX_STRIPS)
+					usage(-ENOSPC);
+				err = strip_open(optarg, strips + num_strips);
+				if (err) {
+					fprintf(stderr, "initialising strip %s: "
+						"%s\n", optarg, strerror(-err));
+					goto free_out;
+				}
+				num_strips++;
+				break;
+			case 'p':
+				port = atoi(optarg);
+				break;
+			case 'f':
+				fps = atoi(optarg);
+				break;
+			case 'v':
+				verbose = true;
+				break;
+			case 'h':
+				usage(0);
+			default:
+				usage(-1);
+		}
+	}
+
+	if (!num_strips)
+		usage(-EINVAL);
+
+	epfd = epoll_create1(0);
+	if (epfd == -1) {
+		err = -errno;
+		goto free_out;
+	}
+
+	listen_fd = open_listener(port);
+	if (listen_fd < 0) {
+		err = listen_fd;
+		fprintf(stderr, "listening on port %u: %s\n", port,
+			strerror(-err));
+		goto close_out;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = &listen_fd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+
+	if (fps) {
+		timer_fd = open_frame_timer(fps);
+		if (timer_fd < 0) {
+			err = timer_fd;
+			goto close_out;
+		}
+		ev.data.ptr = &timer_fd;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, timer_fd, &ev);
+	}
+
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	last_report = now_us();
+	err = 0;
+	while (!stop) {
+		n = epoll_wait(epfd, events, MAX_EVENTS, 1000);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			err = -errno;
+			break;
+		}
+
+		while (n--) {
+			if (events[n].data.ptr == &listen_fd) {
+				accept_clients(epfd, listen_fd);
+			} else if (events[n].data.ptr == &timer_fd) {
+				if (read(timer_fd, &expirations,
+					 sizeof(expirations)) == -1)
+					continue;
+				for (i = 0; i < num_strips; i++)
+					if (dirty[i])
+						commit(i, dirty_since[i]);
+			} else {
+				c = events[n].data.ptr;
+				if (client_read(c, fps))
+					continue;
+				close(c->fd);
+				free(c);
+			}
+		}
+
+		now = now_us();
+		if (verbose && now - last_report >= 1000000) {
+			print_stats(now - last_report);
+			last_report = now;
+		}
+	}
+
+close_out:
+	if (timer_fd >= 0)
+		close(timer_fd);
+	if (listen_fd >= 0)
+		close(listen_fd);
+	if (epfd >= 0)
+		close(epfd);
+
+free_out:
+	for (i = 0; i < num_strips; i++)
+		strips[i].free(strips + i);
+
+	return err;
+}
@@ -0,0 +1,166 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ws2801.h>
+
+#include "strip.h"
+
+static volatile sig_atomic_t stop;
+
+static void __attribute__((noreturn)) usage(int exit_code)
+{
+	FILE *s;
+
+	if (exit_code)
+		s = stderr;
+	else
+		s = stdout;
+
+	fprintf(s, "Usage: { -s STRIP } [ -l ] [ -h ] FILE\n"
+		   "       -l: loop forever\n"
+		   STRIP_USAGE);
+
+	exit(exit_code);
+}
+
+static void handle_signal(int sig)
+{
+	stop = 1;
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(unsigned long long ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+/* Duration of the show. The last frame is shown for one frame period.
+ * Returns ULLONG_MAX if the time of the last frame can't be read. */
+static unsigned long long show_length(const struct ws2801_seq *seq)
+{
+	unsigned long long last = ws2801_seq_time(seq, seq->num_frames - 1);
+
+	if (last == ULLONG_MAX)
+		return last;
+	if (seq->fps)
+		return last + 1000000000ULL / seq->fps;
+	if (seq->num_frames > 1)
+		return last + last / (seq->num_frames - 1);
+	return last;
+}
+
+int main(int argc, char **argv)
+{
+	const char *strip = NULL;
+	unsigned long long start, ts, length;
+	struct ws2801_driver ws;
+	struct ws2801_seq seq;
+	bool loop = false;
+	unsigned int frame;
+	int option, err;
+
+	while ((option = getopt(argc, argv, "s:lh")) != -1) {
+		switch (option) {
+			case 's':
+				strip = optarg;
+				break;
+			case 'l':
+				loop = true;
+				break;
+			case 'h':
+				usage(0);
+			default:
+				usage(-1);
+		}
+	}
+
+	if (!strip || optind != argc - 1)
+		usage(-EINVAL);
+
+	err = ws2801_seq_open(&seq, argv[optind]);
+	if (err) {
+		fprintf(stderr, "opening %s: %s\n", argv[optind],
+			strerror(-err));
+		return err;
+	}
+
+	if (!seq.num_frames)
+		goto close_out;
+
+	err = strip_open(strip, &ws);
+	if (err) {
+		fprintf(stderr, "initialising strip %s: %s\n", strip,
+			strerror(-err));
+		goto close_out;
+	}
+
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+
+	/* Frames are scheduled on absolute time, so delays don't add up */
+	start = now_ns();
+	do {
+		for (frame = 0; frame < seq.num_frames && !stop; frame++) {
+			err = ws2801_seq_load(&seq, &ws, frame);
+			if (err)
+				break;
+
+			ts = ws2801_seq_time(&seq, frame);
+			if (ts == ULLONG_MAX) {
+				err = -EIO;
+				break;
+			}
+
+			sleep_until(start + ts);
+			ws.commit(&ws);
+		}
+		if (err)
+			break;
+
+		length = show_length(&seq);
+		if (length == ULLONG_MAX) {
+			err = -EIO;
+			break;
+		}
+		start += length;
+	} while (loop && !stop);
+	if (err)
+		fprintf(stderr, "playing %s: %s\n", argv[optind],
+			strerror(-err));
+
+	ws.free(&ws);
+
+close_out:
+	ws2801_seq_close(&seq);
+
+	return err;
+}
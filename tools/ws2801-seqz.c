@@ -0,0 +1,217 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ws2801-seq.h"
+
+#define DEFAULT_KEYFRAME_INTERVAL 300
+
+/* Runs of changed bytes are only split at this many unchanged bytes. For
+ * shorter gaps, storing the zeros is cheaper than starting a new run. */
+#define MIN_GAP 3
+
+static void __attribute__((noreturn)) usage(int exit_code)
+{
+	FILE *s;
+
+	if (exit_code)
+		s = stderr;
+	else
+		s = stdout;
+
+	fprintf(s, "Usage: [ -k KEYFRAME_INTERVAL (%u) ] [ -h ] INPUT OUTPUT\n"
+		   "       Compresses a raw frame sequence\n",
+		DEFAULT_KEYFRAME_INTERVAL);
+
+	exit(exit_code);
+}
+
+static size_t put_varint(unsigned char *p, size_t value)
+{
+	size_t len = 0;
+
+	do {
+		p[len] = value & 0x7f;
+		value >>= 7;
+		if (value)
+			p[len] |= 0x80;
+		len++;
+	} while (value);
+
+	return len;
+}
+
+/* Encodes the XOR of frame and prev, returns the size of the payload */
+static size_t encode(unsigned char *out, const unsigned char *prev,
+		     const unsigned char *frame, size_t size)
+{
+	size_t pos = 0, start, last, i, len = 0;
+
+	for (;;) {
+		start = pos;
+		while (pos < size && prev[pos] == frame[pos])
+			pos++;
+		if (pos == size)
+			break;
+
+		last = pos;
+		for (i = pos + 1; i < size && i - last <= MIN_GAP; i++)
+			if (prev[i] != frame[i])
+				last = i;
+
+		len += put_varint(out + len, pos - start);
+		len += put_varint(out + len, last + 1 - pos);
+		for (; pos <= last; pos++)
+			out[len++] = prev[pos] ^ frame[pos];
+	}
+
+	return len;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int interval = DEFAULT_KEYFRAME_INTERVAL, num_frames, i;
+	unsigned char *prev, *black, *frame, *out;
+	size_t frame_size, len, raw = 0, packed = 0;
+	struct ws2801_seq_header hdr;
+	FILE *in, *dst = NULL;
+	bool timestamps;
+	int option, err;
+	uint32_t size;
+	uint64_t ts;
+
+	while ((option = getopt(argc, argv, "k:h")) != -1) {
+		switch (option) {
+			case 'k':
+				interval = strtoul(optarg, NULL, 10);
+				break;
+			case 'h':
+				usage(0);
+			default:
+				usage(-1);
+		}
+	}
+
+	if (!interval || optind != argc - 2)
+		usage(-EINVAL);
+
+	in = fopen(argv[optind], "r");
+	if (!in) {
+		err = -errno;
+		fprintf(stderr, "opening %s: %s\n", argv[optind],
+			strerror(-err));
+		return err;
+	}
+
+	err = -EINVAL;
+	if (fread(&hdr, sizeof(hdr), 1, in) != 1 ||
+	    memcmp(hdr.magic, WS2801_SEQ_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.version != WS2801_SEQ_VERSION || !hdr.num_leds ||
+	    le16toh(hdr.flags) & WS2801_SEQ_COMPRESSED) {
+		fprintf(stderr, "%s: not a raw frame sequence\n", argv[optind]);
+		goto close_out;
+	}
+
+	timestamps = le16toh(hdr.flags) & WS2801_SEQ_TIMESTAMPS;
+	num_frames = le32toh(hdr.num_frames);
+	frame_size = le32toh(hdr.num_leds) * 3;
+
+	prev = calloc(1, frame_size);
+	black = calloc(1, frame_size);
+	frame = malloc(frame_size);
+	/* Every run costs at most two 5-byte varints, and is followed by more
+	 * than MIN_GAP unchanged bytes, so this is plenty */
+	out = malloc(frame_size * 4 + 16);
+	if (!prev || !black || !frame || !out) {
+		err = -ENOMEM;
+		goto free_out;
+	}
+
+	dst = fopen(argv[optind + 1], "w");
+	if (!dst) {
+		err = -errno;
+		fprintf(stderr, "opening %s: %s\n", argv[optind + 1],
+			strerror(-err));
+		goto free_out;
+	}
+
+	hdr.flags = htole16(le16toh(hdr.flags) | WS2801_SEQ_COMPRESSED);
+	if (fwrite(&hdr, sizeof(hdr), 1, dst) != 1)
+		goto write_err;
+
+	/* Unfinished recordings end with the last complete frame */
+	for (i = 0; !num_frames || i < num_frames; i++) {
+		if (timestamps && fread(&ts, sizeof(ts), 1, in) != 1)
+			break;
+		if (fread(frame, frame_size, 1, in) != 1)
+			break;
+
+		if (i % interval) {
+			out[0] = WS2801_SEQ_DELTA;
+			len = encode(out + 1, prev, frame, frame_size);
+		} else {
+			out[0] = WS2801_SEQ_KEYFRAME;
+			len = encode(out + 1, black, frame, frame_size);
+		}
+		memcpy(prev, frame, frame_size);
+
+		size = htole32(len);
+		if ((timestamps && fwrite(&ts, sizeof(ts), 1, dst) != 1) ||
+		    fwrite(&size, sizeof(size), 1, dst) != 1 ||
+		    fwrite(out, len + 1, 1, dst) != 1)
+			goto write_err;
+
+		raw += frame_size;
+		packed += len + WS2801_SEQ_RECORD_HEADER_SIZE;
+	}
+
+	if (num_frames && i != num_frames) {
+		fprintf(stderr, "%s: truncated after %u frames\n", argv[optind],
+			i);
+		goto dst_out;
+	}
+
+	hdr.num_frames = htole32(i);
+	if (fseek(dst, 0, SEEK_SET) ||
+	    fwrite(&hdr, sizeof(hdr), 1, dst) != 1)
+		goto write_err;
+
+	printf("%u frames, %zu -> %zu bytes\n", i, raw, packed);
+	err = 0;
+	goto dst_out;
+
+write_err:
+	err = -EIO;
+	fprintf(stderr, "writing %s: %s\n", argv[optind + 1], strerror(-err));
+
+dst_out:
+	if (fclose(dst) && !err)
+		err = -errno;
+
+free_out:
+	free(out);
+	free(frame);
+	free(black);
+	free(prev);
+
+close_out:
+	fclose(in);
+
+	return err;
+}
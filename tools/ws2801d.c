@@ -0,0 +1,543 @@
+/*
+ * ws2801 - WS2801 LED driver running in Linux userspace
+ *
+ * Copyright (c) - Ralf Ramsauer, 2017
+ *
+ * Authors:
+ *   Ralf Ramsauer <ralf.ramsauer@oth-regensburg.de>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <ws2801.h>
+
+#include "strip.h"
+#include "ws2801-shm.h"
+
+#define MAX_STRIPS 32
+#define MAX_EVENTS 32
+
+enum watch_type {
+	WATCH_LISTEN,
+	WATCH_SOCKET,
+	WATCH_EVENT,
+};
+
+struct watch {
+	enum watch_type type;
+	struct client *client;
+};
+
+struct strip {
+	char name[WS2801D_NAME_MAX];
+	struct ws2801_driver ws;
+};
+
+struct client {
+	struct watch sock_watch;
+	struct watch event_watch;
+	int sock;
+	int efd;
+	struct strip *strip;
+	struct ws2801_shm_ring *ring;
+	size_t ring_size;
+	/* Size of the ring's slots at attach time. Never taken from the ring,
+	 * which the client may scribble on. */
+	unsigned int num_leds;
+	unsigned int seq;
+	/* Dead clients are freed after the current batch of events */
+	bool dead;
+	struct client *next_dead;
+};
+
+static struct strip strips[MAX_STRIPS];
+static unsigned int num_strips;
+
+static struct ws2801_sched sched;
+static bool use_sched;
+
+static int epfd;
+static volatile sig_atomic_t stop;
+static volatile sig_atomic_t dump_stats;
+
+static void __attribute__((noreturn)) usage(int exit_code)
+{
+	FILE *s;
+
+	if (exit_code)
+		s = stderr;
+	else
+		s = stdout;
+
+	fprintf(s, "Usage: { -s NAME=STRIP } ...\n"
+		   "       [ -S SOCKET (" WS2801D_SOCKET ") ]\n"
+		   "       [ -w WORKERS (refresh strips with a shared "
+		   "scheduler) ]\n"
+		   "       [ -h ]\n"
+		   STRIP_USAGE);
+
+	exit(exit_code);
+}
+
+static void handle_signal(int sig)
+{
+	if (sig == SIGUSR1)
+		dump_stats = 1;
+	else
+		stop = 1;
+}
+
+static void print_stats(void)
+{
+	struct ws2801_stats st;
+	unsigned int i;
+
+	for (i = 0; i < num_strips; i++) {
+		if (strips[i].ws.get_stats(&strips[i].ws, &st))
+			continue;
+		fprintf(stderr, "%s: %llu frames, tx %llu/%llu/%lluus "
+			"(min/avg/max), jitter %lluus, latency %llu/%lluus "
+			"(avg/max)\n", strips[i].name, st.frames,
+			st.tx_min / 1000, st.tx_avg / 1000, st.tx_max / 1000,
+			st.tx_jitter / 1000, st.latency_avg / 1000,
+			st.latency_max / 1000);
+		if (st.power_ma)
+			fprintf(stderr, "%s: %llumA, scale %u/%u, %llu frames "
+				"limited\n", strips[i].name, st.power_ma,
+				st.power_scale, WS2801_POWER_SCALE_NONE,
+				st.frames_limited);
+	}
+}
+
+static int add_strip(char *arg)
+{
+	struct strip *s;
+	char *eq;
+	int err;
+
+	if (num_strips == MAX_STRIPS)
+		return -ENOSPC;
+
+	eq = strchr(arg, '=');
+	if (!eq || eq - arg >= WS2801D_NAME_MAX)
+		return -EINVAL;
+	*eq++ = 0;
+
+	s = strips + num_strips;
+	strcpy(s->name, arg);
+
+	err = strip_open(eq, &s->ws);
+	if (err)
+		return err;
+
+	num_strips++;
+
+	return 0;
+}
+
+static struct strip *find_strip(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_strips; i++)
+		if (!strncmp(strips[i].name, name, WS2801D_NAME_MAX))
+			return strips + i;
+
+	return NULL;
+}
+
+static int send_reply(int sock, int err, unsigned int num_leds, int *fds)
+{
+	char control[CMSG_SPACE(2 * sizeof(int))];
+	struct ws2801d_reply reply = {
+		.err = err,
+		.num_leds = num_leds,
+	};
+	struct iovec iov = {
+		.iov_base = &reply,
+		.iov_len = sizeof(reply),
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	struct cmsghdr *cmsg;
+
+	if (fds) {
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, 2 * sizeof(int));
+	}
+
+	if (sendmsg(sock, &msg, 0) == -1)
+		return -errno;
+
+	return 0;
+}
+
+/* Publishes the latest frame of a client, if there is a new one */
+static void client_update(struct client *c)
+{
+	struct ws2801_driver *ws = &c->strip->ws;
+	unsigned int seq;
+
+	for (;;) {
+		seq = atomic_load(&c->ring->seq);
+		if (seq == c->seq)
+			break;
+
+		ws->set_leds(ws, ws2801_shm_slot(c->ring, c->num_leds, seq - 1),
+			     0, c->num_leds);
+
+		/* The client might have lapped us while we were copying. In
+		 * this case, the frame might be torn, so take the next one. */
+		if (atomic_load(&c->ring->seq) - seq >= WS2801_SHM_SLOTS - 1)
+			continue;
+
+		c->seq = seq;
+		ws->commit(ws);
+	}
+}
+
+static void client_wait(struct client *c)
+{
+	uint64_t kicks;
+
+	if (!c->strip)
+		return;
+
+	if (read(c->efd, &kicks, sizeof(kicks)) == -1 && errno != EAGAIN)
+		return;
+
+	for (;;) {
+		client_update(c);
+
+		/* Announce that we are going to sleep and check again, the
+		 * client might have published a frame in the meantime */
+		atomic_store(&c->ring->waiting, 1);
+		if (atomic_load(&c->ring->seq) == c->seq)
+			break;
+		atomic_store(&c->ring->waiting, 0);
+	}
+}
+
+static void client_free(struct client *c)
+{
+	if (c->ring)
+		munmap(c->ring, c->ring_size);
+	if (c->efd != -1)
+		close(c->efd);
+	close(c->sock);
+	free(c);
+}
+
+static int client_attach(struct client *c, const char *name)
+{
+	struct epoll_event ev;
+	struct strip *strip;
+	int err, fds[2];
+
+	if (c->ring)
+		return -EBUSY;
+
+	strip = find_strip(name);
+	if (!strip)
+		return -ENOENT;
+
+	fds[0] = memfd_create("ws2801", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fds[0] == -1)
+		return -errno;
+
+	c->num_leds = strip->ws.num_leds;
+	c->ring_size = ws2801_shm_ring_size(c->num_leds);
+	if (ftruncate(fds[0], c->ring_size)) {
+		err = -errno;
+		goto close_out;
+	}
+
+	/* Clients must not be able to pull the mapping out from under us */
+	if (fcntl(fds[0], F_ADD_SEALS,
+		  F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)) {
+		err = -errno;
+		goto close_out;
+	}
+
+	c->ring = mmap(NULL, c->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		       fds[0], 0);
+	if (c->ring == MAP_FAILED) {
+		c->ring = NULL;
+		err = -errno;
+		goto close_out;
+	}
+	c->ring->num_leds = c->num_leds;
+	atomic_store(&c->ring->waiting, 1);
+
+	c->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (c->efd == -1) {
+		err = -errno;
+		goto close_out;
+	}
+	fds[1] = c->efd;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = &c->event_watch;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, c->efd, &ev)) {
+		err = -errno;
+		goto close_out;
+	}
+
+	err = send_reply(c->sock, 0, c->num_leds, fds);
+	if (!err)
+		c->strip = strip;
+
+close_out:
+	close(fds[0]);
+	return err;
+}
+
+/* Returns false if the client should be dropped */
+static bool client_request(struct client *c)
+{
+	struct ws2801d_request req;
+	ssize_t ret;
+	int err;
+
+	ret = recv(c->sock, &req, sizeof(req), 0);
+	if (ret != sizeof(req))
+		return false;
+
+	switch (req.cmd) {
+	case WS2801D_ATTACH:
+		req.strip[sizeof(req.strip) - 1] = 0;
+		err = client_attach(c, req.strip);
+		if (!err)
+			return true;
+		break;
+	case WS2801D_SET_REFRESH_RATE:
+		err = -ENOENT;
+		if (c->strip)
+			err = c->strip->ws.set_refresh_rate(&c->strip->ws,
+							    req.arg);
+		break;
+	default:
+		err = -EINVAL;
+		break;
+	}
+
+	return !send_reply(c->sock, err, 0, NULL);
+}
+
+static void accept_clients(int listen_fd)
+{
+	struct epoll_event ev;
+	struct client *c;
+	int sock;
+
+	while ((sock = accept4(listen_fd, NULL, NULL,
+			       SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+		c = calloc(1, sizeof(*c));
+		if (!c) {
+			close(sock);
+			continue;
+		}
+
+		c->sock = sock;
+		c->efd = -1;
+		c->sock_watch.type = WATCH_SOCKET;
+		c->sock_watch.client = c;
+		c->event_watch.type = WATCH_EVENT;
+		c->event_watch.client = c;
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = &c->sock_watch;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev))
+			client_free(c);
+	}
+}
+
+static int open_listener(const char *path)
+{
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+	int fd, err;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -EINVAL;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return -errno;
+
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 16)) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+
+	return fd;
+}
+
+int main(int argc, char **argv)
+{
+	struct watch listen_watch = { .type = WATCH_LISTEN };
+	struct epoll_event ev, events[MAX_EVENTS];
+	const char *socket_path = WS2801D_SOCKET;
+	int listen_fd = -1, option, err, n;
+	struct client *c, *dead;
+	struct watch *w;
+	unsigned int i;
+
+	while ((option = getopt(argc, argv, "s:S:w:h")) != -1) {
+		switch (option) {
+			case 's':
+				err = add_strip(optarg);
+				if (err) {
+					fprintf(stderr, "initialising strip %s: "
+						"%s\n", optarg, strerror(-err));
+					goto free_out;
+				}
+				break;
+			case 'S':
+				socket_path = optarg;
+				break;
+			case 'w':
+				if (use_sched)
+					usage(-EINVAL);
+				err = ws2801_sched_init(&sched, atoi(optarg));
+				if (err) {
+					fprintf(stderr, "initialising scheduler: "
+						"%s\n", strerror(-err));
+					goto free_out;
+				}
+				use_sched = true;
+				break;
+			case 'h':
+				usage(0);
+			default:
+				usage(-1);
+		}
+	}
+
+	if (!num_strips)
+		usage(-EINVAL);
+
+	/* Strips that refresh on their own can't be scheduled */
+	for (i = 0; use_sched && i < num_strips; i++) {
+		err = ws2801_sched_add(&sched, &strips[i].ws, 0);
+		if (err && err != -ENOSYS) {
+			fprintf(stderr, "scheduling strip %s: %s\n",
+				strips[i].name, strerror(-err));
+			goto free_out;
+		}
+	}
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd == -1) {
+		err = -errno;
+		goto free_out;
+	}
+
+	listen_fd = open_listener(socket_path);
+	if (listen_fd < 0) {
+		err = listen_fd;
+		fprintf(stderr, "listening on %s: %s\n", socket_path,
+			strerror(-err));
+		goto close_out;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = &listen_watch;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+	signal(SIGUSR1, handle_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	err = 0;
+	while (!stop) {
+		n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+		if (n == -1) {
+			if (errno == EINTR) {
+				if (dump_stats)
+					print_stats();
+				dump_stats = 0;
+				continue;
+			}
+			err = -errno;
+			break;
+		}
+
+		dead = NULL;
+		while (n--) {
+			w = events[n].data.ptr;
+			c = w->client;
+			if (c && c->dead)
+				continue;
+
+			switch (w->type) {
+			case WATCH_LISTEN:
+				accept_clients(listen_fd);
+				break;
+			case WATCH_EVENT:
+				client_wait(c);
+				break;
+			case WATCH_SOCKET:
+				if (client_request(c))
+					break;
+				/* Catch the last frame before the client
+				 * leaves */
+				if (c->strip)
+					client_update(c);
+				c->dead = true;
+				c->next_dead = dead;
+				dead = c;
+				break;
+			}
+		}
+
+		while (dead) {
+			c = dead->next_dead;
+			client_free(dead);
+			dead = c;
+		}
+	}
+
+	unlink(socket_path);
+	close(listen_fd);
+
+close_out:
+	close(epfd);
+
+free_out:
+	if (use_sched)
+		ws2801_sched_free(&sched);
+	for (i = 0; i < num_strips; i++)
+		strips[i].ws.free(&strips[i].ws);
+
+	return err;
+}